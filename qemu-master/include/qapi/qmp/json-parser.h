@@ -17,8 +17,11 @@
 #include "qemu-common.h"
 #include "qapi/qmp/qlist.h"
 #include "qapi/error.h"
+#include "qapi/qmp/json-lexer.h"
 
 QObject *json_parser_parse(QList *tokens, va_list *ap);
 QObject *json_parser_parse_err(QList *tokens, va_list *ap, Error **errp);
+QObject *json_parser_parse_scalar(JSONTokenType type, const char *token,
+                                  Error **errp);
 
 #endif
@@ -16,6 +16,7 @@
 
 #include "qapi/qmp/qlist.h"
 #include "qapi/qmp/json-lexer.h"
+#include "qapi/error.h"
 
 typedef struct JSONMessageParser
 {
@@ -25,11 +26,25 @@ typedef struct JSONMessageParser
     int bracket_count;
     QList *tokens;
     uint64_t token_size;
+    /* direct mode, see json_message_parser_init_direct() */
+    void (*emit_object)(struct JSONMessageParser *parser, QObject *obj,
+                        Error *err);
+    QObject **stack;
+    int depth;
+    int stack_size;
+    int state;
+    QString *key;
+    QObject *result;
+    Error *err;
 } JSONMessageParser;
 
 void json_message_parser_init(JSONMessageParser *parser,
                               void (*func)(JSONMessageParser *, QList *));
 
+void json_message_parser_init_direct(JSONMessageParser *parser,
+                                     void (*func)(JSONMessageParser *,
+                                                  QObject *, Error *));
+
 int json_message_parser_feed(JSONMessageParser *parser,
                              const char *buffer, size_t size);
 
@@ -26,4 +26,10 @@ QObject *qobject_from_jsonv(const char *string, va_list *ap) GCC_FMT_ATTR(1, 0);
 QString *qobject_to_json(const QObject *obj);
 QString *qobject_to_json_pretty(const QObject *obj);
 
+/* receives the JSON text of an object piece by piece, in order */
+typedef void JSONEmitFunc(void *opaque, const char *buf, size_t len);
+
+void qobject_to_json_emit(const QObject *obj, JSONEmitFunc *emit,
+                          void *opaque);
+
 #endif /* QJSON_H */
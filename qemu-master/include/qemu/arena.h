@@ -0,0 +1,80 @@
+/*
+ * Region allocator for short-lived object trees
+ *
+ * Copyright (c) 2015 Red Hat, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_ARENA_H
+#define QEMU_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct QemuArena QemuArena;
+
+/**
+ * qemu_arena_new:
+ * @size: initial size of the region memory is carved from
+ * @max_size: size the region may grow to
+ *
+ * Create an arena. Allocations made through qemu_arena_malloc() and friends
+ * come from the arena while it is current for the calling thread, as long
+ * as they fit in its region, and from the heap otherwise. Freeing arena
+ * memory is a no-op; it is all released in one step by qemu_arena_reset(),
+ * which also grows the region if allocations did not fit.
+ */
+QemuArena *qemu_arena_new(size_t size, size_t max_size);
+
+/**
+ * qemu_arena_destroy:
+ * @arena: arena to free, must not be current for any thread
+ */
+void qemu_arena_destroy(QemuArena *arena);
+
+/**
+ * qemu_arena_reset:
+ * @arena: arena to empty
+ *
+ * Release everything allocated from @arena. Nothing allocated from it may
+ * be referenced afterwards, so objects that must outlive the reset are to
+ * be copied to the heap while no arena is current.
+ */
+void qemu_arena_reset(QemuArena *arena);
+
+/**
+ * qemu_arena_set_current:
+ * @arena: arena to allocate from, or NULL to allocate from the heap
+ *
+ * Select the arena used by the calling thread. Other threads are not
+ * affected and keep allocating from the heap.
+ *
+ * Returns: the arena that was current before.
+ */
+QemuArena *qemu_arena_set_current(QemuArena *arena);
+
+/**
+ * qemu_arena_get_allocs:
+ * @arena: arena to query
+ *
+ * Returns: the number of allocations served by @arena since it was created.
+ */
+uint64_t qemu_arena_get_allocs(QemuArena *arena);
+
+/*
+ * Allocation functions for objects that may live in an arena. Without a
+ * current arena they are g_malloc() and friends, and cost no more than a
+ * check of the current arena. While an arena is current,
+ * qemu_arena_realloc() and qemu_arena_free() also accept heap memory, which
+ * is told apart by its address. Memory from an arena must only be freed
+ * while that arena is current, and never passed to g_free() or g_realloc().
+ */
+void *qemu_arena_malloc(size_t size);
+void *qemu_arena_malloc0(size_t size);
+void *qemu_arena_realloc(void *ptr, size_t size);
+char *qemu_arena_strdup(const char *str);
+void qemu_arena_free(void *ptr);
+
+#endif
@@ -14,6 +14,7 @@
 #include "qapi/dealloc-visitor.h"
 #include "qemu/queue.h"
 #include "qemu-common.h"
+#include "qemu/arena.h"
 #include "qapi/qmp/types.h"
 #include "qapi/visitor-impl.h"
 
@@ -38,7 +39,7 @@ static QapiDeallocVisitor *to_qov(Visitor *v)
 
 static void qapi_dealloc_push(QapiDeallocVisitor *qov, void *value)
 {
-    StackEntry *e = g_malloc0(sizeof(*e));
+    StackEntry *e = qemu_arena_malloc0(sizeof(*e));
 
     e->value = value;
 
@@ -55,7 +56,7 @@ static void *qapi_dealloc_pop(QapiDeallocVisitor *qov)
     QObject *value;
     QTAILQ_REMOVE(&qov->stack, e, node);
     value = e->value;
-    g_free(e);
+    qemu_arena_free(e);
     return value;
 }
 
@@ -72,7 +73,7 @@ static void qapi_dealloc_end_struct(Visitor *v, Error **errp)
     QapiDeallocVisitor *qov = to_qov(v);
     void **obj = qapi_dealloc_pop(qov);
     if (obj) {
-        g_free(*obj);
+        qemu_arena_free(*obj);
     }
 }
 
@@ -90,7 +91,7 @@ static void qapi_dealloc_end_implicit_struct(Visitor *v, Error **errp)
     QapiDeallocVisitor *qov = to_qov(v);
     void **obj = qapi_dealloc_pop(qov);
     if (obj) {
-        g_free(*obj);
+        qemu_arena_free(*obj);
     }
 }
 
@@ -114,7 +115,7 @@ static GenericList *qapi_dealloc_next_list(Visitor *v, GenericList **listp,
 
     if (list) {
         list = list->next;
-        g_free(*listp);
+        qemu_arena_free(*listp);
         return list;
     }
 
@@ -132,7 +133,7 @@ static void qapi_dealloc_type_str(Visitor *v, char **obj, const char *name,
                                   Error **errp)
 {
     if (obj) {
-        g_free(*obj);
+        qemu_arena_free(*obj);
     }
 }
 
@@ -203,14 +204,14 @@ Visitor *qapi_dealloc_get_visitor(QapiDeallocVisitor *v)
 
 void qapi_dealloc_visitor_cleanup(QapiDeallocVisitor *v)
 {
-    g_free(v);
+    qemu_arena_free(v);
 }
 
 QapiDeallocVisitor *qapi_dealloc_visitor_new(void)
 {
     QapiDeallocVisitor *v;
 
-    v = g_malloc0(sizeof(*v));
+    v = qemu_arena_malloc0(sizeof(*v));
 
     v->visitor.start_struct = qapi_dealloc_start_struct;
     v->visitor.end_struct = qapi_dealloc_end_struct;
@@ -12,6 +12,7 @@
  */
 
 #include "qemu-common.h"
+#include "qemu/arena.h"
 #include "qapi/qmp/qobject.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/visitor.h"
@@ -310,10 +311,10 @@ void input_type_enum(Visitor *v, int *obj, const char * const strings[],
 
     if (strings[value] == NULL) {
         error_setg(errp, QERR_INVALID_PARAMETER, enum_str);
-        g_free(enum_str);
+        qemu_arena_free(enum_str);
         return;
     }
 
-    g_free(enum_str);
+    qemu_arena_free(enum_str);
     *obj = value;
 }
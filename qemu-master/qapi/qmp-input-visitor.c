@@ -15,6 +15,7 @@
 #include "qapi/visitor-impl.h"
 #include "qemu/queue.h"
 #include "qemu-common.h"
+#include "qemu/arena.h"
 #include "qapi/qmp/types.h"
 #include "qapi/qmp/qerror.h"
 
@@ -134,7 +135,7 @@ static void qmp_input_start_struct(Visitor *v, void **obj, const char *kind,
     }
 
     if (obj) {
-        *obj = g_malloc0(size);
+        *obj = qemu_arena_malloc0(size);
     }
 }
 
@@ -149,7 +150,7 @@ static void qmp_input_start_implicit_struct(Visitor *v, void **obj,
                                             size_t size, Error **errp)
 {
     if (obj) {
-        *obj = g_malloc0(size);
+        *obj = qemu_arena_malloc0(size);
     }
 }
 
@@ -191,7 +192,7 @@ static GenericList *qmp_input_next_list(Visitor *v, GenericList **list,
         return NULL;
     }
 
-    entry = g_malloc0(sizeof(*entry));
+    entry = qemu_arena_malloc0(sizeof(*entry));
     if (first) {
         *list = entry;
     } else {
@@ -263,7 +264,7 @@ static void qmp_input_type_str(Visitor *v, char **obj, const char *name,
         return;
     }
 
-    *obj = g_strdup(qstring_get_str(qobject_to_qstring(qobj)));
+    *obj = qemu_arena_strdup(qstring_get_str(qobject_to_qstring(qobj)));
 }
 
 static void qmp_input_type_number(Visitor *v, double *obj, const char *name,
@@ -318,14 +319,14 @@ Visitor *qmp_input_get_visitor(QmpInputVisitor *v)
 void qmp_input_visitor_cleanup(QmpInputVisitor *v)
 {
     qobject_decref(v->stack[0].obj);
-    g_free(v);
+    qemu_arena_free(v);
 }
 
 QmpInputVisitor *qmp_input_visitor_new(QObject *obj)
 {
     QmpInputVisitor *v;
 
-    v = g_malloc0(sizeof(*v));
+    v = qemu_arena_malloc0(sizeof(*v));
 
     v->visitor.start_struct = qmp_input_start_struct;
     v->visitor.end_struct = qmp_input_end_struct;
@@ -15,6 +15,7 @@
 #include "qapi/visitor-impl.h"
 #include "qemu/queue.h"
 #include "qemu-common.h"
+#include "qemu/arena.h"
 #include "qapi/qmp/types.h"
 
 typedef struct QStackEntry
@@ -43,7 +44,7 @@ static QmpOutputVisitor *to_qov(Visitor *v)
 
 static void qmp_output_push_obj(QmpOutputVisitor *qov, QObject *value)
 {
-    QStackEntry *e = g_malloc0(sizeof(*e));
+    QStackEntry *e = qemu_arena_malloc0(sizeof(*e));
 
     e->value = value;
     if (qobject_type(e->value) == QTYPE_QLIST) {
@@ -58,7 +59,7 @@ static QObject *qmp_output_pop(QmpOutputVisitor *qov)
     QObject *value;
     QTAILQ_REMOVE(&qov->stack, e, node);
     value = e->value;
-    g_free(e);
+    qemu_arena_free(e);
     return value;
 }
 
@@ -222,18 +223,18 @@ void qmp_output_visitor_cleanup(QmpOutputVisitor *v)
 
     QTAILQ_FOREACH_SAFE(e, &v->stack, node, tmp) {
         QTAILQ_REMOVE(&v->stack, e, node);
-        g_free(e);
+        qemu_arena_free(e);
     }
 
     qobject_decref(root);
-    g_free(v);
+    qemu_arena_free(v);
 }
 
 QmpOutputVisitor *qmp_output_visitor_new(void)
 {
     QmpOutputVisitor *v;
 
-    v = g_malloc0(sizeof(*v));
+    v = qemu_arena_malloc0(sizeof(*v));
 
     v->visitor.start_struct = qmp_output_start_struct;
     v->visitor.end_struct = qmp_output_end_struct;
@@ -18,6 +18,8 @@
 
 static QTAILQ_HEAD(QmpCommandList, QmpCommand) qmp_commands =
     QTAILQ_HEAD_INITIALIZER(qmp_commands);
+/* name lookups; qmp_commands keeps the order of registration */
+static GHashTable *qmp_command_table;
 
 void qmp_register_command(const char *name, QmpCommandFunc *fn,
                           QmpCommandOptions options)
@@ -30,29 +32,30 @@ void qmp_register_command(const char *name, QmpCommandFunc *fn,
     cmd->enabled = true;
     cmd->options = options;
     QTAILQ_INSERT_TAIL(&qmp_commands, cmd, node);
+
+    if (!qmp_command_table) {
+        qmp_command_table = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    /* if a name is registered twice, the first registration wins */
+    if (!g_hash_table_lookup(qmp_command_table, name)) {
+        g_hash_table_insert(qmp_command_table, (gpointer)name, cmd);
+    }
 }
 
 QmpCommand *qmp_find_command(const char *name)
 {
-    QmpCommand *cmd;
-
-    QTAILQ_FOREACH(cmd, &qmp_commands, node) {
-        if (strcmp(cmd->name, name) == 0) {
-            return cmd;
-        }
+    if (!qmp_command_table) {
+        return NULL;
     }
-    return NULL;
+    return g_hash_table_lookup(qmp_command_table, name);
 }
 
 static void qmp_toggle_command(const char *name, bool enabled)
 {
-    QmpCommand *cmd;
+    QmpCommand *cmd = qmp_find_command(name);
 
-    QTAILQ_FOREACH(cmd, &qmp_commands, node) {
-        if (strcmp(cmd->name, name) == 0) {
-            cmd->enabled = enabled;
-            return;
-        }
+    if (cmd) {
+        cmd->enabled = enabled;
     }
 }
 
@@ -81,6 +84,11 @@ bool qmp_has_success_response(const QmpCommand *cmd)
     return !(cmd->options & QCO_NO_SUCCESS_RESP);
 }
 
+bool qmp_command_is_blocking(const QmpCommand *cmd)
+{
+    return cmd->options & QCO_BLOCKING;
+}
+
 void qmp_for_each_command(qmp_cmd_callback_fn fn, void *opaque)
 {
     QmpCommand *cmd;
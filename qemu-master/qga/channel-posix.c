@@ -5,32 +5,66 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include "qemu/osdep.h"
+#include "qemu-common.h"
 #include "qemu/sockets.h"
+#include "qemu/iov.h"
 #include "qga/channel.h"
 
+#include <poll.h>
 #ifdef CONFIG_SOLARIS
 #include <stropts.h>
 #endif
+#ifdef CONFIG_LINUX
+#include <sys/sendfile.h>
+#endif
 
 #define GA_CHANNEL_BAUDRATE_DEFAULT B38400 /* for isa-serial channels */
+/* output a client has not taken yet is queued, up to this much */
+#define GA_CHANNEL_OUTPUT_MAX (4 * 1024 * 1024)
+
+struct GAChannelClient {
+    GAChannel *channel;
+    GIOChannel *client_channel;
+    guint watch;            /* 0 while waiting for a virtio-serial host */
+    gpointer user_data;     /* as returned by the accept callback */
+    guint write_watch;      /* replaces watch while set */
+    GAChannelCallback write_cb;
+    gpointer write_opaque;
+    GQueue output;          /* GByteArrays waiting for the client */
+    gsize output_len;       /* bytes in output */
+    gsize output_offset;    /* into the head of output */
+};
 
 struct GAChannel {
     GIOChannel *listen_channel;
-    GIOChannel *client_channel;
+    guint listen_watch;     /* 0 while not accepting connections */
+    GSList *clients;
+    int nr_clients;
+    int max_clients;
     GAChannelMethod method;
+    GAChannelAcceptCallback accept_cb;
     GAChannelCallback event_cb;
     gpointer user_data;
+    GIOChannel *sigio_channel;  /* NULL if SIGIO could not be set up */
+    guint sigio_watch;
+    guint reconnect_timer;  /* polls a hung up port in that case */
 };
 
+/* how often a hung up virtio-serial port is checked without SIGIO */
+#define GA_CHANNEL_RECONNECT_INTERVAL 1000 /* ms */
+
 static int ga_channel_client_add(GAChannel *c, int fd);
+static bool ga_channel_client_hung_up(GAChannelClient *client);
+static gboolean ga_channel_reconnect_timeout(gpointer opaque);
+static void ga_channel_client_output_clear(GAChannelClient *client);
 
 static gboolean ga_channel_listen_accept(GIOChannel *channel,
                                          GIOCondition condition, gpointer data)
 {
     GAChannel *c = data;
     int ret, client_fd;
-    bool accepted = false;
     struct sockaddr_un addr;
     socklen_t addrlen = sizeof(addr);
 
@@ -49,11 +83,14 @@ static gboolean ga_channel_listen_accept(GIOChannel *channel,
         close(client_fd);
         goto out;
     }
-    accepted = true;
 
 out:
-    /* only accept 1 connection at a time */
-    return !accepted;
+    /* further connections wait in the backlog once we are at the limit */
+    if (c->nr_clients >= c->max_clients) {
+        c->listen_watch = 0;
+        return false;
+    }
+    return true;
 }
 
 /* start polling for readable events on listen fd, new==true
@@ -64,28 +101,44 @@ static void ga_channel_listen_add(GAChannel *c, int listen_fd, bool create)
     if (create) {
         c->listen_channel = g_io_channel_unix_new(listen_fd);
     }
-    g_io_add_watch(c->listen_channel, G_IO_IN, ga_channel_listen_accept, c);
+    c->listen_watch = g_io_add_watch(c->listen_channel, G_IO_IN,
+                                     ga_channel_listen_accept, c);
 }
 
 static void ga_channel_listen_close(GAChannel *c)
 {
     g_assert(c->method == GA_CHANNEL_UNIX_LISTEN);
     g_assert(c->listen_channel);
+    if (c->listen_watch) {
+        g_source_remove(c->listen_watch);
+        c->listen_watch = 0;
+    }
     g_io_channel_shutdown(c->listen_channel, true, NULL);
     g_io_channel_unref(c->listen_channel);
     c->listen_channel = NULL;
 }
 
-/* cleanup state for closed connection/session, start accepting new
- * connections if we're in listening mode
+/* cleanup state for closed connection/session, resume accepting new
+ * connections if we're in listening mode and were at the limit
  */
-static void ga_channel_client_close(GAChannel *c)
+static void ga_channel_client_close(GAChannelClient *client)
 {
-    g_assert(c->client_channel);
-    g_io_channel_shutdown(c->client_channel, true, NULL);
-    g_io_channel_unref(c->client_channel);
-    c->client_channel = NULL;
-    if (c->method == GA_CHANNEL_UNIX_LISTEN && c->listen_channel) {
+    GAChannel *c = client->channel;
+
+    if (client->watch) {
+        g_source_remove(client->watch);
+    }
+    if (client->write_watch) {
+        g_source_remove(client->write_watch);
+    }
+    ga_channel_client_output_clear(client);
+    g_io_channel_shutdown(client->client_channel, true, NULL);
+    g_io_channel_unref(client->client_channel);
+    c->clients = g_slist_remove(c->clients, client);
+    c->nr_clients--;
+    g_free(client);
+    if (c->method == GA_CHANNEL_UNIX_LISTEN && c->listen_channel &&
+        !c->listen_watch) {
         ga_channel_listen_add(c, 0, false);
     }
 }
@@ -93,37 +146,303 @@ static void ga_channel_client_close(GAChannel *c)
 static gboolean ga_channel_client_event(GIOChannel *channel,
                                         GIOCondition condition, gpointer data)
 {
-    GAChannel *c = data;
+    GAChannelClient *client = data;
+    GAChannel *c = client->channel;
     gboolean client_cont;
 
     g_assert(c);
     if (c->event_cb) {
-        client_cont = c->event_cb(condition, c->user_data);
+        client_cont = c->event_cb(condition, client->user_data);
         if (!client_cont) {
-            ga_channel_client_close(c);
+            ga_channel_client_close(client);
             return false;
         }
     }
+    if (c->method == GA_CHANNEL_VIRTIO_SERIAL && (condition & G_IO_HUP)) {
+        /*
+         * The port stays hung up until a host process attaches. One that
+         * attached since the poll may have raised its SIGIO already.
+         */
+        if (!ga_channel_client_hung_up(client)) {
+            return true;
+        }
+        g_debug("virtio-serial host disconnected");
+        client->watch = 0;
+        if (!c->sigio_channel && !c->reconnect_timer) {
+            c->reconnect_timer = g_timeout_add(GA_CHANNEL_RECONNECT_INTERVAL,
+                                               ga_channel_reconnect_timeout,
+                                               c);
+        }
+        return false;
+    }
+    return true;
+}
+
+static void ga_channel_client_output_clear(GAChannelClient *client)
+{
+    GByteArray *data;
+
+    while ((data = g_queue_pop_head(&client->output))) {
+        g_byte_array_free(data, true);
+    }
+    client->output_len = 0;
+    client->output_offset = 0;
+}
+
+/* write out as much of the queued output as the client takes */
+static GIOStatus ga_channel_client_flush(GAChannelClient *client)
+{
+    GByteArray *data;
+    GIOStatus status;
+    gsize count;
+
+    while ((data = g_queue_peek_head(&client->output))) {
+        status = ga_channel_write_some(client, (gchar *)data->data +
+                                       client->output_offset,
+                                       data->len - client->output_offset,
+                                       &count);
+        if (status != G_IO_STATUS_NORMAL) {
+            if (status == G_IO_STATUS_ERROR) {
+                ga_channel_client_output_clear(client);
+            }
+            return status;
+        }
+        client->output_offset += count;
+        client->output_len -= count;
+        if (client->output_offset == data->len) {
+            g_byte_array_free(g_queue_pop_head(&client->output), true);
+            client->output_offset = 0;
+        }
+    }
+    return G_IO_STATUS_NORMAL;
+}
+
+static gboolean ga_channel_client_writable(GIOChannel *channel,
+                                           GIOCondition condition,
+                                           gpointer data)
+{
+    GAChannelClient *client = data;
+    bool hangup = condition & (G_IO_HUP | G_IO_ERR);
+
+    if (!hangup && ga_channel_client_flush(client) == G_IO_STATUS_AGAIN) {
+        return true;
+    }
+    if (client->write_cb &&
+        !client->write_cb(condition, client->write_opaque)) {
+        client->write_cb = NULL;
+    }
+    if (hangup) {
+        /* the input watch sees the hangup and handles it */
+        client->write_cb = NULL;
+        ga_channel_client_output_clear(client);
+    } else if (client->write_cb || !g_queue_is_empty(&client->output)) {
+        return true;
+    }
+    client->write_watch = 0;
+    client->watch = g_io_add_watch(client->client_channel, G_IO_IN | G_IO_HUP,
+                                   ga_channel_client_event, client);
+    return false;
+}
+
+/*
+ * Wait for the client to become writable instead of readable. Nothing is
+ * read from a client that does not take its output, which holds back its
+ * requests until it does.
+ */
+static void ga_channel_client_watch_output(GAChannelClient *client)
+{
+    if (client->write_watch) {
+        return;
+    }
+    if (client->watch) {
+        g_source_remove(client->watch);
+        client->watch = 0;
+    }
+    client->write_watch = g_io_add_watch(client->client_channel,
+                                         G_IO_OUT | G_IO_HUP | G_IO_ERR,
+                                         ga_channel_client_writable, client);
+}
+
+/*
+ * Call @cb from the main loop whenever the client can be written to and
+ * its queued output has gone out, until it returns false. Nothing is read
+ * from the client meanwhile. Called again before that, it replaces the
+ * callback.
+ */
+void ga_channel_client_write_watch(GAChannelClient *client,
+                                   GAChannelCallback cb, gpointer opaque)
+{
+    client->write_cb = cb;
+    client->write_opaque = opaque;
+    ga_channel_client_watch_output(client);
+}
+
+/*
+ * A virtio-serial port polls as hung up (and readable, at EOF) for as
+ * long as no host process has its chardev open. Instead of spinning on
+ * that, the port leaves the main loop until the kernel signals a change
+ * of the host connection with SIGIO, which is passed on to the main loop
+ * through a pipe. Only if SIGIO cannot be set up for the port does a slow
+ * timer check it instead.
+ */
+static int ga_channel_sigio_fd = -1;
+
+static void ga_channel_sigio(int signum)
+{
+    int saved_errno = errno;
+
+    while (write(ga_channel_sigio_fd, "", 1) == -1 && errno == EINTR) {
+        /* if the pipe is full, a wakeup is pending already */
+    }
+    errno = saved_errno;
+}
+
+static bool ga_channel_client_hung_up(GAChannelClient *client)
+{
+    struct pollfd pfd;
+
+    pfd.fd = g_io_channel_unix_get_fd(client->client_channel);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLHUP);
+}
+
+/* watch the port again once it is no longer hung up */
+static bool ga_channel_reattach(GAChannel *c)
+{
+    GAChannelClient *client = c->clients ? c->clients->data : NULL;
+
+    if (!client || client->watch) {
+        return true;
+    }
+    if (ga_channel_client_hung_up(client)) {
+        return false;
+    }
+
+    g_debug("virtio-serial host connected");
+    client->watch = g_io_add_watch(client->client_channel, G_IO_IN | G_IO_HUP,
+                                   ga_channel_client_event, client);
+    return true;
+}
+
+static gboolean ga_channel_reconnect_timeout(gpointer opaque)
+{
+    GAChannel *c = opaque;
+
+    if (ga_channel_reattach(c)) {
+        c->reconnect_timer = 0;
+        return false;
+    }
     return true;
 }
 
+static gboolean ga_channel_sigio_event(GIOChannel *channel,
+                                       GIOCondition condition, gpointer data)
+{
+    GAChannel *c = data;
+    char buf[64];
+    ssize_t ret;
+
+    do {
+        ret = read(g_io_channel_unix_get_fd(channel), buf, sizeof(buf));
+    } while (ret > 0 || (ret == -1 && errno == EINTR));
+
+    ga_channel_reattach(c);
+    return true;
+}
+
+static bool ga_channel_sigio_init(GAChannel *c, int fd)
+{
+    struct sigaction sigact;
+    int fds[2], flags;
+
+    if (qemu_pipe(fds) == -1) {
+        g_warning("error creating pipe: %s", strerror(errno));
+        return false;
+    }
+    qemu_set_nonblock(fds[0]);
+    qemu_set_nonblock(fds[1]);
+    ga_channel_sigio_fd = fds[1];
+
+    memset(&sigact, 0, sizeof(sigact));
+    sigact.sa_handler = ga_channel_sigio;
+    sigact.sa_flags = SA_RESTART;
+    if (sigaction(SIGIO, &sigact, NULL) == -1) {
+        g_warning("error configuring SIGIO handler: %s", strerror(errno));
+        goto fail;
+    }
+#ifndef CONFIG_SOLARIS
+    /* Solaris raises SIGPOLL (SIGIO) through I_SETSIG instead */
+    if (fcntl(fd, F_SETOWN, getpid()) == -1) {
+        g_warning("error setting owner of channel: %s", strerror(errno));
+        goto fail;
+    }
+    /*
+     * O_ASYNC given to open() is not acted upon, drivers only enable
+     * signal-driven I/O when the flag is changed with F_SETFL.
+     */
+    flags = fcntl(fd, F_GETFL);
+    if (flags == -1 ||
+        fcntl(fd, F_SETFL, flags & ~O_ASYNC) == -1 ||
+        fcntl(fd, F_SETFL, flags | O_ASYNC) == -1) {
+        g_warning("error enabling SIGIO for channel: %s", strerror(errno));
+        goto fail;
+    }
+#endif
+
+    c->sigio_channel = g_io_channel_unix_new(fds[0]);
+    g_io_channel_set_close_on_unref(c->sigio_channel, true);
+    c->sigio_watch = g_io_add_watch(c->sigio_channel, G_IO_IN,
+                                    ga_channel_sigio_event, c);
+    return true;
+
+fail:
+    signal(SIGIO, SIG_IGN);
+    ga_channel_sigio_fd = -1;
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+}
+
+static void ga_channel_sigio_close(GAChannel *c)
+{
+    g_source_remove(c->sigio_watch);
+    g_io_channel_unref(c->sigio_channel);
+    c->sigio_channel = NULL;
+    signal(SIGIO, SIG_IGN);
+    close(ga_channel_sigio_fd);
+    ga_channel_sigio_fd = -1;
+}
+
 static int ga_channel_client_add(GAChannel *c, int fd)
 {
+    GAChannelClient *client;
     GIOChannel *client_channel;
     GError *err = NULL;
 
-    g_assert(c && !c->client_channel);
+    g_assert(c && c->nr_clients < c->max_clients);
     client_channel = g_io_channel_unix_new(fd);
     g_assert(client_channel);
     g_io_channel_set_encoding(client_channel, NULL, &err);
     if (err != NULL) {
         g_warning("error setting channel encoding to binary");
         g_error_free(err);
+        g_io_channel_unref(client_channel);
+        return -1;
+    }
+    client = g_new0(GAChannelClient, 1);
+    client->channel = c;
+    client->client_channel = client_channel;
+    client->user_data = c->accept_cb(client, c->user_data);
+    if (!client->user_data) {
+        g_io_channel_unref(client_channel);
+        g_free(client);
         return -1;
     }
-    g_io_add_watch(client_channel, G_IO_IN | G_IO_HUP,
-                   ga_channel_client_event, c);
-    c->client_channel = client_channel;
+    client->watch = g_io_add_watch(client_channel, G_IO_IN | G_IO_HUP,
+                                   ga_channel_client_event, client);
+    c->clients = g_slist_prepend(c->clients, client);
+    c->nr_clients++;
     return 0;
 }
 
@@ -152,6 +471,9 @@ static gboolean ga_channel_open(GAChannel *c, const gchar *path, GAChannelMethod
             return false;
         }
 #endif
+        if (!ga_channel_sigio_init(c, fd)) {
+            g_warning("checking for host connections by polling instead");
+        }
         ret = ga_channel_client_add(c, fd);
         if (ret) {
             g_critical("error adding channel to main loop");
@@ -210,45 +532,186 @@ static gboolean ga_channel_open(GAChannel *c, const gchar *path, GAChannelMethod
     return true;
 }
 
-GIOStatus ga_channel_write_all(GAChannel *c, const gchar *buf, gsize size)
+/*
+ * A client that leaves too much output queued is not reading it. A
+ * unix-listen client is shut down, which its input watch sees as EOF, and
+ * the host side of a serial port misses the message.
+ */
+static GIOStatus ga_channel_client_overflow(GAChannelClient *client)
 {
-    GError *err = NULL;
-    gsize written = 0;
-    GIOStatus status = G_IO_STATUS_NORMAL;
-
-    while (size) {
-        g_debug("sending data, count: %d", (int)size);
-        status = g_io_channel_write_chars(c->client_channel, buf, size,
-                                          &written, &err);
-        if (status == G_IO_STATUS_NORMAL) {
-            size -= written;
-            buf += written;
-        } else if (status != G_IO_STATUS_AGAIN) {
-            g_warning("error writing to channel: %s", err->message);
-            return status;
+    int fd = g_io_channel_unix_get_fd(client->client_channel);
+
+    if (client->channel->method != GA_CHANNEL_UNIX_LISTEN) {
+        g_warning("channel is not being read, dropping output");
+        return G_IO_STATUS_ERROR;
+    }
+    g_warning("client is not reading its output, disconnecting");
+    ga_channel_client_output_clear(client);
+    shutdown(fd, SHUT_RDWR);
+    return G_IO_STATUS_ERROR;
+}
+
+/*
+ * Write out a vector straight to the fd, without blocking. What the client
+ * does not take right away is queued and written out from the main loop
+ * in order, ahead of any file data of ga_channel_client_write_watch()
+ * callbacks. @iov is consumed.
+ */
+GIOStatus ga_channel_writev_all(GAChannelClient *client, struct iovec *iov,
+                                unsigned int iovcnt)
+{
+    int fd = g_io_channel_unix_get_fd(client->client_channel);
+    GByteArray *data;
+    unsigned int i;
+    ssize_t ret;
+
+    if (!g_queue_is_empty(&client->output)) {
+        if (client->output_len + iov_size(iov, iovcnt) >
+            GA_CHANNEL_OUTPUT_MAX) {
+            return ga_channel_client_overflow(client);
         }
+    } else {
+        while (iovcnt) {
+            ret = writev(fd, iov, MIN(iovcnt, IOV_MAX));
+            if (ret >= 0) {
+                iov_discard_front(&iov, &iovcnt, ret);
+            } else if (errno == EAGAIN) {
+                break;
+            } else if (errno != EINTR) {
+                g_warning("error writing to channel: %s", strerror(errno));
+                return G_IO_STATUS_ERROR;
+            }
+        }
+        if (!iovcnt) {
+            return G_IO_STATUS_NORMAL;
+        }
+    }
+
+    data = g_byte_array_sized_new(iov_size(iov, iovcnt));
+    for (i = 0; i < iovcnt; i++) {
+        g_byte_array_append(data, iov[i].iov_base, iov[i].iov_len);
     }
+    g_queue_push_tail(&client->output, data);
+    client->output_len += data->len;
+    ga_channel_client_watch_output(client);
+    return G_IO_STATUS_NORMAL;
+}
+
+GIOStatus ga_channel_write_all(GAChannelClient *client, const gchar *buf,
+                               gsize size)
+{
+    struct iovec iov = { .iov_base = (gchar *)buf, .iov_len = size };
+
+    return ga_channel_writev_all(client, &iov, 1);
+}
 
+/*
+ * Write as much of @buf as the channel takes without blocking, straight to
+ * the fd, bypassing the output queue. Returns G_IO_STATUS_AGAIN if it
+ * takes nothing.
+ */
+GIOStatus ga_channel_write_some(GAChannelClient *client, const gchar *buf,
+                                gsize size, gsize *count)
+{
+    int fd = g_io_channel_unix_get_fd(client->client_channel);
+    ssize_t ret;
+
+    *count = 0;
     do {
-        status = g_io_channel_flush(c->client_channel, &err);
-    } while (status == G_IO_STATUS_AGAIN);
+        ret = write(fd, buf, size);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        if (errno == EAGAIN) {
+            return G_IO_STATUS_AGAIN;
+        }
+        g_warning("error writing to channel: %s", strerror(errno));
+        return G_IO_STATUS_ERROR;
+    }
+    *count = ret;
+    return G_IO_STATUS_NORMAL;
+}
+
+#define GA_CHANNEL_COPY_SIZE (64 * 1024)
+
+static GIOStatus ga_channel_copy_file(GAChannelClient *client, int fd,
+                                      off_t offset, gsize size, gsize *count)
+{
+    gchar *buf = g_malloc(MIN(size, GA_CHANNEL_COPY_SIZE));
+    GIOStatus status;
+    ssize_t ret;
 
-    if (status != G_IO_STATUS_NORMAL) {
-        g_warning("error flushing channel: %s", err->message);
+    do {
+        ret = pread(fd, buf, MIN(size, GA_CHANNEL_COPY_SIZE), offset);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        g_warning("error reading file: %s", strerror(errno));
+        status = G_IO_STATUS_ERROR;
+    } else if (ret == 0) {
+        status = G_IO_STATUS_EOF;
+    } else {
+        /* whatever the channel does not take is read again next time */
+        status = ga_channel_write_some(client, buf, ret, count);
     }
 
+    g_free(buf);
     return status;
 }
 
-GIOStatus ga_channel_read(GAChannel *c, gchar *buf, gsize size, gsize *count)
+/*
+ * Send up to @size bytes of @fd, starting at @offset, as far as the
+ * channel takes them without blocking. Where the kernel supports it the
+ * data goes straight from the page cache to the channel with sendfile(),
+ * otherwise it is copied through a bounded buffer. Returns
+ * G_IO_STATUS_AGAIN if the channel takes nothing and G_IO_STATUS_EOF if
+ * @fd ends at @offset.
+ */
+GIOStatus ga_channel_write_file(GAChannelClient *client, int fd, off_t offset,
+                                gsize size, gsize *count)
+{
+#ifdef CONFIG_LINUX
+    int out = g_io_channel_unix_get_fd(client->client_channel);
+    ssize_t ret;
+#endif
+
+    *count = 0;
+#ifdef CONFIG_LINUX
+    for (;;) {
+        ret = sendfile(out, fd, &offset, size);
+        if (ret > 0) {
+            *count = ret;
+            return G_IO_STATUS_NORMAL;
+        } else if (ret == 0) {
+            return G_IO_STATUS_EOF;
+        } else if (errno == EAGAIN) {
+            return G_IO_STATUS_AGAIN;
+        } else if (errno == EINVAL || errno == ENOSYS) {
+            /* not supported for this pair of descriptors */
+            break;
+        } else if (errno != EINTR) {
+            g_warning("error writing to channel: %s", strerror(errno));
+            return G_IO_STATUS_ERROR;
+        }
+    }
+#endif
+
+    return ga_channel_copy_file(client, fd, offset, size, count);
+}
+
+GIOStatus ga_channel_read(GAChannelClient *client, gchar *buf, gsize size,
+                          gsize *count)
 {
-    return g_io_channel_read_chars(c->client_channel, buf, size, count, NULL);
+    return g_io_channel_read_chars(client->client_channel, buf, size, count,
+                                   NULL);
 }
 
 GAChannel *ga_channel_new(GAChannelMethod method, const gchar *path,
+                          int max_clients, GAChannelAcceptCallback accept_cb,
                           GAChannelCallback cb, gpointer opaque)
 {
     GAChannel *c = g_new0(GAChannel, 1);
+    /* serial ports carry a single client */
+    c->max_clients = method == GA_CHANNEL_UNIX_LISTEN ? MAX(max_clients, 1) : 1;
+    c->accept_cb = accept_cb;
     c->event_cb = cb;
     c->user_data = opaque;
 
@@ -267,8 +730,14 @@ void ga_channel_free(GAChannel *c)
         && c->listen_channel) {
         ga_channel_listen_close(c);
     }
-    if (c->client_channel) {
-        ga_channel_client_close(c);
+    while (c->clients) {
+        ga_channel_client_close(c->clients->data);
+    }
+    if (c->sigio_channel) {
+        ga_channel_sigio_close(c);
+    }
+    if (c->reconnect_timer) {
+        g_source_remove(c->reconnect_timer);
     }
     g_free(c);
 }
@@ -18,10 +18,16 @@ typedef struct GAChannelReadState {
     bool ov_pending; /* whether on async read is outstanding */
 } GAChannelReadState;
 
+/* the serial port is the one and only client */
+struct GAChannelClient {
+    GAChannel *channel;
+    gpointer user_data;     /* as returned by the accept callback */
+};
+
 struct GAChannel {
     HANDLE handle;
     GAChannelCallback cb;
-    gpointer user_data;
+    GAChannelClient client;
     GAChannelReadState rstate;
     GIOCondition pending_events; /* TODO: use GAWatch.pollfd.revents */
     GSource *source;
@@ -161,7 +167,7 @@ static gboolean ga_channel_dispatch(GSource *source, GSourceFunc unused,
     gboolean success;
 
     g_debug("dispatch");
-    success = c->cb(watch->pollfd.revents, c->user_data);
+    success = c->cb(watch->pollfd.revents, c->client.user_data);
 
     if (c->pending_events & G_IO_ERR) {
         g_critical("channel error, removing source");
@@ -202,8 +208,10 @@ static GSource *ga_channel_create_watch(GAChannel *c)
     return source;
 }
 
-GIOStatus ga_channel_read(GAChannel *c, char *buf, size_t size, gsize *count)
+GIOStatus ga_channel_read(GAChannelClient *client, char *buf, size_t size,
+                          gsize *count)
 {
+    GAChannel *c = client->channel;
     GAChannelReadState *rs = &c->rstate;
     GIOStatus status;
     size_t to_read = 0;
@@ -266,8 +274,10 @@ static GIOStatus ga_channel_write(GAChannel *c, const char *buf, size_t size,
     return status;
 }
 
-GIOStatus ga_channel_write_all(GAChannel *c, const char *buf, size_t size)
+GIOStatus ga_channel_write_all(GAChannelClient *client, const char *buf,
+                               size_t size)
 {
+    GAChannel *c = client->channel;
     GIOStatus status = G_IO_STATUS_NORMAL;
     size_t count = 0;
 
@@ -284,6 +294,20 @@ GIOStatus ga_channel_write_all(GAChannel *c, const char *buf, size_t size)
     return status;
 }
 
+GIOStatus ga_channel_writev_all(GAChannelClient *client, struct iovec *iov,
+                                unsigned int iovcnt)
+{
+    GIOStatus status = G_IO_STATUS_NORMAL;
+    unsigned int i;
+
+    for (i = 0; i < iovcnt && status == G_IO_STATUS_NORMAL; i++) {
+        status = ga_channel_write_all(client, iov[i].iov_base,
+                                      iov[i].iov_len);
+    }
+
+    return status;
+}
+
 static gboolean ga_channel_open(GAChannel *c, GAChannelMethod method,
                                 const gchar *path)
 {
@@ -320,6 +344,7 @@ static gboolean ga_channel_open(GAChannel *c, GAChannelMethod method,
 }
 
 GAChannel *ga_channel_new(GAChannelMethod method, const gchar *path,
+                          int max_clients, GAChannelAcceptCallback accept_cb,
                           GAChannelCallback cb, gpointer opaque)
 {
     GAChannel *c = g_new0(GAChannel, 1);
@@ -332,7 +357,13 @@ GAChannel *ga_channel_new(GAChannelMethod method, const gchar *path,
     }
 
     c->cb = cb;
-    c->user_data = opaque;
+    c->client.channel = c;
+    c->client.user_data = accept_cb(&c->client, opaque);
+    if (!c->client.user_data) {
+        CloseHandle(c->handle);
+        g_free(c);
+        return NULL;
+    }
 
     sec_attrs.nLength = sizeof(SECURITY_ATTRIBUTES);
     sec_attrs.lpSecurityDescriptor = NULL;
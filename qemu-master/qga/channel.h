@@ -14,7 +14,10 @@
 
 #include <glib.h>
 
+struct iovec;
+
 typedef struct GAChannel GAChannel;
+typedef struct GAChannelClient GAChannelClient;
 
 typedef enum {
     GA_CHANNEL_VIRTIO_SERIAL,
@@ -22,12 +25,30 @@ typedef enum {
     GA_CHANNEL_UNIX_LISTEN,
 } GAChannelMethod;
 
+/* returns the opaque for the client's event callbacks, NULL to drop it */
+typedef gpointer (*GAChannelAcceptCallback)(GAChannelClient *client,
+                                            gpointer opaque);
+/* a false return closes the client */
 typedef gboolean (*GAChannelCallback)(GIOCondition condition, gpointer opaque);
 
+/* @max_clients bounds the number of concurrent unix-listen connections */
 GAChannel *ga_channel_new(GAChannelMethod method, const gchar *path,
+                          int max_clients, GAChannelAcceptCallback accept_cb,
                           GAChannelCallback cb, gpointer opaque);
 void ga_channel_free(GAChannel *c);
-GIOStatus ga_channel_read(GAChannel *c, gchar *buf, gsize size, gsize *count);
-GIOStatus ga_channel_write_all(GAChannel *c, const gchar *buf, gsize size);
+GIOStatus ga_channel_read(GAChannelClient *client, gchar *buf, gsize size,
+                          gsize *count);
+GIOStatus ga_channel_write_all(GAChannelClient *client, const gchar *buf,
+                               gsize size);
+GIOStatus ga_channel_writev_all(GAChannelClient *client, struct iovec *iov,
+                                unsigned int iovcnt);
+#ifndef _WIN32
+GIOStatus ga_channel_write_some(GAChannelClient *client, const gchar *buf,
+                                gsize size, gsize *count);
+GIOStatus ga_channel_write_file(GAChannelClient *client, int fd, off_t offset,
+                                gsize size, gsize *count);
+void ga_channel_client_write_watch(GAChannelClient *client,
+                                   GAChannelCallback cb, gpointer opaque);
+#endif
 
 #endif
@@ -25,9 +25,12 @@
 #include <inttypes.h>
 #include "qga/guest-agent-core.h"
 #include "qga-qmp-commands.h"
+#include "qga-qapi-event.h"
 #include "qapi/qmp/qerror.h"
 #include "qemu/queue.h"
 #include "qemu/host-utils.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
 
 #ifndef CONFIG_HAS_ENVIRON
 #ifdef __APPLE__
@@ -45,6 +48,14 @@ extern char **environ;
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <net/if.h>
+#include <netdb.h>
+#include <pwd.h>
+#include <lastlog.h>
+#include <sys/utsname.h>
+#include <sys/statvfs.h>
+#include <sys/sysinfo.h>
+#include <poll.h>
+#include <linux/netlink.h>
 
 #ifdef FIFREEZE
 #define CONFIG_FSFREEZE
@@ -215,19 +226,46 @@ void qmp_guest_set_time(bool has_time, int64_t time_ns, Error **errp)
     }
 }
 
+/*
+ * guest-file-read/write/flush may run in a worker thread while the main
+ * loop opens or closes other handles, so the table is protected by a lock
+ * and a handle is only closed once the last user drops its reference.
+ *
+ * Handles wrap a plain non-blocking file descriptor: the data is not
+ * buffered by the agent, so positional and sequential accesses can be
+ * mixed freely.
+ */
 typedef struct GuestFileHandle {
-    uint64_t id;
-    FILE *fh;
-    QTAILQ_ENTRY(GuestFileHandle) next;
+    int64_t id;
+    int fd;
+    int refcnt;
 } GuestFileHandle;
 
 static struct {
-    QTAILQ_HEAD(, GuestFileHandle) filehandles;
-} guest_file_state = {
-    .filehandles = QTAILQ_HEAD_INITIALIZER(guest_file_state.filehandles),
-};
+    QemuMutex lock;
+    GHashTable *filehandles;    /* id -> GuestFileHandle */
+} guest_file_state;
+
+static void guest_file_init(void)
+{
+    qemu_mutex_init(&guest_file_state.lock);
+    guest_file_state.filehandles = g_hash_table_new(g_int64_hash,
+                                                    g_int64_equal);
+}
 
-static int64_t guest_file_handle_add(FILE *fh, Error **errp)
+/* drop a reference taken by guest_file_handle_find() */
+static int guest_file_handle_put(GuestFileHandle *gfh)
+{
+    int ret = 0;
+
+    if (atomic_fetch_dec(&gfh->refcnt) == 1) {
+        ret = close(gfh->fd);
+        g_free(gfh);
+    }
+    return ret;
+}
+
+static int64_t guest_file_handle_add(int fd, Error **errp)
 {
     GuestFileHandle *gfh;
     int64_t handle;
@@ -239,25 +277,31 @@ static int64_t guest_file_handle_add(FILE *fh, Error **errp)
 
     gfh = g_new0(GuestFileHandle, 1);
     gfh->id = handle;
-    gfh->fh = fh;
-    QTAILQ_INSERT_TAIL(&guest_file_state.filehandles, gfh, next);
+    gfh->fd = fd;
+    gfh->refcnt = 1;
+    qemu_mutex_lock(&guest_file_state.lock);
+    g_hash_table_insert(guest_file_state.filehandles, &gfh->id, gfh);
+    qemu_mutex_unlock(&guest_file_state.lock);
 
     return handle;
 }
 
+/* look up a handle and take a reference to it */
 static GuestFileHandle *guest_file_handle_find(int64_t id, Error **errp)
 {
     GuestFileHandle *gfh;
 
-    QTAILQ_FOREACH(gfh, &guest_file_state.filehandles, next)
-    {
-        if (gfh->id == id) {
-            return gfh;
-        }
+    qemu_mutex_lock(&guest_file_state.lock);
+    gfh = g_hash_table_lookup(guest_file_state.filehandles, &id);
+    if (gfh) {
+        atomic_inc(&gfh->refcnt);
     }
+    qemu_mutex_unlock(&guest_file_state.lock);
 
-    error_setg(errp, "handle '%" PRId64 "' has not been found", id);
-    return NULL;
+    if (!gfh) {
+        error_setg(errp, "handle '%" PRId64 "' has not been found", id);
+    }
+    return gfh;
 }
 
 typedef const char * const ccpc;
@@ -313,7 +357,7 @@ find_open_flag(const char *mode_str, Error **errp)
                                S_IRGRP | S_IWGRP | \
                                S_IROTH | S_IWOTH)
 
-static FILE *
+static int
 safe_open_or_create(const char *path, const char *mode, Error **errp)
 {
     Error *local_err = NULL;
@@ -362,16 +406,7 @@ safe_open_or_create(const char *path, const char *mode, Error **errp)
                                  "0%03o on new file '%s' (mode: '%s')",
                                  (unsigned)DEFAULT_NEW_FILE_MODE, path, mode);
             } else {
-                FILE *f;
-
-                f = fdopen(fd, mode);
-                if (f == NULL) {
-                    error_setg_errno(&local_err, errno, "failed to associate "
-                                     "stdio stream with file descriptor %d, "
-                                     "file '%s' (mode: '%s')", fd, path, mode);
-                } else {
-                    return f;
-                }
+                return fd;
             }
 
             close(fd);
@@ -382,58 +417,32 @@ safe_open_or_create(const char *path, const char *mode, Error **errp)
     }
 
     error_propagate(errp, local_err);
-    return NULL;
-}
-
-static int guest_file_toggle_flags(int fd, int flags, bool set, Error **err)
-{
-    int ret, old_flags;
-
-    old_flags = fcntl(fd, F_GETFL);
-    if (old_flags == -1) {
-        error_setg_errno(err, errno, QERR_QGA_COMMAND_FAILED,
-                         "failed to fetch filehandle flags");
-        return -1;
-    }
-
-    ret = fcntl(fd, F_SETFL, set ? (old_flags | flags) : (old_flags & ~flags));
-    if (ret == -1) {
-        error_setg_errno(err, errno, QERR_QGA_COMMAND_FAILED,
-                         "failed to set filehandle flags");
-        return -1;
-    }
-
-    return ret;
+    return -1;
 }
 
 int64_t qmp_guest_file_open(const char *path, bool has_mode, const char *mode,
                             Error **errp)
 {
-    FILE *fh;
     Error *local_err = NULL;
     int64_t handle;
+    int fd;
 
     if (!has_mode) {
         mode = "r";
     }
     slog("guest-file-open called, filepath: %s, mode: %s", path, mode);
-    fh = safe_open_or_create(path, mode, &local_err);
+    /* the fd is non-blocking to avoid common use cases (like reading from
+     * a named pipe) from hanging the agent
+     */
+    fd = safe_open_or_create(path, mode, &local_err);
     if (local_err != NULL) {
         error_propagate(errp, local_err);
         return -1;
     }
 
-    /* set fd non-blocking to avoid common use cases (like reading from a
-     * named pipe) from hanging the agent
-     */
-    if (guest_file_toggle_flags(fileno(fh), O_NONBLOCK, true, errp) < 0) {
-        fclose(fh);
-        return -1;
-    }
-
-    handle = guest_file_handle_add(fh, errp);
+    handle = guest_file_handle_add(fd, errp);
     if (handle < 0) {
-        fclose(fh);
+        close(fd);
         return -1;
     }
 
@@ -443,32 +452,146 @@ int64_t qmp_guest_file_open(const char *path, bool has_mode, const char *mode,
 
 void qmp_guest_file_close(int64_t handle, Error **errp)
 {
-    GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
-    int ret;
+    GuestFileHandle *gfh;
 
     slog("guest-file-close called, handle: %" PRId64, handle);
+
+    qemu_mutex_lock(&guest_file_state.lock);
+    gfh = g_hash_table_lookup(guest_file_state.filehandles, &handle);
+    if (gfh) {
+        g_hash_table_remove(guest_file_state.filehandles, &handle);
+    }
+    qemu_mutex_unlock(&guest_file_state.lock);
+
     if (!gfh) {
+        error_setg(errp, "handle '%" PRId64 "' has not been found", handle);
         return;
     }
 
-    ret = fclose(gfh->fh);
-    if (ret == EOF) {
+    /* drop the table's reference; if a command in flight still holds one,
+     * the file is closed when that command is done with it
+     */
+    if (guest_file_handle_put(gfh) == -1) {
         error_setg_errno(errp, errno, "failed to close handle");
-        return;
     }
+}
+
+/*
+ * Read up to @count bytes at @offset, or at the file position of the
+ * handle if @offset is negative. Running out of data on a non-blocking
+ * file (EAGAIN) ends the read early without setting eof.
+ */
+static GuestFileRead *guest_file_do_read(GuestFileHandle *gfh,
+                                         int64_t offset, int64_t count,
+                                         Error **errp)
+{
+    GuestFileRead *read_data;
+    size_t read_count = 0;
+    bool eof = false;
+    guchar *buf;
+    ssize_t ret;
+
+    if (count < 0) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument count",
+                   count);
+        return NULL;
+    }
+
+    buf = g_malloc(count + 1);
+    while (read_count < count) {
+        if (offset < 0) {
+            ret = read(gfh->fd, buf + read_count, count - read_count);
+        } else {
+            ret = pread(gfh->fd, buf + read_count, count - read_count,
+                        offset + read_count);
+        }
+        if (ret > 0) {
+            read_count += ret;
+        } else if (ret == 0) {
+            eof = true;
+            break;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            if (read_count) {
+                /* report the error on the next read */
+                break;
+            }
+            error_setg_errno(errp, errno, "failed to read file");
+            slog("guest-file-read failed, handle: %" PRId64, gfh->id);
+            g_free(buf);
+            return NULL;
+        }
+    }
+
+    read_data = g_new0(GuestFileRead, 1);
+    read_data->count = read_count;
+    read_data->eof = eof;
+    if (read_count) {
+        read_data->buf_b64 = g_base64_encode(buf, read_count);
+    }
+    g_free(buf);
+
+    return read_data;
+}
+
+/* Write @count bytes at @offset, or at the file position if negative */
+static GuestFileWrite *guest_file_do_write(GuestFileHandle *gfh,
+                                           int64_t offset,
+                                           const char *buf_b64,
+                                           bool has_count, int64_t count,
+                                           Error **errp)
+{
+    GuestFileWrite *write_data;
+    size_t write_count = 0;
+    gsize buf_len;
+    guchar *buf;
+    ssize_t ret;
+
+    buf = g_base64_decode(buf_b64, &buf_len);
+    if (!has_count) {
+        count = buf_len;
+    } else if (count < 0 || count > buf_len) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument count",
+                   count);
+        g_free(buf);
+        return NULL;
+    }
+
+    while (write_count < count) {
+        if (offset < 0) {
+            ret = write(gfh->fd, buf + write_count, count - write_count);
+        } else {
+            ret = pwrite(gfh->fd, buf + write_count, count - write_count,
+                         offset + write_count);
+        }
+        if (ret >= 0) {
+            write_count += ret;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            if (write_count) {
+                break;
+            }
+            error_setg_errno(errp, errno, "failed to write to file");
+            slog("guest-file-write failed, handle: %" PRId64, gfh->id);
+            g_free(buf);
+            return NULL;
+        }
+    }
+    g_free(buf);
 
-    QTAILQ_REMOVE(&guest_file_state.filehandles, gfh, next);
-    g_free(gfh);
+    write_data = g_new0(GuestFileWrite, 1);
+    write_data->count = write_count;
+    write_data->eof = false;
+    return write_data;
 }
 
 struct GuestFileRead *qmp_guest_file_read(int64_t handle, bool has_count,
                                           int64_t count, Error **errp)
 {
     GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
-    GuestFileRead *read_data = NULL;
-    guchar *buf;
-    FILE *fh;
-    size_t read_count;
+    GuestFileRead *read_data;
 
     if (!gfh) {
         return NULL;
@@ -476,71 +599,121 @@ struct GuestFileRead *qmp_guest_file_read(int64_t handle, bool has_count,
 
     if (!has_count) {
         count = QGA_READ_COUNT_DEFAULT;
-    } else if (count < 0) {
-        error_setg(errp, "value '%" PRId64 "' is invalid for argument count",
-                   count);
+    }
+    read_data = guest_file_do_read(gfh, -1, count, errp);
+    guest_file_handle_put(gfh);
+
+    return read_data;
+}
+
+GuestFileRead *qmp_guest_file_pread(int64_t handle, int64_t offset,
+                                    bool has_count, int64_t count,
+                                    Error **errp)
+{
+    GuestFileHandle *gfh;
+    GuestFileRead *read_data;
+
+    if (offset < 0) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument offset",
+                   offset);
+        return NULL;
+    }
+    gfh = guest_file_handle_find(handle, errp);
+    if (!gfh) {
         return NULL;
     }
 
-    fh = gfh->fh;
-    buf = g_malloc0(count+1);
-    read_count = fread(buf, 1, count, fh);
-    if (ferror(fh)) {
-        error_setg_errno(errp, errno, "failed to read file");
-        slog("guest-file-read failed, handle: %" PRId64, handle);
-    } else {
-        buf[read_count] = 0;
-        read_data = g_new0(GuestFileRead, 1);
-        read_data->count = read_count;
-        read_data->eof = feof(fh);
-        if (read_count) {
-            read_data->buf_b64 = g_base64_encode(buf, read_count);
-        }
+    if (!has_count) {
+        count = QGA_READ_COUNT_DEFAULT;
     }
-    g_free(buf);
-    clearerr(fh);
+    read_data = guest_file_do_read(gfh, offset, count, errp);
+    guest_file_handle_put(gfh);
 
     return read_data;
 }
 
+GuestFileReadResultList *
+qmp_guest_file_read_vector(GuestFileReadRequestList *requests, Error **errp)
+{
+    GuestFileReadResultList *head = NULL, **link = &head, *entry;
+    GuestFileReadRequest *req;
+    GuestFileReadResult *result;
+    GuestFileHandle *gfh;
+    Error *local_err = NULL;
+
+    for (; requests; requests = requests->next) {
+        req = requests->value;
+        result = g_new0(GuestFileReadResult, 1);
+        result->handle = req->handle;
+
+        if (req->has_offset && req->offset < 0) {
+            error_setg(&local_err, "value '%" PRId64 "' is invalid for "
+                       "argument offset", req->offset);
+        } else {
+            gfh = guest_file_handle_find(req->handle, &local_err);
+            if (gfh) {
+                result->data = guest_file_do_read(gfh,
+                    req->has_offset ? req->offset : -1,
+                    req->has_count ? req->count : QGA_READ_COUNT_DEFAULT,
+                    &local_err);
+                guest_file_handle_put(gfh);
+            }
+        }
+        if (local_err) {
+            result->has_error = true;
+            result->error = g_strdup(error_get_pretty(local_err));
+            error_free(local_err);
+            local_err = NULL;
+        } else {
+            result->has_data = true;
+        }
+
+        entry = g_new0(GuestFileReadResultList, 1);
+        entry->value = result;
+        *link = entry;
+        link = &entry->next;
+    }
+
+    return head;
+}
+
 GuestFileWrite *qmp_guest_file_write(int64_t handle, const char *buf_b64,
                                      bool has_count, int64_t count,
                                      Error **errp)
 {
-    GuestFileWrite *write_data = NULL;
-    guchar *buf;
-    gsize buf_len;
-    int write_count;
     GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
-    FILE *fh;
+    GuestFileWrite *write_data;
 
     if (!gfh) {
         return NULL;
     }
 
-    fh = gfh->fh;
-    buf = g_base64_decode(buf_b64, &buf_len);
+    write_data = guest_file_do_write(gfh, -1, buf_b64, has_count, count, errp);
+    guest_file_handle_put(gfh);
 
-    if (!has_count) {
-        count = buf_len;
-    } else if (count < 0 || count > buf_len) {
-        error_setg(errp, "value '%" PRId64 "' is invalid for argument count",
-                   count);
-        g_free(buf);
+    return write_data;
+}
+
+GuestFileWrite *qmp_guest_file_pwrite(int64_t handle, int64_t offset,
+                                      const char *buf_b64, bool has_count,
+                                      int64_t count, Error **errp)
+{
+    GuestFileHandle *gfh;
+    GuestFileWrite *write_data;
+
+    if (offset < 0) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument offset",
+                   offset);
         return NULL;
     }
-
-    write_count = fwrite(buf, 1, count, fh);
-    if (ferror(fh)) {
-        error_setg_errno(errp, errno, "failed to write to file");
-        slog("guest-file-write failed, handle: %" PRId64, handle);
-    } else {
-        write_data = g_new0(GuestFileWrite, 1);
-        write_data->count = write_count;
-        write_data->eof = feof(fh);
+    gfh = guest_file_handle_find(handle, errp);
+    if (!gfh) {
+        return NULL;
     }
-    g_free(buf);
-    clearerr(fh);
+
+    write_data = guest_file_do_write(gfh, offset, buf_b64, has_count, count,
+                                     errp);
+    guest_file_handle_put(gfh);
 
     return write_data;
 }
@@ -550,23 +723,21 @@ struct GuestFileSeek *qmp_guest_file_seek(int64_t handle, int64_t offset,
 {
     GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
     GuestFileSeek *seek_data = NULL;
-    FILE *fh;
-    int ret;
+    off_t ret;
 
     if (!gfh) {
         return NULL;
     }
 
-    fh = gfh->fh;
-    ret = fseek(fh, offset, whence);
+    ret = lseek(gfh->fd, offset, whence);
     if (ret == -1) {
         error_setg_errno(errp, errno, "failed to seek file");
     } else {
         seek_data = g_new0(GuestFileSeek, 1);
-        seek_data->position = ftell(fh);
-        seek_data->eof = feof(fh);
+        seek_data->position = ret;
+        seek_data->eof = false;
     }
-    clearerr(fh);
+    guest_file_handle_put(gfh);
 
     return seek_data;
 }
@@ -574,85 +745,521 @@ struct GuestFileSeek *qmp_guest_file_seek(int64_t handle, int64_t offset,
 void qmp_guest_file_flush(int64_t handle, Error **errp)
 {
     GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
-    FILE *fh;
-    int ret;
-
-    if (!gfh) {
-        return;
-    }
 
-    fh = gfh->fh;
-    ret = fflush(fh);
-    if (ret == EOF) {
-        error_setg_errno(errp, errno, "failed to flush file");
+    /* writes are not buffered in the agent, there is nothing to flush */
+    if (gfh) {
+        guest_file_handle_put(gfh);
     }
 }
 
-/* linux-specific implementations. avoid this if at all possible. */
-#if defined(__linux__)
+#define GUEST_BINARY_CHUNK_DEFAULT (64 * 1024)
+#define GUEST_BINARY_CHUNK_MIN (4 * 1024)
+#define GUEST_BINARY_CHUNK_MAX (1024 * 1024)
 
-#if defined(CONFIG_FSFREEZE) || defined(CONFIG_FSTRIM)
-typedef struct FsMount {
-    char *dirname;
-    char *devtype;
-    unsigned int devmajor, devminor;
-    QTAILQ_ENTRY(FsMount) next;
-} FsMount;
+GuestBinaryTransfer *qmp_guest_set_binary_transfer(bool enable,
+                                                   bool has_chunk_size,
+                                                   int64_t chunk_size,
+                                                   Error **errp)
+{
+    GuestBinaryTransfer *info = g_new0(GuestBinaryTransfer, 1);
 
-typedef QTAILQ_HEAD(FsMountList, FsMount) FsMountList;
+    if (!has_chunk_size) {
+        chunk_size = GUEST_BINARY_CHUNK_DEFAULT;
+    }
+    chunk_size = MIN(MAX(chunk_size, GUEST_BINARY_CHUNK_MIN),
+                     GUEST_BINARY_CHUNK_MAX);
+    ga_set_binary_transfer(ga_state, enable, chunk_size);
 
-static void free_fs_mount_list(FsMountList *mounts)
+    info->enabled = enable;
+    info->chunk_size = chunk_size;
+    return info;
+}
+
+/*
+ * Raw transfers are carried out by the main loop after the command has
+ * returned, so they get a descriptor of their own.
+ */
+static int guest_file_transfer_fd(GuestFileHandle *gfh, Error **errp)
 {
-     FsMount *mount, *temp;
+    int fd;
 
-     if (!mounts) {
-         return;
-     }
+    fd = dup(gfh->fd);
+    if (fd == -1) {
+        error_setg_errno(errp, errno, "failed to duplicate file descriptor");
+        return -1;
+    }
+    qemu_set_cloexec(fd);
+    return fd;
+}
 
-     QTAILQ_FOREACH_SAFE(mount, mounts, next, temp) {
-         QTAILQ_REMOVE(mounts, mount, next);
-         g_free(mount->dirname);
-         g_free(mount->devtype);
-         g_free(mount);
-     }
+static bool guest_file_check_transfer(bool has_offset, int64_t offset,
+                                      Error **errp)
+{
+    if (!ga_binary_transfer_enabled(ga_state)) {
+        error_setg(errp, "binary transfer mode is not enabled");
+        return false;
+    }
+    if (has_offset && offset < 0) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument offset",
+                   offset);
+        return false;
+    }
+    return true;
 }
 
-static int dev_major_minor(const char *devpath,
-                           unsigned int *devmajor, unsigned int *devminor)
+GuestFileReadRaw *qmp_guest_file_read_raw(int64_t handle, bool has_offset,
+                                          int64_t offset, bool has_count,
+                                          int64_t count, Error **errp)
 {
+    GuestFileReadRaw *read_data;
+    GuestFileHandle *gfh;
     struct stat st;
+    int64_t avail;
+    int fd;
 
-    *devmajor = 0;
-    *devminor = 0;
+    if (!guest_file_check_transfer(has_offset, offset, errp)) {
+        return NULL;
+    }
+    if (has_count && count < 0) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument count",
+                   count);
+        return NULL;
+    }
 
-    if (stat(devpath, &st) < 0) {
-        slog("failed to stat device file '%s': %s", devpath, strerror(errno));
-        return -1;
+    gfh = guest_file_handle_find(handle, errp);
+    if (!gfh) {
+        return NULL;
     }
-    if (S_ISDIR(st.st_mode)) {
-        /* It is bind mount */
-        return -2;
+    fd = guest_file_transfer_fd(gfh, errp);
+    guest_file_handle_put(gfh);
+    if (fd == -1) {
+        return NULL;
     }
-    if (S_ISBLK(st.st_mode)) {
-        *devmajor = major(st.st_rdev);
-        *devminor = minor(st.st_rdev);
-        return 0;
+
+    if (fstat(fd, &st) == -1) {
+        error_setg_errno(errp, errno, "failed to stat file");
+        close(fd);
+        return NULL;
     }
-    return -1;
+    if (!S_ISREG(st.st_mode)) {
+        error_setg(errp, "raw transfers are only supported for regular files");
+        close(fd);
+        return NULL;
+    }
+
+    if (!has_offset) {
+        offset = 0;
+    }
+    avail = st.st_size > offset ? st.st_size - offset : 0;
+    if (!has_count || count > avail) {
+        count = avail;
+    }
+
+    read_data = g_new0(GuestFileReadRaw, 1);
+    read_data->count = count;
+    read_data->eof = count == avail;
+
+    /* the main loop streams the data and closes fd */
+    ga_bulk_send(ga_state, fd, offset, count);
+    return read_data;
 }
 
-/*
- * Walk the mount table and build a list of local file systems
- */
-static void build_fs_mount_list_from_mtab(FsMountList *mounts, Error **errp)
+GuestFileWrite *qmp_guest_file_write_raw(int64_t handle, bool has_offset,
+                                         int64_t offset, Error **errp)
 {
-    struct mntent *ment;
-    FsMount *mount;
-    char const *mtab = "/proc/self/mounts";
-    FILE *fp;
-    unsigned int devmajor, devminor;
+    GuestFileWrite *write_data;
+    GuestFileHandle *gfh;
+    int fd;
 
-    fp = setmntent(mtab, "r");
+    if (!guest_file_check_transfer(has_offset, offset, errp)) {
+        return NULL;
+    }
+
+    gfh = guest_file_handle_find(handle, errp);
+    if (!gfh) {
+        return NULL;
+    }
+    fd = guest_file_transfer_fd(gfh, errp);
+    guest_file_handle_put(gfh);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    /* the count is filled in by the main loop once the data is written */
+    write_data = g_new0(GuestFileWrite, 1);
+    ga_bulk_receive(ga_state, fd, has_offset ? offset : 0);
+    return write_data;
+}
+
+/*
+ * guest-file-checksum and guest-file-apply-delta let the host update a
+ * file in place in the style of rsync: the host matches the block sums of
+ * the guest's copy against its own version and only sends the data of the
+ * blocks that differ.
+ */
+#define GUEST_CHECKSUM_BLOCK_DEFAULT (64 * 1024)
+#define GUEST_CHECKSUM_BLOCK_MIN 512
+#define GUEST_CHECKSUM_BLOCK_MAX (16 * 1024 * 1024)
+#define GUEST_CHECKSUM_STRONG_LEN 16    /* hex digits of the block SHA-256 */
+
+/* rsync's weak checksum: a = sum(x[i]), b = sum((len - i) * x[i]) */
+static uint32_t guest_file_rolling_sum(const guchar *buf, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        a += buf[i];
+        b += a;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+/* read until @len bytes or end of file, return the byte count or -1 */
+static ssize_t guest_file_read_block(int fd, guchar *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < len) {
+        ret = read(fd, buf + done, len - done);
+        if (ret == 0) {
+            break;
+        } else if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+static bool guest_file_check_block_size(bool has_block_size,
+                                        int64_t *block_size, Error **errp)
+{
+    if (!has_block_size) {
+        *block_size = GUEST_CHECKSUM_BLOCK_DEFAULT;
+    } else if (*block_size < GUEST_CHECKSUM_BLOCK_MIN ||
+               *block_size > GUEST_CHECKSUM_BLOCK_MAX) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "block-size",
+                   "a value between 512 and 16777216");
+        return false;
+    }
+    return true;
+}
+
+GuestFileChecksum *qmp_guest_file_checksum(const char *path,
+                                           bool has_block_size,
+                                           int64_t block_size,
+                                           bool has_blocks, bool blocks,
+                                           Error **errp)
+{
+    GuestFileChecksum *sum = NULL;
+    GuestFileBlockChecksumList **link = NULL, *entry;
+    GChecksum *file_sum;
+    int64_t size = 0;
+    guchar *buf;
+    ssize_t len;
+    int fd;
+
+    if (!guest_file_check_block_size(has_block_size, &block_size, errp)) {
+        return NULL;
+    }
+
+    fd = qemu_open(path, O_RDONLY);
+    if (fd == -1) {
+        error_setg_errno(errp, errno, "failed to open file '%s'", path);
+        return NULL;
+    }
+
+    sum = g_new0(GuestFileChecksum, 1);
+    sum->block_size = block_size;
+    if (!has_blocks || blocks) {
+        sum->has_blocks = true;
+        link = &sum->blocks;
+    }
+
+    buf = g_malloc(block_size);
+    file_sum = g_checksum_new(G_CHECKSUM_SHA256);
+    while ((len = guest_file_read_block(fd, buf, block_size)) > 0) {
+        g_checksum_update(file_sum, buf, len);
+        size += len;
+        if (link) {
+            gchar *strong;
+
+            strong = g_compute_checksum_for_data(G_CHECKSUM_SHA256, buf, len);
+            strong[GUEST_CHECKSUM_STRONG_LEN] = '\0';
+
+            entry = g_new0(GuestFileBlockChecksumList, 1);
+            entry->value = g_new0(GuestFileBlockChecksum, 1);
+            entry->value->weak = guest_file_rolling_sum(buf, len);
+            entry->value->strong = strong;
+            *link = entry;
+            link = &entry->next;
+        }
+        if (len < block_size) {
+            break;
+        }
+    }
+    if (len < 0) {
+        error_setg_errno(errp, errno, "failed to read file '%s'", path);
+        qapi_free_GuestFileChecksum(sum);
+        sum = NULL;
+    } else {
+        sum->size = size;
+        sum->sha256 = g_strdup(g_checksum_get_string(file_sum));
+    }
+
+    g_checksum_free(file_sum);
+    g_free(buf);
+    close(fd);
+    return sum;
+}
+
+/* append the @count blocks of @src starting at @block to @dst */
+static bool guest_file_copy_blocks(int src, int dst, int64_t block,
+                                   int64_t count, int64_t block_size,
+                                   guchar *buf, GChecksum *dst_sum,
+                                   int64_t *size, Error **errp)
+{
+    ssize_t len;
+    size_t done;
+
+    for (; count > 0; count--, block++) {
+        done = 0;
+        while (done < block_size) {
+            len = pread(src, buf + done, block_size - done,
+                        block * block_size + done);
+            if (len == 0) {
+                break;
+            } else if (len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error_setg_errno(errp, errno, "failed to read block %" PRId64,
+                                 block);
+                return false;
+            }
+            done += len;
+        }
+        if (done == 0) {
+            error_setg(errp, "block %" PRId64 " is past the end of the file",
+                       block);
+            return false;
+        }
+        if (qemu_write_full(dst, buf, done) != done) {
+            error_setg_errno(errp, errno, "failed to write file");
+            return false;
+        }
+        g_checksum_update(dst_sum, buf, done);
+        *size += done;
+    }
+    return true;
+}
+
+GuestFileChecksum *qmp_guest_file_apply_delta(const char *path,
+                                              int64_t block_size,
+                                              GuestFileDeltaOpList *ops,
+                                              bool has_sha256,
+                                              const char *sha256,
+                                              Error **errp)
+{
+    GuestFileChecksum *result = NULL;
+    GuestFileDeltaOp *op;
+    GChecksum *dst_sum = NULL;
+    Error *local_err = NULL;
+    gchar *tmp_path = NULL, *dir_path;
+    char *real_path;
+    guchar *buf = NULL, *data;
+    int64_t size = 0;
+    struct stat st;
+    gsize data_len;
+    int src, dst = -1, dir;
+
+    if (!guest_file_check_block_size(true, &block_size, errp)) {
+        return NULL;
+    }
+
+    /* replace the file a symlink points to, not the symlink itself */
+    real_path = realpath(path, NULL);
+    if (!real_path) {
+        error_setg_errno(errp, errno, "failed to resolve path '%s'", path);
+        return NULL;
+    }
+
+    src = qemu_open(real_path, O_RDONLY);
+    if (src == -1) {
+        error_setg_errno(errp, errno, "failed to open file '%s'", path);
+        free(real_path);
+        return NULL;
+    }
+    if (fstat(src, &st) == -1) {
+        error_setg_errno(errp, errno, "failed to stat file '%s'", path);
+        goto out;
+    }
+
+    /* build the new version next to the old one, so rename() can swap them */
+    tmp_path = g_strdup_printf("%s.qga-XXXXXX", real_path);
+    dst = mkstemp(tmp_path);
+    if (dst == -1) {
+        error_setg_errno(errp, errno, "failed to create temporary file for "
+                         "'%s'", path);
+        goto out;
+    }
+    qemu_set_cloexec(dst);
+
+    buf = g_malloc(block_size);
+    dst_sum = g_checksum_new(G_CHECKSUM_SHA256);
+    for (; ops; ops = ops->next) {
+        op = ops->value;
+        if (op->has_block == op->has_data) {
+            error_setg(&local_err, "each delta operation needs either "
+                       "'block' or 'data'");
+            break;
+        }
+        if (op->has_data) {
+            data = g_base64_decode(op->data, &data_len);
+            if (qemu_write_full(dst, data, data_len) != data_len) {
+                error_setg_errno(&local_err, errno, "failed to write file");
+            }
+            g_checksum_update(dst_sum, data, data_len);
+            size += data_len;
+            g_free(data);
+        } else if (op->block < 0 || (op->has_count && op->count < 1)) {
+            error_setg(&local_err, "invalid block range %" PRId64 "+%" PRId64,
+                       op->block, op->has_count ? op->count : 1);
+        } else {
+            guest_file_copy_blocks(src, dst, op->block,
+                                   op->has_count ? op->count : 1, block_size,
+                                   buf, dst_sum, &size, &local_err);
+        }
+        if (local_err) {
+            break;
+        }
+    }
+
+    if (!local_err && has_sha256 &&
+        g_ascii_strcasecmp(sha256, g_checksum_get_string(dst_sum))) {
+        error_setg(&local_err, "checksum mismatch, the file is unchanged");
+    }
+    if (!local_err) {
+        /* keep the owner and permissions of the file being replaced */
+        if (fchown(dst, st.st_uid, st.st_gid) == -1) {
+            slog("failed to set owner of '%s': %s", tmp_path,
+                 strerror(errno));
+        }
+        if (fchmod(dst, st.st_mode & 07777) == -1 || fsync(dst) == -1) {
+            error_setg_errno(&local_err, errno, "failed to write file");
+        }
+    }
+    if (!local_err && rename(tmp_path, real_path) == -1) {
+        error_setg_errno(&local_err, errno, "failed to replace file '%s'",
+                         path);
+    }
+    if (!local_err) {
+        /* make the rename itself durable */
+        dir_path = g_path_get_dirname(real_path);
+        dir = qemu_open(dir_path, O_RDONLY | O_DIRECTORY);
+        if (dir == -1 || fsync(dir) == -1) {
+            error_setg_errno(&local_err, errno, "file '%s' was replaced, "
+                             "but syncing its directory failed", path);
+        }
+        if (dir != -1) {
+            close(dir);
+        }
+        g_free(dir_path);
+    }
+
+    if (local_err) {
+        unlink(tmp_path);
+        error_propagate(errp, local_err);
+    } else {
+        result = g_new0(GuestFileChecksum, 1);
+        result->size = size;
+        result->sha256 = g_strdup(g_checksum_get_string(dst_sum));
+        result->block_size = block_size;
+    }
+
+out:
+    if (dst_sum) {
+        g_checksum_free(dst_sum);
+    }
+    if (dst != -1) {
+        close(dst);
+    }
+    close(src);
+    g_free(buf);
+    g_free(tmp_path);
+    free(real_path);
+    return result;
+}
+
+/* linux-specific implementations. avoid this if at all possible. */
+#if defined(__linux__)
+
+typedef struct FsMount {
+    char *dirname;
+    char *devtype;
+    unsigned int devmajor, devminor;
+    QTAILQ_ENTRY(FsMount) next;
+} FsMount;
+
+typedef QTAILQ_HEAD(FsMountList, FsMount) FsMountList;
+
+static void free_fs_mount_list(FsMountList *mounts)
+{
+     FsMount *mount, *temp;
+
+     if (!mounts) {
+         return;
+     }
+
+     QTAILQ_FOREACH_SAFE(mount, mounts, next, temp) {
+         QTAILQ_REMOVE(mounts, mount, next);
+         g_free(mount->dirname);
+         g_free(mount->devtype);
+         g_free(mount);
+     }
+}
+
+static int dev_major_minor(const char *devpath,
+                           unsigned int *devmajor, unsigned int *devminor)
+{
+    struct stat st;
+
+    *devmajor = 0;
+    *devminor = 0;
+
+    if (stat(devpath, &st) < 0) {
+        slog("failed to stat device file '%s': %s", devpath, strerror(errno));
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        /* It is bind mount */
+        return -2;
+    }
+    if (S_ISBLK(st.st_mode)) {
+        *devmajor = major(st.st_rdev);
+        *devminor = minor(st.st_rdev);
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Walk the mount table and build a list of local file systems
+ */
+static void build_fs_mount_list_from_mtab(FsMountList *mounts, Error **errp)
+{
+    struct mntent *ment;
+    FsMount *mount;
+    char const *mtab = "/proc/self/mounts";
+    FILE *fp;
+    unsigned int devmajor, devminor;
+
+    fp = setmntent(mtab, "r");
     if (!fp) {
         error_setg(errp, "failed to open mtab file: '%s'", mtab);
         return;
@@ -766,7 +1373,6 @@ static void build_fs_mount_list(FsMountList *mounts, Error **errp)
 
     fclose(fp);
 }
-#endif
 
 #if defined(CONFIG_FSFREEZE)
 
@@ -1056,7 +1662,7 @@ static GuestFilesystemInfo *build_guest_fsinfo(struct FsMount *mount,
     return fs;
 }
 
-GuestFilesystemInfoList *qmp_guest_get_fsinfo(Error **errp)
+static GuestFilesystemInfoList *guest_build_fsinfo_list(Error **errp)
 {
     FsMountList mounts;
     struct FsMount *mount;
@@ -1089,6 +1695,187 @@ GuestFilesystemInfoList *qmp_guest_get_fsinfo(Error **errp)
     return ret;
 }
 
+/*
+ * Building the fsinfo list walks sysfs for every mount, so the result is
+ * cached until the kernel signals a change of the mount table (POLLPRI on
+ * /proc/self/mountinfo) or a block device uevent arrives. Without both
+ * notifications available, the list is built on every call.
+ */
+typedef struct GuestFsinfoCache {
+    QemuMutex lock;
+    bool failed;            /* notifications unavailable */
+    int mountinfo_fd;
+    int uevent_fd;
+    GuestFilesystemInfoList *list;
+} GuestFsinfoCache;
+
+static GuestFsinfoCache guest_fsinfo_cache = {
+    .mountinfo_fd = -1,
+    .uevent_fd = -1,
+};
+
+static bool guest_fsinfo_watch(GuestFsinfoCache *c)
+{
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = 1,     /* kernel uevents */
+    };
+
+    if (c->uevent_fd >= 0) {
+        return true;
+    }
+    if (c->failed) {
+        return false;
+    }
+
+    c->mountinfo_fd = qemu_open("/proc/self/mountinfo", O_RDONLY);
+    if (c->mountinfo_fd < 0) {
+        slog("failed to open /proc/self/mountinfo, not caching fsinfo: %s",
+             strerror(errno));
+        goto fail;
+    }
+    c->uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC |
+                          SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (c->uevent_fd < 0 ||
+        bind(c->uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        slog("failed to listen to uevents, not caching fsinfo: %s",
+             strerror(errno));
+        goto fail;
+    }
+    return true;
+
+fail:
+    if (c->mountinfo_fd >= 0) {
+        close(c->mountinfo_fd);
+        c->mountinfo_fd = -1;
+    }
+    if (c->uevent_fd >= 0) {
+        close(c->uevent_fd);
+        c->uevent_fd = -1;
+    }
+    c->failed = true;
+    return false;
+}
+
+/* Consume pending notifications, return true if the cache is stale */
+static bool guest_fsinfo_changed(GuestFsinfoCache *c)
+{
+    struct pollfd pfd = {
+        .fd = c->mountinfo_fd,
+        .events = POLLPRI,
+    };
+    bool changed = false;
+    char buf[4096];
+    ssize_t len;
+
+    if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR))) {
+        changed = true;
+    }
+
+    for (;;) {
+        len = recv(c->uevent_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS) {
+                /* some events were lost */
+                changed = true;
+                continue;
+            }
+            break;
+        }
+        /* "action@devpath\0KEY=value\0..." */
+        if (memmem(buf, len, "\0SUBSYSTEM=block\0", 17)) {
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+static GuestPCIAddress *guest_pci_address_copy(const GuestPCIAddress *src)
+{
+    return g_memdup(src, sizeof(*src));
+}
+
+static GuestFilesystemInfoList *
+guest_fsinfo_list_copy(const GuestFilesystemInfoList *src)
+{
+    GuestFilesystemInfoList *head = NULL, **link = &head, *entry;
+    GuestDiskAddressList **disk_link, *disk_entry;
+    const GuestDiskAddressList *disk;
+    GuestFilesystemInfo *fs;
+
+    for (; src; src = src->next) {
+        fs = g_new0(GuestFilesystemInfo, 1);
+        fs->name = g_strdup(src->value->name);
+        fs->mountpoint = g_strdup(src->value->mountpoint);
+        fs->type = g_strdup(src->value->type);
+
+        disk_link = &fs->disk;
+        for (disk = src->value->disk; disk; disk = disk->next) {
+            disk_entry = g_new0(GuestDiskAddressList, 1);
+            disk_entry->value = g_memdup(disk->value, sizeof(*disk->value));
+            disk_entry->value->pci_controller =
+                guest_pci_address_copy(disk->value->pci_controller);
+            *disk_link = disk_entry;
+            disk_link = &disk_entry->next;
+        }
+
+        entry = g_new0(GuestFilesystemInfoList, 1);
+        entry->value = fs;
+        *link = entry;
+        link = &entry->next;
+    }
+
+    return head;
+}
+
+GuestFilesystemInfoList *qmp_guest_get_fsinfo(Error **errp)
+{
+    GuestFsinfoCache *c = &guest_fsinfo_cache;
+    GuestFilesystemInfoList *ret;
+
+    qemu_mutex_lock(&c->lock);
+    if (!guest_fsinfo_watch(c)) {
+        qemu_mutex_unlock(&c->lock);
+        return guest_build_fsinfo_list(errp);
+    }
+
+    if (guest_fsinfo_changed(c)) {
+        qapi_free_GuestFilesystemInfoList(c->list);
+        c->list = NULL;
+    }
+    if (!c->list) {
+        /* an empty list is not cached, which is rare enough */
+        c->list = guest_build_fsinfo_list(errp);
+    }
+    ret = guest_fsinfo_list_copy(c->list);
+    qemu_mutex_unlock(&c->lock);
+
+    return ret;
+}
+
+static void guest_fsinfo_init(void)
+{
+    qemu_mutex_init(&guest_fsinfo_cache.lock);
+}
+
+static void guest_fsinfo_cleanup(void)
+{
+    GuestFsinfoCache *c = &guest_fsinfo_cache;
+
+    if (c->mountinfo_fd >= 0) {
+        close(c->mountinfo_fd);
+    }
+    if (c->uevent_fd >= 0) {
+        close(c->uevent_fd);
+    }
+    qapi_free_GuestFilesystemInfoList(c->list);
+    qemu_mutex_destroy(&c->lock);
+}
+
 
 typedef enum {
     FSFREEZE_HOOK_THAW = 0,
@@ -1167,18 +1954,97 @@ int64_t qmp_guest_fsfreeze_freeze(Error **errp)
     return qmp_guest_fsfreeze_freeze_list(false, NULL, errp);
 }
 
-/*
- * Walk list of mounted file systems in the guest, and freeze the ones which
- * are real local file systems.
- */
-int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
-                                       strList *mountpoints,
-                                       Error **errp)
+#define GUEST_FSFREEZE_SYNC_THREADS 8
+
+typedef struct GuestFsfreezeSync {
+    FsMount **mounts;
+    int64_t *times;         /* us */
+    int count;
+    int next;               /* next mount to flush, shared by the threads */
+} GuestFsfreezeSync;
+
+static void *guest_fsfreeze_sync_thread(void *opaque)
+{
+    GuestFsfreezeSync *sync = opaque;
+    int64_t start;
+    int i, fd;
+
+    while ((i = atomic_fetch_inc(&sync->next)) < sync->count) {
+        start = g_get_monotonic_time();
+        fd = qemu_open(sync->mounts[i]->dirname, O_RDONLY);
+        if (fd >= 0) {
+            if (syncfs(fd) < 0) {
+                slog("failed to sync %s: %s", sync->mounts[i]->dirname,
+                     strerror(errno));
+            }
+            close(fd);
+        }
+        sync->times[i] = g_get_monotonic_time() - start;
+    }
+
+    return NULL;
+}
+
+/*
+ * Flush the file systems before freezing them. Flushing them one by one
+ * as part of FIFREEZE would keep the ones frozen first blocked for the
+ * time it takes to flush all the others.
+ */
+static void guest_fsfreeze_sync(FsMount **mounts, int count, int nthreads,
+                                int64_t *times)
+{
+#ifdef CONFIG_SYNCFS
+    GuestFsfreezeSync sync = {
+        .mounts = mounts,
+        .times = times,
+        .count = count,
+    };
+    QemuThread *threads;
+    int i;
+
+    nthreads = MIN(nthreads, count);
+    threads = g_new(QemuThread, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_create(&threads[i], "qga-fsfreeze-sync",
+                           guest_fsfreeze_sync_thread, &sync,
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+#else
+    /* no way to flush a single file system, flush them all at once */
+    int64_t start = g_get_monotonic_time();
+    int i;
+
+    sync();
+    for (i = 0; i < count; i++) {
+        times[i] = g_get_monotonic_time() - start;
+    }
+#endif
+}
+
+/*
+ * Walk list of mounted file systems in the guest, and freeze the ones which
+ * are real local file systems. With @sync_threads > 0 they are flushed in
+ * parallel first. If @result is not NULL, per mount timings are returned
+ * there.
+ */
+static int64_t guest_fsfreeze_freeze_mounts(bool has_mountpoints,
+                                            strList *mountpoints,
+                                            int sync_threads,
+                                            GuestFsfreezeResult **result,
+                                            Error **errp)
 {
-    int ret = 0, i = 0;
+    int ret = 0, i = 0, j;
     strList *list;
     FsMountList mounts;
     struct FsMount *mount;
+    GPtrArray *selected;
+    GuestFsfreezeMountStatus **status;
+    GuestFsfreezeMountStatusList **link, *entry;
+    int64_t *sync_times, start, end;
     Error *local_err = NULL;
     int fd;
 
@@ -1197,12 +2063,10 @@ int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
         return -1;
     }
 
-    /* cannot risk guest agent blocking itself on a write in this state */
-    ga_set_frozen(ga_state);
-
+    /* To issue fsfreeze in the reverse order of mounts, walk them backwards
+     * and check if the mount is listed in the list here */
+    selected = g_ptr_array_new();
     QTAILQ_FOREACH_REVERSE(mount, &mounts, FsMountList, next) {
-        /* To issue fsfreeze in the reverse order of mounts, check if the
-         * mount is listed in the list here */
         if (has_mountpoints) {
             for (list = mountpoints; list; list = list->next) {
                 if (strcmp(list->value, mount->dirname) == 0) {
@@ -1213,6 +2077,26 @@ int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
                 continue;
             }
         }
+        g_ptr_array_add(selected, mount);
+    }
+
+    sync_times = g_new0(int64_t, selected->len);
+    status = g_new0(GuestFsfreezeMountStatus *, selected->len);
+    if (sync_threads > 0 && selected->len) {
+        guest_fsfreeze_sync((FsMount **)selected->pdata, selected->len,
+                            sync_threads, sync_times);
+    }
+
+    /* cannot risk guest agent blocking itself on a write in this state */
+    ga_set_frozen(ga_state);
+
+    start = g_get_monotonic_time();
+    for (j = 0; j < selected->len; j++) {
+        mount = g_ptr_array_index(selected, j);
+
+        status[j] = g_new0(GuestFsfreezeMountStatus, 1);
+        status[j]->mountpoint = g_strdup(mount->dirname);
+        status[j]->sync_time = sync_times[j];
 
         fd = qemu_open(mount->dirname, O_RDONLY);
         if (fd == -1) {
@@ -1229,7 +2113,10 @@ int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
          * expect to be freezable, so return an error in those cases
          * and return system to thawed state.
          */
+        status[j]->frozen_time = g_get_monotonic_time();
         ret = ioctl(fd, FIFREEZE);
+        status[j]->freeze_time = g_get_monotonic_time() -
+                                 status[j]->frozen_time;
         if (ret == -1) {
             if (errno != EOPNOTSUPP) {
                 error_setg_errno(errp, errno, "failed to freeze %s",
@@ -1238,20 +2125,86 @@ int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
                 goto error;
             }
         } else {
+            status[j]->frozen = true;
             i++;
         }
         close(fd);
     }
+    end = g_get_monotonic_time();
+
+    if (result) {
+        *result = g_new0(GuestFsfreezeResult, 1);
+        (*result)->count = i;
+        (*result)->time = end - start;
+        link = &(*result)->mounts;
+        for (j = 0; j < selected->len; j++) {
+            /* frozen_time held the start of the freeze until now */
+            status[j]->frozen_time = status[j]->frozen ?
+                                     end - status[j]->frozen_time : 0;
+            entry = g_new0(GuestFsfreezeMountStatusList, 1);
+            entry->value = status[j];
+            status[j] = NULL;
+            *link = entry;
+            link = &entry->next;
+        }
+    }
 
+    for (j = 0; j < selected->len; j++) {
+        qapi_free_GuestFsfreezeMountStatus(status[j]);
+    }
+    g_free(status);
+    g_free(sync_times);
+    g_ptr_array_free(selected, true);
     free_fs_mount_list(&mounts);
     return i;
 
 error:
+    for (j = 0; j < selected->len; j++) {
+        qapi_free_GuestFsfreezeMountStatus(status[j]);
+    }
+    g_free(status);
+    g_free(sync_times);
+    g_ptr_array_free(selected, true);
     free_fs_mount_list(&mounts);
     qmp_guest_fsfreeze_thaw(NULL);
     return 0;
 }
 
+int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
+                                       strList *mountpoints,
+                                       Error **errp)
+{
+    return guest_fsfreeze_freeze_mounts(has_mountpoints, mountpoints, 0,
+                                        NULL, errp);
+}
+
+GuestFsfreezeResult *qmp_guest_fsfreeze_freeze_parallel(bool has_mountpoints,
+                                                        strList *mountpoints,
+                                                        bool has_sync_threads,
+                                                        int64_t sync_threads,
+                                                        Error **errp)
+{
+    GuestFsfreezeResult *result = NULL;
+    Error *local_err = NULL;
+
+    if (!has_sync_threads) {
+        sync_threads = GUEST_FSFREEZE_SYNC_THREADS;
+    }
+    if (sync_threads < 1 || sync_threads > 64) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "sync-threads",
+                   "a value between 1 and 64");
+        return NULL;
+    }
+
+    guest_fsfreeze_freeze_mounts(has_mountpoints, mountpoints, sync_threads,
+                                 &result, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return NULL;
+    }
+    return result;
+}
+
 /*
  * Walk list of frozen file systems in the guest, and thaw them.
  */
@@ -1779,6 +2732,65 @@ static long sysconf_exact(int name, const char *name_str, Error **errp)
     return ret;
 }
 
+/*
+ * The vcpu and memory block directories in sysfs are opened relative to a
+ * file descriptor of their parent, which is opened once and kept, instead
+ * of resolving the whole path for every block.
+ */
+typedef struct GuestSysfsDir {
+    const char *path;
+    int fd;
+} GuestSysfsDir;
+
+static GuestSysfsDir guest_sysfs_cpu = {
+    .path = "/sys/devices/system/cpu",
+    .fd = -1,
+};
+
+static GuestSysfsDir guest_sysfs_memory = {
+    .path = "/sys/devices/system/memory",
+    .fd = -1,
+};
+
+/* Return the cached fd of @dir, or -1 with errno set */
+static int guest_sysfs_dir_fd(GuestSysfsDir *dir)
+{
+    int fd, old;
+
+    fd = atomic_read(&dir->fd);
+    if (fd == -1) {
+        fd = qemu_open(dir->path, O_RDONLY | O_DIRECTORY);
+        if (fd == -1) {
+            return -1;
+        }
+        /* lost a race against another worker thread, use its fd */
+        old = atomic_cmpxchg(&dir->fd, -1, fd);
+        if (old != -1) {
+            close(fd);
+            fd = old;
+        }
+    }
+    return fd;
+}
+
+static int guest_sysfs_dir_open(GuestSysfsDir *dir, const char *name)
+{
+    int fd = guest_sysfs_dir_fd(dir);
+
+    if (fd == -1) {
+        return -1;
+    }
+    return openat(fd, name, O_RDONLY | O_DIRECTORY);
+}
+
+static void guest_sysfs_dir_close(GuestSysfsDir *dir)
+{
+    if (dir->fd != -1) {
+        close(dir->fd);
+        dir->fd = -1;
+    }
+}
+
 /* Transfer online/offline status between @vcpu and the guest system.
  *
  * On input either @errp or *@errp must be NULL.
@@ -1800,9 +2812,10 @@ static void transfer_vcpu(GuestLogicalProcessor *vcpu, bool sys2vcpu,
     char *dirpath;
     int dirfd;
 
-    dirpath = g_strdup_printf("/sys/devices/system/cpu/cpu%" PRId64 "/",
+    dirpath = g_strdup_printf("%s/cpu%" PRId64, guest_sysfs_cpu.path,
                               vcpu->logical_id);
-    dirfd = open(dirpath, O_RDONLY | O_DIRECTORY);
+    dirfd = guest_sysfs_dir_open(&guest_sysfs_cpu,
+                                 dirpath + strlen(guest_sysfs_cpu.path) + 1);
     if (dirfd == -1) {
         error_setg_errno(errp, errno, "open(\"%s\")", dirpath);
     } else {
@@ -2085,29 +3098,27 @@ static void transfer_memory_block(GuestMemoryBlock *mem_blk, bool sys2memblk,
     Error *local_err = NULL;
 
     if (!sys2memblk) {
-        DIR *dp;
-
         if (!result) {
             error_setg(errp, "Internal error, 'result' should not be NULL");
             return;
         }
         errno = 0;
-        dp = opendir("/sys/devices/system/memory/");
          /* if there is no 'memory' directory in sysfs,
          * we think this VM does not support online/offline memory block,
          * any other solution?
          */
-        if (!dp && errno == ENOENT) {
+        if (guest_sysfs_dir_fd(&guest_sysfs_memory) == -1 &&
+            errno == ENOENT) {
             result->response =
                 GUEST_MEMORY_BLOCK_RESPONSE_TYPE_OPERATION_NOT_SUPPORTED;
             goto out1;
         }
-        closedir(dp);
     }
 
-    dirpath = g_strdup_printf("/sys/devices/system/memory/memory%" PRId64 "/",
+    dirpath = g_strdup_printf("%s/memory%" PRId64, guest_sysfs_memory.path,
                               mem_blk->phys_index);
-    dirfd = open(dirpath, O_RDONLY | O_DIRECTORY);
+    dirfd = guest_sysfs_dir_open(&guest_sysfs_memory,
+                                 dirpath + strlen(guest_sysfs_memory.path) + 1);
     if (dirfd == -1) {
         if (sys2memblk) {
             error_setg_errno(errp, errno, "open(\"%s\")", dirpath);
@@ -2331,9 +3342,377 @@ GuestMemoryBlockInfo *qmp_guest_get_memory_block_info(Error **errp)
     return info;
 }
 
+/*
+ * guest-set-memory-blocks-async and guest-set-vcpus-async run the same
+ * transfer functions as their synchronous versions from a few worker
+ * threads, which pick the next entry through a shared index. Finished
+ * entries are appended to @order, from where guest-hotplug-job-status
+ * returns them while the job is still running.
+ *
+ * A finished job whose results nobody collects is dropped after
+ * GUEST_HOTPLUG_JOB_EXPIRE, and at most GUEST_HOTPLUG_JOBS_FINISHED are
+ * kept, so that forgotten jobs don't pile up.
+ */
+#define GUEST_HOTPLUG_THREADS 4
+#define GUEST_HOTPLUG_THREADS_MAX 16
+#define GUEST_HOTPLUG_JOB_EXPIRE (60 * G_USEC_PER_SEC)
+#define GUEST_HOTPLUG_JOBS_FINISHED 16
+
+typedef struct GuestHotplugTask {
+    int64_t id;
+    int64_t start;          /* monotonic, us */
+    int64_t finished;       /* monotonic, us, 0 while running */
+    int total;
+    int next;               /* next entry to process, shared by the threads */
+    bool cancel;
+    int completed;          /* protected by guest_hotplug_state.lock */
+    int *order;             /* entries in completion order */
+    GuestMemoryBlock *mem_blks;
+    GuestMemoryBlockResponse *mem_results;
+    GuestLogicalProcessor *vcpus;
+    GuestLogicalProcessorResponse *vcpu_results;
+    QemuThread *threads;
+    int nthreads;
+    QTAILQ_ENTRY(GuestHotplugTask) entry;
+} GuestHotplugTask;
+
+static struct {
+    QemuMutex lock;
+    int64_t last_id;
+    QTAILQ_HEAD(, GuestHotplugTask) tasks;
+} guest_hotplug_state = {
+    .tasks = QTAILQ_HEAD_INITIALIZER(guest_hotplug_state.tasks),
+};
+
+static void *guest_hotplug_thread(void *opaque)
+{
+    GuestHotplugTask *task = opaque;
+    Error *local_err = NULL;
+    int i;
+
+    while (!atomic_read(&task->cancel) &&
+           (i = atomic_fetch_inc(&task->next)) < task->total) {
+        if (task->mem_blks) {
+            task->mem_results[i].phys_index = task->mem_blks[i].phys_index;
+            /* failures are reported in the result */
+            transfer_memory_block(&task->mem_blks[i], false,
+                                  &task->mem_results[i], NULL);
+        } else {
+            GuestLogicalProcessorResponse *result = &task->vcpu_results[i];
+
+            result->logical_id = task->vcpus[i].logical_id;
+            transfer_vcpu(&task->vcpus[i], false, &local_err);
+            if (local_err) {
+                result->has_desc = true;
+                result->desc = g_strdup(error_get_pretty(local_err));
+                error_free(local_err);
+                local_err = NULL;
+            } else {
+                result->success = true;
+            }
+        }
+
+        qemu_mutex_lock(&guest_hotplug_state.lock);
+        task->order[task->completed++] = i;
+        if (task->completed == task->total) {
+            task->finished = g_get_monotonic_time();
+        }
+        qemu_mutex_unlock(&guest_hotplug_state.lock);
+    }
+
+    return NULL;
+}
+
+static int guest_hotplug_threads(bool has_threads, int64_t threads,
+                                 Error **errp)
+{
+    if (!has_threads) {
+        return GUEST_HOTPLUG_THREADS;
+    }
+    if (threads < 1 || threads > GUEST_HOTPLUG_THREADS_MAX) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "threads",
+                   "a value between 1 and 16");
+        return -1;
+    }
+    return threads;
+}
+
+static void guest_hotplug_task_free(GuestHotplugTask *task);
+
+/*
+ * Called with guest_hotplug_state.lock held. Returns the finished tasks
+ * that are too old or too many, which the caller frees after unlocking.
+ */
+static GSList *guest_hotplug_expire(void)
+{
+    GuestHotplugTask *task, *next;
+    int64_t now = g_get_monotonic_time();
+    GSList *stale = NULL;
+    int finished = 0;
+
+    QTAILQ_FOREACH(task, &guest_hotplug_state.tasks, entry) {
+        finished += task->finished != 0;
+    }
+    /* oldest first */
+    QTAILQ_FOREACH_SAFE(task, &guest_hotplug_state.tasks, entry, next) {
+        if (task->finished &&
+            (finished > GUEST_HOTPLUG_JOBS_FINISHED ||
+             now - task->finished > GUEST_HOTPLUG_JOB_EXPIRE)) {
+            QTAILQ_REMOVE(&guest_hotplug_state.tasks, task, entry);
+            stale = g_slist_prepend(stale, task);
+            finished--;
+        }
+    }
+    return stale;
+}
+
+static GuestHotplugJob *guest_hotplug_task_start(GuestHotplugTask *task,
+                                                 int nthreads)
+{
+    GuestHotplugJob *job;
+    GSList *stale;
+    int i;
+
+    task->start = g_get_monotonic_time();
+    task->order = g_new(int, task->total);
+    task->nthreads = MIN(nthreads, task->total);
+    task->threads = g_new(QemuThread, task->nthreads);
+
+    qemu_mutex_lock(&guest_hotplug_state.lock);
+    stale = guest_hotplug_expire();
+    task->id = ++guest_hotplug_state.last_id;
+    QTAILQ_INSERT_TAIL(&guest_hotplug_state.tasks, task, entry);
+    qemu_mutex_unlock(&guest_hotplug_state.lock);
+    g_slist_free_full(stale, (GDestroyNotify)guest_hotplug_task_free);
+
+    for (i = 0; i < task->nthreads; i++) {
+        qemu_thread_create(&task->threads[i], "qga-hotplug",
+                           guest_hotplug_thread, task, QEMU_THREAD_JOINABLE);
+    }
+
+    job = g_new0(GuestHotplugJob, 1);
+    job->job_id = task->id;
+    return job;
+}
+
+/* the task must have been removed from guest_hotplug_state.tasks */
+static void guest_hotplug_task_free(GuestHotplugTask *task)
+{
+    int i;
+
+    for (i = 0; i < task->nthreads; i++) {
+        qemu_thread_join(&task->threads[i]);
+    }
+    if (task->vcpu_results) {
+        for (i = 0; i < task->total; i++) {
+            g_free(task->vcpu_results[i].desc);
+        }
+    }
+    g_free(task->threads);
+    g_free(task->order);
+    g_free(task->mem_blks);
+    g_free(task->mem_results);
+    g_free(task->vcpus);
+    g_free(task->vcpu_results);
+    g_free(task);
+}
+
+GuestHotplugJob *
+qmp_guest_set_memory_blocks_async(GuestMemoryBlockList *mem_blks,
+                                  bool has_threads, int64_t threads,
+                                  Error **errp)
+{
+    GuestHotplugTask *task;
+    GuestMemoryBlockList *l;
+    GHashTable *seen;
+    int nthreads, n = 0;
+
+    nthreads = guest_hotplug_threads(has_threads, threads, errp);
+    if (nthreads < 0) {
+        return NULL;
+    }
+
+    seen = g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (l = mem_blks; l; l = l->next) {
+        if (g_hash_table_lookup(seen, &l->value->phys_index)) {
+            error_setg(errp, "memory block %" PRIu64 " is listed twice",
+                       l->value->phys_index);
+            g_hash_table_destroy(seen);
+            return NULL;
+        }
+        g_hash_table_insert(seen, &l->value->phys_index, l->value);
+        n++;
+    }
+    g_hash_table_destroy(seen);
+    if (n == 0) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "mem-blks",
+                   "a non-empty list");
+        return NULL;
+    }
+
+    task = g_new0(GuestHotplugTask, 1);
+    task->total = n;
+    task->mem_blks = g_new(GuestMemoryBlock, n);
+    task->mem_results = g_new0(GuestMemoryBlockResponse, n);
+    for (l = mem_blks, n = 0; l; l = l->next, n++) {
+        task->mem_blks[n] = *l->value;
+    }
+
+    return guest_hotplug_task_start(task, nthreads);
+}
+
+GuestHotplugJob *qmp_guest_set_vcpus_async(GuestLogicalProcessorList *vcpus,
+                                           bool has_threads, int64_t threads,
+                                           Error **errp)
+{
+    GuestHotplugTask *task;
+    GuestLogicalProcessorList *l;
+    GHashTable *seen;
+    int nthreads, n = 0;
+
+    nthreads = guest_hotplug_threads(has_threads, threads, errp);
+    if (nthreads < 0) {
+        return NULL;
+    }
+
+    seen = g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (l = vcpus; l; l = l->next) {
+        if (g_hash_table_lookup(seen, &l->value->logical_id)) {
+            error_setg(errp, "logical processor #%" PRId64 " is listed twice",
+                       l->value->logical_id);
+            g_hash_table_destroy(seen);
+            return NULL;
+        }
+        g_hash_table_insert(seen, &l->value->logical_id, l->value);
+        n++;
+    }
+    g_hash_table_destroy(seen);
+    if (n == 0) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "vcpus",
+                   "a non-empty list");
+        return NULL;
+    }
+
+    task = g_new0(GuestHotplugTask, 1);
+    task->total = n;
+    task->vcpus = g_new(GuestLogicalProcessor, n);
+    task->vcpu_results = g_new0(GuestLogicalProcessorResponse, n);
+    for (l = vcpus, n = 0; l; l = l->next, n++) {
+        task->vcpus[n] = *l->value;
+    }
+
+    return guest_hotplug_task_start(task, nthreads);
+}
+
+GuestHotplugJobStatus *qmp_guest_hotplug_job_status(int64_t job_id,
+                                                    bool has_cursor,
+                                                    int64_t cursor,
+                                                    Error **errp)
+{
+    GuestHotplugJobStatus *status;
+    GuestMemoryBlockResponseList **mem_link;
+    GuestLogicalProcessorResponseList **vcpu_link;
+    GuestHotplugTask *task;
+    GSList *stale;
+    int i;
+
+    qemu_mutex_lock(&guest_hotplug_state.lock);
+    stale = guest_hotplug_expire();
+    QTAILQ_FOREACH(task, &guest_hotplug_state.tasks, entry) {
+        if (task->id == job_id) {
+            break;
+        }
+    }
+    if (!task) {
+        qemu_mutex_unlock(&guest_hotplug_state.lock);
+        g_slist_free_full(stale, (GDestroyNotify)guest_hotplug_task_free);
+        error_setg(errp, "hotplug job %" PRId64 " not found", job_id);
+        return NULL;
+    }
+    if (!has_cursor) {
+        cursor = 0;
+    }
+    if (cursor < 0 || cursor > task->completed) {
+        qemu_mutex_unlock(&guest_hotplug_state.lock);
+        g_slist_free_full(stale, (GDestroyNotify)guest_hotplug_task_free);
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "cursor",
+                   "a position up to the number of completed entries");
+        return NULL;
+    }
+
+    status = g_new0(GuestHotplugJobStatus, 1);
+    status->total = task->total;
+    status->completed = task->completed;
+    status->done = task->completed == task->total;
+    status->cursor = task->completed;
+    status->elapsed = (g_get_monotonic_time() - task->start) / 1000;
+
+    mem_link = &status->mem_blks;
+    vcpu_link = &status->vcpus;
+    for (i = cursor; i < task->completed; i++) {
+        int idx = task->order[i];
+
+        if (task->mem_blks) {
+            GuestMemoryBlockResponseList *entry;
+
+            entry = g_new0(GuestMemoryBlockResponseList, 1);
+            entry->value = g_memdup(&task->mem_results[idx],
+                                    sizeof(task->mem_results[idx]));
+            *mem_link = entry;
+            mem_link = &entry->next;
+        } else {
+            GuestLogicalProcessorResponseList *entry;
+
+            entry = g_new0(GuestLogicalProcessorResponseList, 1);
+            entry->value = g_memdup(&task->vcpu_results[idx],
+                                    sizeof(task->vcpu_results[idx]));
+            entry->value->desc = g_strdup(task->vcpu_results[idx].desc);
+            *vcpu_link = entry;
+            vcpu_link = &entry->next;
+        }
+    }
+    status->has_mem_blks = task->mem_blks != NULL;
+    status->has_vcpus = task->vcpus != NULL;
+
+    if (status->done) {
+        QTAILQ_REMOVE(&guest_hotplug_state.tasks, task, entry);
+        stale = g_slist_prepend(stale, task);
+    }
+    qemu_mutex_unlock(&guest_hotplug_state.lock);
+    g_slist_free_full(stale, (GDestroyNotify)guest_hotplug_task_free);
+
+    return status;
+}
+
+static void guest_hotplug_init(void)
+{
+    qemu_mutex_init(&guest_hotplug_state.lock);
+}
+
+static void guest_hotplug_cleanup(void)
+{
+    GuestHotplugTask *task;
+
+    qemu_mutex_lock(&guest_hotplug_state.lock);
+    QTAILQ_FOREACH(task, &guest_hotplug_state.tasks, entry) {
+        atomic_set(&task->cancel, true);
+    }
+    qemu_mutex_unlock(&guest_hotplug_state.lock);
+
+    while (!QTAILQ_EMPTY(&guest_hotplug_state.tasks)) {
+        task = QTAILQ_FIRST(&guest_hotplug_state.tasks);
+        QTAILQ_REMOVE(&guest_hotplug_state.tasks, task, entry);
+        guest_hotplug_task_free(task);
+    }
+
+    guest_sysfs_dir_close(&guest_sysfs_cpu);
+    guest_sysfs_dir_close(&guest_sysfs_memory);
+    qemu_mutex_destroy(&guest_hotplug_state.lock);
+}
+
 /*MemoryStatus*/
 /*########################################################################################################*/
-GuestMemoryStatus *qmp_guest_get_memory_status(Error **errp)
+static GuestMemoryStatus *guest_collect_memory_status(Error **errp)
 {
     Error *local_err = NULL;
     int oflag;
@@ -2419,138 +3798,1648 @@ GuestMemoryStatus *qmp_guest_get_memory_status(Error **errp)
         }
         error_free(local_err);
     }
-    else
-        error_propagate(errp, local_err);
+    else
+        error_propagate(errp, local_err);
+
+    return status;
+}
+/*########################################################################################################*/
+
+/*OSStatus*/
+/*########################################################################################################*/
+/* Resolve the canonical name of this host the way `hostname -f` does */
+static char *guest_get_fqdn(void)
+{
+    char hostname[HOST_NAME_MAX + 1] = "";
+    struct addrinfo hints, *res = NULL;
+    char *fqdn;
+
+    if (gethostname(hostname, sizeof(hostname) - 1) < 0) {
+        slog("failed to get hostname: %s", strerror(errno));
+        return g_strdup("");
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags = AI_CANONNAME;
+    if (getaddrinfo(hostname, NULL, &hints, &res) == 0 &&
+        res->ai_canonname) {
+        fqdn = g_strdup(res->ai_canonname);
+    } else {
+        fqdn = g_strdup(hostname);
+    }
+    if (res) {
+        freeaddrinfo(res);
+    }
+
+    return fqdn;
+}
+
+/* Format root's record from the lastlog database the way lastlog(8) does */
+static char *guest_get_lastlogin(void)
+{
+    const char *path = "/var/log/lastlog";
+    struct passwd pwd, *pw = NULL;
+    struct lastlog ll;
+    char pwbuf[1024], date[64];
+    const char *user = "root";
+    struct tm tm;
+    time_t t;
+    ssize_t len;
+    int fd;
+
+    if (getpwuid_r(0, &pwd, pwbuf, sizeof(pwbuf), &pw) == 0 && pw) {
+        user = pw->pw_name;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        slog("failed to open '%s': %s", path, strerror(errno));
+        return g_strdup_printf("%-16s **Never logged in**", user);
+    }
+    len = pread(fd, &ll, sizeof(ll), 0);
+    close(fd);
+
+    if (len != sizeof(ll) || ll.ll_time == 0) {
+        return g_strdup_printf("%-16s **Never logged in**", user);
+    }
+
+    t = ll.ll_time;
+    localtime_r(&t, &tm);
+    strftime(date, sizeof(date), "%a %b %e %H:%M:%S %z %Y", &tm);
+
+    return g_strdup_printf("%-16s %-8.*s %-16.*s %s", user,
+                           (int)sizeof(ll.ll_line), ll.ll_line,
+                           (int)sizeof(ll.ll_host), ll.ll_host, date);
+}
+
+GuestSystemInfo *qmp_guest_get_system_info(Error **errp)
+{
+    GuestSystemInfo *info;
+    struct utsname uts;
+
+    if (uname(&uts) < 0) {
+        error_setg_errno(errp, errno, "failed to get system information");
+        return NULL;
+    }
+
+    info = g_new0(GuestSystemInfo, 1);
+    info->os_name = g_strdup(uts.sysname);
+    info->kernel_version = g_strdup(uts.release);
+    info->system_version = g_strdup(uts.version);
+    info->fqdn = guest_get_fqdn();
+    info->lastlogin = guest_get_lastlogin();
+
+    return info;
+}
+/*########################################################################################################*/
+
+/*APPStatus*/
+/*########################################################################################################*/
+#define GUEST_APP_STATUS_MAX_LINES 200
+
+typedef struct GuestProcStat {
+    int pid;
+    int ppid;
+    char comm[64];
+    char state;
+    uid_t uid;
+    uint64_t ticks;         /* utime + stime, in clock ticks */
+    uint64_t starttime;     /* clock ticks after boot */
+    long priority;
+    long nice;
+    long threads;
+    uint64_t vsize;         /* bytes */
+    uint64_t rss;           /* pages */
+    double cpu;             /* filled in by the caller */
+} GuestProcStat;
+
+/*
+ * Parse /proc/@pid/stat, relative to the /proc directory @procfd. The
+ * owner is only looked up if @with_uid is true.
+ */
+static bool guest_proc_stat_read(int procfd, const char *pid, bool with_uid,
+                                 GuestProcStat *ps)
+{
+    char path[64], buf[1024], *comm, *end;
+    unsigned long long utime, stime, starttime, vsize;
+    struct stat st;
+    ssize_t len;
+    long rss;
+    int fd, ret;
+
+    snprintf(path, sizeof(path), "%s/stat", pid);
+    fd = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        /* the process went away under us */
+        return false;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    ret = with_uid ? fstat(fd, &st) : 0;
+    close(fd);
+    if (len <= 0 || ret < 0) {
+        return false;
+    }
+    buf[len] = 0;
+
+    /* the command name may contain spaces and parentheses */
+    comm = strchr(buf, '(');
+    end = strrchr(buf, ')');
+    if (!comm || !end || end < comm || end[1] != ' ') {
+        return false;
+    }
+
+    memset(ps, 0, sizeof(*ps));
+    ret = sscanf(end + 2, "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                 "%llu %llu %*d %*d %ld %ld %ld %*d %llu %llu %ld",
+                 &ps->state, &ps->ppid, &utime, &stime, &ps->priority,
+                 &ps->nice, &ps->threads, &starttime, &vsize, &rss);
+    if (ret != 10) {
+        return false;
+    }
+
+    ps->pid = atoi(pid);
+    g_strlcpy(ps->comm, comm + 1,
+              MIN(end - comm, (ptrdiff_t)sizeof(ps->comm)));
+    ps->uid = with_uid ? st.st_uid : 0;
+    ps->ticks = utime + stime;
+    ps->starttime = starttime;
+    ps->vsize = vsize;
+    ps->rss = rss > 0 ? rss : 0;
+
+    return true;
+}
+
+/* Walk /proc and collect a GuestProcStat for every live process */
+static GArray *guest_proc_scan(Error **errp)
+{
+    GuestProcStat ps;
+    struct dirent *de;
+    GArray *procs;
+    DIR *dir;
+
+    dir = opendir("/proc");
+    if (!dir) {
+        error_setg_errno(errp, errno, "failed to open /proc");
+        return NULL;
+    }
+
+    procs = g_array_new(FALSE, FALSE, sizeof(GuestProcStat));
+    while ((de = readdir(dir))) {
+        if (!g_ascii_isdigit(de->d_name[0])) {
+            continue;
+        }
+        if (guest_proc_stat_read(dirfd(dir), de->d_name, true, &ps)) {
+            g_array_append_val(procs, ps);
+        }
+    }
+    closedir(dir);
+
+    return procs;
+}
+
+static gint guest_proc_compare_cpu(gconstpointer a, gconstpointer b)
+{
+    const GuestProcStat *pa = a, *pb = b;
+
+    if (pa->cpu != pb->cpu) {
+        return pa->cpu < pb->cpu ? 1 : -1;
+    }
+    return pa->pid - pb->pid;
+}
+
+static const char *guest_user_name(GHashTable *users, uid_t uid)
+{
+    struct passwd pwd, *pw = NULL;
+    char buf[1024];
+    char *name;
+
+    name = g_hash_table_lookup(users, GUINT_TO_POINTER(uid));
+    if (!name) {
+        if (getpwuid_r(uid, &pwd, buf, sizeof(buf), &pw) == 0 && pw) {
+            name = g_strdup(pw->pw_name);
+        } else {
+            name = g_strdup_printf("%u", (unsigned int)uid);
+        }
+        g_hash_table_insert(users, GUINT_TO_POINTER(uid), name);
+    }
+
+    return name;
+}
+
+/* Render a process table in the layout of `top -b -n 1` */
+static char *guest_format_app_status(GArray *procs, struct sysinfo *si)
+{
+    long hz = sysconf(_SC_CLK_TCK);
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t mem_unit = si->mem_unit ? si->mem_unit : 1;
+    uint64_t total_ram = si->totalram * mem_unit;
+    uint64_t uptime_ticks = (uint64_t)si->uptime * hz;
+    int running = 0, sleeping = 0, stopped = 0, zombie = 0;
+    GHashTable *users;
+    GString *out;
+    char now[16];
+    struct tm tm;
+    time_t t;
+    guint i;
+
+    for (i = 0; i < procs->len; i++) {
+        GuestProcStat *ps = &g_array_index(procs, GuestProcStat, i);
+        uint64_t age = uptime_ticks > ps->starttime ?
+                       uptime_ticks - ps->starttime : 0;
+
+        /* no previous sample to diff against, use the lifetime average */
+        ps->cpu = age ? 100.0 * ps->ticks / age : 0;
+
+        switch (ps->state) {
+        case 'R':
+            running++;
+            break;
+        case 'T':
+        case 't':
+            stopped++;
+            break;
+        case 'Z':
+            zombie++;
+            break;
+        default:
+            sleeping++;
+            break;
+        }
+    }
+    g_array_sort(procs, guest_proc_compare_cpu);
+
+    t = time(NULL);
+    localtime_r(&t, &tm);
+    strftime(now, sizeof(now), "%H:%M:%S", &tm);
+
+    out = g_string_sized_new(GUEST_APP_STATUS_MAX_LINES * 80);
+    g_string_append_printf(out, "top - %s up %ld days, %2ld:%02ld,  "
+                           "load average: %.2f, %.2f, %.2f\n", now,
+                           si->uptime / 86400, si->uptime % 86400 / 3600,
+                           si->uptime % 3600 / 60,
+                           si->loads[0] / (double)(1 << SI_LOAD_SHIFT),
+                           si->loads[1] / (double)(1 << SI_LOAD_SHIFT),
+                           si->loads[2] / (double)(1 << SI_LOAD_SHIFT));
+    g_string_append_printf(out, "Tasks: %3u total, %3d running, "
+                           "%3d sleeping, %3d stopped, %3d zombie\n",
+                           procs->len, running, sleeping, stopped, zombie);
+    g_string_append_printf(out, "KiB Mem : %8" PRIu64 " total, %8" PRIu64
+                           " free, %8" PRIu64 " buffers\n",
+                           total_ram / 1024,
+                           (uint64_t)si->freeram * mem_unit / 1024,
+                           (uint64_t)si->bufferram * mem_unit / 1024);
+    g_string_append_printf(out, "KiB Swap: %8" PRIu64 " total, %8" PRIu64
+                           " free\n\n",
+                           (uint64_t)si->totalswap * mem_unit / 1024,
+                           (uint64_t)si->freeswap * mem_unit / 1024);
+    g_string_append(out, "  PID USER      PR  NI    VIRT    RES S  %CPU "
+                    "%MEM     TIME+ COMMAND\n");
+
+    users = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    for (i = 0; i < procs->len && i < GUEST_APP_STATUS_MAX_LINES - 6; i++) {
+        GuestProcStat *ps = &g_array_index(procs, GuestProcStat, i);
+        uint64_t rss = ps->rss * page_size;
+        uint64_t hundredths = ps->ticks * 100 / hz;
+
+        g_string_append_printf(out, "%5d %-8.8s %3ld %3ld %7" PRIu64
+                               " %6" PRIu64 " %c %5.1f %4.1f %6" PRIu64
+                               ":%02" PRIu64 ".%02" PRIu64 " %s\n",
+                               ps->pid, guest_user_name(users, ps->uid),
+                               ps->priority, ps->nice, ps->vsize / 1024,
+                               rss / 1024, ps->state, ps->cpu,
+                               total_ram ? 100.0 * rss / total_ram : 0,
+                               hundredths / 6000, hundredths / 100 % 60,
+                               hundredths % 100, ps->comm);
+    }
+    g_hash_table_destroy(users);
+
+    return g_string_free(out, FALSE);
+}
+
+static APPStatus *guest_collect_app_status(Error **errp)
+{
+    APPStatus *status;
+    struct sysinfo si;
+    GArray *procs;
+
+    if (sysinfo(&si) < 0) {
+        error_setg_errno(errp, errno, "failed to get system statistics");
+        return NULL;
+    }
+
+    procs = guest_proc_scan(errp);
+    if (!procs) {
+        return NULL;
+    }
+
+    status = g_new0(APPStatus, 1);
+    status->appStatus = guest_format_app_status(procs, &si);
+    g_array_free(procs, TRUE);
+
+    return status;
+}
+/*########################################################################################################*/
+
+/*Processes*/
+/*########################################################################################################*/
+/*
+ * guest-get-processes walks /proc through a directory fd opened once and
+ * keeps only the top N entries in a heap, so memory stays bounded by N
+ * plus one small record per process. Those records, sorted by pid, are
+ * what the next walk computes processor usage against. Owner and shared
+ * memory are only looked up for the processes that are returned.
+ */
+#define GUEST_PROCESSES_DEFAULT 10
+#define GUEST_PROCESSES_MAX 1000
+
+typedef struct GuestProcTicks {
+    int pid;
+    uint64_t starttime;
+    uint64_t ticks;
+} GuestProcTicks;
+
+typedef struct GuestProcState {
+    QemuMutex lock;
+    int procfd;
+    GArray *prev;           /* GuestProcTicks of the previous walk, by pid */
+    int64_t prev_time;      /* us, g_get_monotonic_time() */
+} GuestProcState;
+
+static GuestProcState guest_procs = { .procfd = -1 };
+
+static gint guest_proc_compare_pid(gconstpointer a, gconstpointer b)
+{
+    const GuestProcTicks *pa = a, *pb = b;
+
+    return pa->pid - pb->pid;
+}
+
+static gint guest_proc_compare_rss(gconstpointer a, gconstpointer b)
+{
+    const GuestProcStat *pa = a, *pb = b;
+
+    if (pa->rss != pb->rss) {
+        return pa->rss < pb->rss ? 1 : -1;
+    }
+    return pa->pid - pb->pid;
+}
+
+/*
+ * Min-heap of the best @size entries seen so far according to @cmp, the
+ * worst one at the root. Returns the new number of entries.
+ */
+static int guest_proc_heap_push(GuestProcStat *heap, int n, int size,
+                                GCompareFunc cmp, const GuestProcStat *ps)
+{
+    GuestProcStat tmp;
+    int i, child;
+
+    if (n < size) {
+        /* sift up */
+        for (i = n++; i > 0 && cmp(&heap[(i - 1) / 2], ps) < 0;
+             i = (i - 1) / 2) {
+            heap[i] = heap[(i - 1) / 2];
+        }
+        heap[i] = *ps;
+        return n;
+    }
+    if (!n || cmp(ps, &heap[0]) >= 0) {
+        return n;
+    }
+
+    /* replace the root and sift down */
+    heap[0] = *ps;
+    for (i = 0; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n && cmp(&heap[child + 1], &heap[child]) > 0) {
+            child++;
+        }
+        if (cmp(&heap[child], &heap[i]) <= 0) {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+    }
+    return n;
+}
+
+static uint64_t guest_proc_shared(int procfd, int pid)
+{
+    char path[64], buf[256];
+    unsigned long shared = 0;
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "%d/statm", pid);
+    fd = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = 0;
+    if (sscanf(buf, "%*u %*u %lu", &shared) != 1) {
+        return 0;
+    }
+    return shared;
+}
+
+static GuestProcessInfo *guest_process_info(int procfd, GHashTable *users,
+                                            const GuestProcStat *ps)
+{
+    GuestProcessInfo *info = g_new0(GuestProcessInfo, 1);
+    long hz = sysconf(_SC_CLK_TCK);
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    char pid[16];
+    struct stat st;
+
+    snprintf(pid, sizeof(pid), "%d", ps->pid);
+    info->pid = ps->pid;
+    info->ppid = ps->ppid;
+    info->name = g_strdup(ps->comm);
+    info->state = g_strndup(&ps->state, 1);
+    if (fstatat(procfd, pid, &st, 0) == 0) {
+        info->user = g_strdup(guest_user_name(users, st.st_uid));
+    } else {
+        /* gone since the walk */
+        info->user = g_strdup("");
+    }
+    info->priority = ps->priority;
+    info->nice = ps->nice;
+    info->threads = ps->threads;
+    info->cpu = ps->cpu;
+    info->cpu_time = ps->ticks * 1000 / hz;
+    info->start_time = ps->starttime * 1000 / hz;
+    info->vsize = ps->vsize;
+    info->rss = ps->rss * page_size;
+    info->shared = guest_proc_shared(procfd, ps->pid) * page_size;
+
+    return info;
+}
+
+GuestProcessTable *qmp_guest_get_processes(bool has_count, int64_t count,
+                                           bool has_sort,
+                                           GuestProcessSort sort,
+                                           Error **errp)
+{
+    GuestProcState *p = &guest_procs;
+    GuestProcessTable *table = NULL;
+    GuestProcessInfoList **link, *entry;
+    GCompareFunc cmp = guest_proc_compare_cpu;
+    GuestProcStat ps, *heap;
+    GuestProcTicks t, *old;
+    GArray *cur;
+    GHashTable *users;
+    struct dirent *de;
+    struct sysinfo si;
+    long hz = sysconf(_SC_CLK_TCK);
+    int64_t now, span = 0, total = 0;
+    uint64_t uptime_ticks, age;
+    DIR *dir;
+    int fd, i, n = 0;
+
+    if (!has_count) {
+        count = GUEST_PROCESSES_DEFAULT;
+    }
+    if (count < 0 || count > GUEST_PROCESSES_MAX) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "count",
+                   "a value between 0 and 1000");
+        return NULL;
+    }
+    if (has_sort && sort == GUEST_PROCESS_SORT_RSS) {
+        cmp = guest_proc_compare_rss;
+    }
+    if (sysinfo(&si) < 0) {
+        error_setg_errno(errp, errno, "failed to get system statistics");
+        return NULL;
+    }
+    uptime_ticks = (uint64_t)si.uptime * hz;
+
+    qemu_mutex_lock(&p->lock);
+    if (p->procfd < 0) {
+        p->procfd = qemu_open("/proc", O_RDONLY | O_DIRECTORY);
+        if (p->procfd < 0) {
+            error_setg_errno(errp, errno, "failed to open /proc");
+            goto out;
+        }
+    }
+    /* the duplicate shares the offset, rewind it */
+    fd = dup(p->procfd);
+    dir = fd < 0 ? NULL : fdopendir(fd);
+    if (!dir) {
+        error_setg_errno(errp, errno, "failed to open /proc");
+        if (fd >= 0) {
+            close(fd);
+        }
+        goto out;
+    }
+    rewinddir(dir);
+
+    now = g_get_monotonic_time();
+    if (p->prev) {
+        span = now - p->prev_time;
+    }
+
+    heap = g_new(GuestProcStat, MAX(count, 1));
+    cur = g_array_sized_new(false, false, sizeof(GuestProcTicks),
+                            p->prev ? p->prev->len + 64 : 256);
+    while ((de = readdir(dir))) {
+        if (!g_ascii_isdigit(de->d_name[0]) ||
+            !guest_proc_stat_read(p->procfd, de->d_name, false, &ps)) {
+            continue;
+        }
+        total++;
+
+        t.pid = ps.pid;
+        t.starttime = ps.starttime;
+        t.ticks = ps.ticks;
+        g_array_append_val(cur, t);
+
+        old = NULL;
+        if (p->prev) {
+            old = bsearch(&t, p->prev->data, p->prev->len,
+                          sizeof(GuestProcTicks), guest_proc_compare_pid);
+        }
+        if (span > 0) {
+            /* a process started since the last walk has no entry there */
+            if (old && old->starttime == ps.starttime &&
+                ps.ticks >= old->ticks) {
+                ps.ticks -= old->ticks;
+            }
+            ps.cpu = 100.0 * ps.ticks * 1000000 / hz / span;
+            ps.ticks = t.ticks;
+        } else {
+            age = uptime_ticks > ps.starttime ? uptime_ticks - ps.starttime
+                                              : 0;
+            ps.cpu = age ? 100.0 * ps.ticks / age : 0;
+        }
+
+        n = guest_proc_heap_push(heap, n, count, cmp, &ps);
+    }
+    closedir(dir);
+
+    /* /proc is normally listed in pid order already */
+    g_array_sort(cur, guest_proc_compare_pid);
+    if (p->prev) {
+        g_array_free(p->prev, true);
+    }
+    p->prev = cur;
+    p->prev_time = now;
+
+    qsort(heap, n, sizeof(GuestProcStat), cmp);
+
+    table = g_new0(GuestProcessTable, 1);
+    table->total = total;
+    table->interval = span / 1000;
+    link = &table->processes;
+    users = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    for (i = 0; i < n; i++) {
+        entry = g_new0(GuestProcessInfoList, 1);
+        entry->value = guest_process_info(p->procfd, users, &heap[i]);
+        *link = entry;
+        link = &entry->next;
+    }
+    g_hash_table_destroy(users);
+    g_free(heap);
+
+out:
+    qemu_mutex_unlock(&p->lock);
+    return table;
+}
+
+static void guest_procs_init(void)
+{
+    qemu_mutex_init(&guest_procs.lock);
+}
+
+static void guest_procs_cleanup(void)
+{
+    GuestProcState *p = &guest_procs;
+
+    if (p->procfd >= 0) {
+        close(p->procfd);
+    }
+    if (p->prev) {
+        g_array_free(p->prev, true);
+    }
+    qemu_mutex_destroy(&p->lock);
+}
+/*########################################################################################################*/
+
+/*DiskStatus*/
+/*########################################################################################################*/
+/* Format a byte count the way `df -h` does: powers of 1024, rounded up */
+static char *guest_format_size(uint64_t bytes)
+{
+    static const char suffixes[] = "KMGTPE";
+    uint64_t unit = 1024, tenths;
+    int i = 0;
+
+    if (bytes < unit) {
+        return g_strdup_printf("%" PRIu64, bytes);
+    }
+    while (i < sizeof(suffixes) - 2 && bytes / unit >= 1024) {
+        unit *= 1024;
+        i++;
+    }
+
+    tenths = bytes / unit * 10 + DIV_ROUND_UP(bytes % unit * 10, unit);
+    if (tenths < 100) {
+        return g_strdup_printf("%" PRIu64 ".%" PRIu64 "%c",
+                               tenths / 10, tenths % 10, suffixes[i]);
+    }
+
+    return g_strdup_printf("%" PRIu64 "%c", DIV_ROUND_UP(bytes, unit),
+                           suffixes[i]);
+}
+
+static GuestDiskStatusList *guest_collect_disk_status(Error **errp)
+{
+    GuestDiskStatusList *head = NULL, **link = &head;
+    GuestDiskStatusList *entry;
+    GuestDiskStatus *status;
+    MountInfo *info;
+    FsMountList mounts;
+    struct FsMount *mount;
+    struct statvfs buf;
+    Error *local_err = NULL;
+
+    QTAILQ_INIT(&mounts);
+    build_fs_mount_list(&mounts, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return NULL;
+    }
+
+    QTAILQ_FOREACH(mount, &mounts, next) {
+        if (statvfs(mount->dirname, &buf) < 0) {
+            slog("failed to stat filesystem '%s': %s", mount->dirname,
+                 strerror(errno));
+            continue;
+        }
+
+        info = g_new0(MountInfo, 1);
+        info->total = guest_format_size((uint64_t)buf.f_blocks *
+                                        buf.f_frsize);
+        info->used = guest_format_size((uint64_t)(buf.f_blocks -
+                                                  buf.f_bfree) *
+                                       buf.f_frsize);
+        info->writable = !(buf.f_flag & ST_RDONLY);
+        if (buf.f_blocks) {
+            /* like df: used / (used + available to unprivileged users) */
+            uint64_t used = buf.f_blocks - buf.f_bfree;
+            uint64_t size = used + buf.f_bavail;
+
+            info->has_used_percent = true;
+            info->used_percent = size ? DIV_ROUND_UP(used * 100, size) : 0;
+        }
+
+        status = g_new0(GuestDiskStatus, 1);
+        status->mount_place = g_strdup(mount->dirname);
+        status->mount_info = info;
+
+        entry = g_new0(GuestDiskStatusList, 1);
+        entry->value = status;
+
+        *link = entry;
+        link = &entry->next;
+    }
+
+    free_fs_mount_list(&mounts);
+    return head;
+}
+/*########################################################################################################*/
+
+/*CpuStats*/
+/*########################################################################################################*/
+/*
+ * Utilization and context switch rate are deltas between two reads of
+ * /proc/stat, kept in a ring the same way as the disk I/O samples below.
+ */
+#define GUEST_CPUSTATS_SAMPLES 8
+#define GUEST_CPUSTATS_MIN_SPAN 1000000     /* us */
+#define GUEST_CPUSTATS_BASELINE 100000      /* us */
+
+enum {
+    CPUSTAT_USER,
+    CPUSTAT_NICE,
+    CPUSTAT_SYSTEM,
+    CPUSTAT_IDLE,
+    CPUSTAT_IOWAIT,
+    CPUSTAT_IRQ,
+    CPUSTAT_SOFTIRQ,
+    CPUSTAT_STEAL,
+    CPUSTAT_MAX,
+};
+
+typedef struct GuestCpuCounters {
+    int cpu;                /* -1 for the "cpu" line with the sums */
+    uint64_t stat[CPUSTAT_MAX];
+} GuestCpuCounters;
+
+typedef struct GuestCpuSample {
+    int64_t time;           /* us, g_get_monotonic_time() */
+    GArray *cpus;           /* of GuestCpuCounters, the sums first */
+    uint64_t ctxt;
+    int64_t procs_running;
+    int64_t procs_blocked;
+} GuestCpuSample;
+
+typedef struct GuestCpuStatsState {
+    QemuMutex lock;
+    GuestCpuSample ring[GUEST_CPUSTATS_SAMPLES];
+    int head;               /* slot of the next sample */
+    int count;
+} GuestCpuStatsState;
+
+static GuestCpuStatsState guest_cpustats;
+
+static bool guest_read_cpustats(GuestCpuSample *sample, Error **errp)
+{
+    GuestCpuCounters c;
+    FILE *fp;
+    char *line = NULL;
+    size_t n = 0;
+    uint64_t *st = c.stat;
+    int ret;
+
+    fp = fopen("/proc/stat", "r");
+    if (!fp) {
+        error_setg_errno(errp, errno, "failed to open /proc/stat");
+        return false;
+    }
+
+    sample->cpus = g_array_new(false, false, sizeof(GuestCpuCounters));
+    while (getline(&line, &n, fp) != -1) {
+        if (!strncmp(line, "cpu", 3)) {
+            memset(&c, 0, sizeof(c));
+            /* "cpu" has the sums, "cpuN" the counters of processor N */
+            c.cpu = g_ascii_isdigit(line[3]) ? atoi(line + 3) : -1;
+            /* older kernels have no steal time */
+            ret = sscanf(line + strcspn(line, " "), " %" SCNu64 " %" SCNu64
+                         " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                         " %" SCNu64 " %" SCNu64, &st[0], &st[1], &st[2],
+                         &st[3], &st[4], &st[5], &st[6], &st[7]);
+            if (ret >= 4) {
+                g_array_append_val(sample->cpus, c);
+            }
+        } else if (sscanf(line, "ctxt %" SCNu64, &sample->ctxt) == 1) {
+            continue;
+        } else if (sscanf(line, "procs_running %" SCNd64,
+                          &sample->procs_running) == 1) {
+            continue;
+        } else if (sscanf(line, "procs_blocked %" SCNd64,
+                          &sample->procs_blocked) == 1) {
+            continue;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return true;
+}
+
+static GuestCpuSample *guest_cpustats_sample(GuestCpuStatsState *d,
+                                             Error **errp)
+{
+    GuestCpuSample *sample, new = { 0 };
+
+    /* a failed read leaves the ring as it is */
+    if (!guest_read_cpustats(&new, errp)) {
+        return NULL;
+    }
+    new.time = g_get_monotonic_time();
+
+    sample = &d->ring[d->head];
+    if (sample->cpus) {
+        g_array_free(sample->cpus, true);
+    }
+    *sample = new;
+
+    d->head = (d->head + 1) % GUEST_CPUSTATS_SAMPLES;
+    d->count = MIN(d->count + 1, GUEST_CPUSTATS_SAMPLES);
+    return sample;
+}
+
+static GuestCpuUsage *guest_cpu_usage(const GuestCpuCounters *cur,
+                                      const GArray *prev_cpus)
+{
+    GuestCpuUsage *usage = g_new0(GuestCpuUsage, 1);
+    const GuestCpuCounters *prev = NULL, *p;
+    uint64_t d[CPUSTAT_MAX] = { 0 }, sum = 0;
+    unsigned int i;
+
+    /* processors may have gone offline and come back in between */
+    for (i = 0; i < prev_cpus->len; i++) {
+        p = &g_array_index(prev_cpus, GuestCpuCounters, i);
+        if (p->cpu == cur->cpu) {
+            prev = p;
+            break;
+        }
+    }
+
+    for (i = 0; prev && i < CPUSTAT_MAX; i++) {
+        d[i] = cur->stat[i] >= prev->stat[i] ?
+               cur->stat[i] - prev->stat[i] : 0;
+        sum += d[i];
+    }
+
+    if (cur->cpu >= 0) {
+        usage->has_cpu = true;
+        usage->cpu = cur->cpu;
+    }
+    if (sum) {
+        usage->user = d[CPUSTAT_USER] * 100.0 / sum;
+        usage->nice = d[CPUSTAT_NICE] * 100.0 / sum;
+        usage->system = d[CPUSTAT_SYSTEM] * 100.0 / sum;
+        usage->idle = d[CPUSTAT_IDLE] * 100.0 / sum;
+        usage->iowait = d[CPUSTAT_IOWAIT] * 100.0 / sum;
+        usage->irq = d[CPUSTAT_IRQ] * 100.0 / sum;
+        usage->softirq = d[CPUSTAT_SOFTIRQ] * 100.0 / sum;
+        usage->steal = d[CPUSTAT_STEAL] * 100.0 / sum;
+    }
+
+    return usage;
+}
+
+GuestCpuStats *qmp_guest_get_cpu_stats(Error **errp)
+{
+    GuestCpuStatsState *d = &guest_cpustats;
+    GuestCpuStats *stats = NULL;
+    GuestCpuUsageList **link, *entry;
+    GuestCpuSample *cur, *prev = NULL;
+    const GuestCpuCounters *c;
+    double load[3];
+    unsigned int i;
+    FILE *fp;
+    int k;
+
+    fp = fopen("/proc/loadavg", "r");
+    if (!fp) {
+        error_setg_errno(errp, errno, "failed to open /proc/loadavg");
+        return NULL;
+    }
+    k = fscanf(fp, "%lf %lf %lf", &load[0], &load[1], &load[2]);
+    fclose(fp);
+    if (k != 3) {
+        error_setg(errp, "failed to parse /proc/loadavg");
+        return NULL;
+    }
+
+    qemu_mutex_lock(&d->lock);
+    if (!d->count) {
+        /* nothing to compare with yet */
+        if (!guest_cpustats_sample(d, errp)) {
+            goto out;
+        }
+        g_usleep(GUEST_CPUSTATS_BASELINE);
+    }
+    cur = guest_cpustats_sample(d, errp);
+    if (!cur || !cur->cpus->len) {
+        if (cur) {
+            error_setg(errp, "no processors found in /proc/stat");
+        }
+        goto out;
+    }
+
+    /* the newest sample old enough, or else the oldest one there is */
+    for (k = 1; k < d->count; k++) {
+        prev = &d->ring[(d->head - 1 - k + GUEST_CPUSTATS_SAMPLES) %
+                        GUEST_CPUSTATS_SAMPLES];
+        if (cur->time - prev->time >= GUEST_CPUSTATS_MIN_SPAN) {
+            break;
+        }
+    }
+
+    stats = g_new0(GuestCpuStats, 1);
+    link = &stats->cpus;
+    for (i = 0; i < cur->cpus->len; i++) {
+        c = &g_array_index(cur->cpus, GuestCpuCounters, i);
+        if (c->cpu < 0) {
+            stats->total = guest_cpu_usage(c, prev->cpus);
+            continue;
+        }
+
+        entry = g_new0(GuestCpuUsageList, 1);
+        entry->value = guest_cpu_usage(c, prev->cpus);
+        *link = entry;
+        link = &entry->next;
+    }
+    if (!stats->total) {
+        stats->total = g_new0(GuestCpuUsage, 1);
+    }
+
+    stats->load1 = load[0];
+    stats->load5 = load[1];
+    stats->load15 = load[2];
+    stats->procs_running = cur->procs_running;
+    stats->procs_blocked = cur->procs_blocked;
+    stats->interval = (cur->time - prev->time) / 1000;
+    if (cur->time > prev->time && cur->ctxt >= prev->ctxt) {
+        stats->context_switches = (cur->ctxt - prev->ctxt) * 1000000.0 /
+                                  (cur->time - prev->time);
+    }
+
+out:
+    qemu_mutex_unlock(&d->lock);
+    return stats;
+}
+
+static void guest_cpustats_init(void)
+{
+    qemu_mutex_init(&guest_cpustats.lock);
+}
+
+static void guest_cpustats_cleanup(void)
+{
+    GuestCpuStatsState *d = &guest_cpustats;
+    int i;
+
+    for (i = 0; i < GUEST_CPUSTATS_SAMPLES; i++) {
+        if (d->ring[i].cpus) {
+            g_array_free(d->ring[i].cpus, true);
+        }
+    }
+    qemu_mutex_destroy(&d->lock);
+}
+/*########################################################################################################*/
+
+/*DiskIOStats*/
+/*########################################################################################################*/
+/*
+ * I/O rates are deltas between two reads of /proc/diskstats. Each call
+ * adds a sample to a small ring and compares it with the newest sample
+ * that is at least GUEST_DISKSTATS_MIN_SPAN older, so that frequent callers
+ * still get rates over a meaningful interval.
+ */
+#define GUEST_DISKSTATS_SAMPLES 8
+#define GUEST_DISKSTATS_MIN_SPAN 1000000    /* us */
+#define GUEST_DISKSTATS_BASELINE 100000     /* us */
+
+enum {
+    DISKSTAT_READS,
+    DISKSTAT_READS_MERGED,
+    DISKSTAT_READ_SECTORS,
+    DISKSTAT_READ_TICKS,
+    DISKSTAT_WRITES,
+    DISKSTAT_WRITES_MERGED,
+    DISKSTAT_WRITE_SECTORS,
+    DISKSTAT_WRITE_TICKS,
+    DISKSTAT_IN_FLIGHT,
+    DISKSTAT_IO_TICKS,
+    DISKSTAT_TIME_IN_QUEUE,
+    DISKSTAT_MAX,
+};
+
+typedef struct GuestDiskCounters {
+    unsigned int devmajor, devminor;
+    char name[32];
+    uint64_t stat[DISKSTAT_MAX];
+} GuestDiskCounters;
+
+typedef struct GuestDiskSample {
+    int64_t time;           /* us, g_get_monotonic_time() */
+    GArray *devices;        /* of GuestDiskCounters */
+} GuestDiskSample;
+
+typedef struct GuestDiskStatsState {
+    QemuMutex lock;
+    GuestDiskSample ring[GUEST_DISKSTATS_SAMPLES];
+    int head;               /* slot of the next sample */
+    int count;
+} GuestDiskStatsState;
+
+static GuestDiskStatsState guest_diskstats;
+
+static GArray *guest_read_diskstats(Error **errp)
+{
+    GArray *devices;
+    GuestDiskCounters c;
+    FILE *fp;
+    char *line = NULL;
+    size_t n = 0;
+    uint64_t *st = c.stat;
+
+    fp = fopen("/proc/diskstats", "r");
+    if (!fp) {
+        error_setg_errno(errp, errno, "failed to open /proc/diskstats");
+        return NULL;
+    }
+
+    devices = g_array_new(false, false, sizeof(GuestDiskCounters));
+    while (getline(&line, &n, fp) != -1) {
+        /* partitions of old kernels only have 4 counters, skip them */
+        if (sscanf(line, "%u %u %31s %" SCNu64 " %" SCNu64 " %" SCNu64
+                   " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                   " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+                   &c.devmajor, &c.devminor, c.name, &st[0], &st[1], &st[2],
+                   &st[3], &st[4], &st[5], &st[6], &st[7], &st[8], &st[9],
+                   &st[10]) != 3 + DISKSTAT_MAX) {
+            continue;
+        }
+        if (!st[DISKSTAT_READS] && !st[DISKSTAT_WRITES]) {
+            /* never used, e.g. unused loop and ram devices */
+            continue;
+        }
+        g_array_append_val(devices, c);
+    }
+
+    free(line);
+    fclose(fp);
+    return devices;
+}
+
+static GuestDiskSample *guest_diskstats_sample(GuestDiskStatsState *d,
+                                               Error **errp)
+{
+    GuestDiskSample *sample;
+    GArray *devices;
+
+    devices = guest_read_diskstats(errp);
+    if (!devices) {
+        return NULL;
+    }
+
+    sample = &d->ring[d->head];
+    if (sample->devices) {
+        g_array_free(sample->devices, true);
+    }
+    sample->time = g_get_monotonic_time();
+    sample->devices = devices;
+
+    d->head = (d->head + 1) % GUEST_DISKSTATS_SAMPLES;
+    d->count = MIN(d->count + 1, GUEST_DISKSTATS_SAMPLES);
+    return sample;
+}
+
+/* devices are usually listed in the same order, so try @hint first */
+static const GuestDiskCounters *guest_diskstats_find(const GArray *devices,
+                                                     unsigned int hint,
+                                                     const GuestDiskCounters *c)
+{
+    const GuestDiskCounters *p;
+    unsigned int i;
+
+    for (i = 0; i < devices->len; i++) {
+        p = &g_array_index(devices, GuestDiskCounters,
+                           (hint + i) % devices->len);
+        if (p->devmajor == c->devmajor && p->devminor == c->devminor) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static GuestDiskIOStats *guest_disk_io_stats(const GuestDiskCounters *cur,
+                                             const GuestDiskCounters *prev,
+                                             int64_t span, FsMountList *mounts)
+{
+    GuestDiskIOStats *stats = g_new0(GuestDiskIOStats, 1);
+    double secs = span / 1000000.0, ms = span / 1000.0;
+    uint64_t d[DISKSTAT_MAX] = { 0 };
+    strList *entry;
+    FsMount *mount;
+    int i;
+
+    for (i = 0; prev && i < DISKSTAT_MAX; i++) {
+        /* a device that was replaced starts over from zero */
+        d[i] = cur->stat[i] >= prev->stat[i] ?
+               cur->stat[i] - prev->stat[i] : cur->stat[i];
+    }
+
+    stats->name = g_strdup(cur->name);
+    stats->major = cur->devmajor;
+    stats->minor = cur->devminor;
+    QTAILQ_FOREACH(mount, mounts, next) {
+        if (mount->devmajor == cur->devmajor &&
+            mount->devminor == cur->devminor) {
+            entry = g_new0(strList, 1);
+            entry->value = g_strdup(mount->dirname);
+            entry->next = stats->mount_points;
+            stats->mount_points = entry;
+        }
+    }
+
+    if (span > 0) {
+        stats->read_iops = d[DISKSTAT_READS] / secs;
+        stats->write_iops = d[DISKSTAT_WRITES] / secs;
+        /* diskstats always counts 512 byte sectors */
+        stats->read_bytes = d[DISKSTAT_READ_SECTORS] * 512 / secs;
+        stats->write_bytes = d[DISKSTAT_WRITE_SECTORS] * 512 / secs;
+        stats->queue_depth = d[DISKSTAT_TIME_IN_QUEUE] / ms;
+        stats->utilization = MIN(100.0, d[DISKSTAT_IO_TICKS] * 100 / ms);
+    }
+    if (d[DISKSTAT_READS]) {
+        stats->read_latency = (double)d[DISKSTAT_READ_TICKS] /
+                              d[DISKSTAT_READS];
+    }
+    if (d[DISKSTAT_WRITES]) {
+        stats->write_latency = (double)d[DISKSTAT_WRITE_TICKS] /
+                               d[DISKSTAT_WRITES];
+    }
+    stats->in_flight = cur->stat[DISKSTAT_IN_FLIGHT];
+    stats->interval = span / 1000;
+
+    return stats;
+}
+
+GuestDiskIOStatsList *qmp_guest_get_disk_io_stats(Error **errp)
+{
+    GuestDiskStatsState *d = &guest_diskstats;
+    GuestDiskIOStatsList *head = NULL, **link = &head, *entry;
+    GuestDiskSample *cur, *prev = NULL;
+    const GuestDiskCounters *c;
+    FsMountList mounts;
+    Error *local_err = NULL;
+    unsigned int i;
+    int k;
+
+    QTAILQ_INIT(&mounts);
+    build_fs_mount_list(&mounts, &local_err);
+    if (local_err) {
+        /* the rates are still useful without mount points */
+        slog("failed to list mounts: %s", error_get_pretty(local_err));
+        error_free(local_err);
+    }
+
+    qemu_mutex_lock(&d->lock);
+    if (!d->count) {
+        /* nothing to compare with yet */
+        if (!guest_diskstats_sample(d, errp)) {
+            goto out;
+        }
+        g_usleep(GUEST_DISKSTATS_BASELINE);
+    }
+    cur = guest_diskstats_sample(d, errp);
+    if (!cur) {
+        goto out;
+    }
+
+    /* the newest sample old enough, or else the oldest one there is */
+    for (k = 1; k < d->count; k++) {
+        prev = &d->ring[(d->head - 1 - k + GUEST_DISKSTATS_SAMPLES) %
+                        GUEST_DISKSTATS_SAMPLES];
+        if (cur->time - prev->time >= GUEST_DISKSTATS_MIN_SPAN) {
+            break;
+        }
+    }
+
+    for (i = 0; i < cur->devices->len; i++) {
+        c = &g_array_index(cur->devices, GuestDiskCounters, i);
+
+        entry = g_new0(GuestDiskIOStatsList, 1);
+        entry->value = guest_disk_io_stats(c,
+                                           guest_diskstats_find(prev->devices,
+                                                                i, c),
+                                           cur->time - prev->time, &mounts);
+        *link = entry;
+        link = &entry->next;
+    }
+
+out:
+    qemu_mutex_unlock(&d->lock);
+    free_fs_mount_list(&mounts);
+    return head;
+}
+
+static void guest_diskstats_init(void)
+{
+    qemu_mutex_init(&guest_diskstats.lock);
+}
+
+static void guest_diskstats_cleanup(void)
+{
+    GuestDiskStatsState *d = &guest_diskstats;
+    int i;
+
+    for (i = 0; i < GUEST_DISKSTATS_SAMPLES; i++) {
+        if (d->ring[i].devices) {
+            g_array_free(d->ring[i].devices, true);
+        }
+    }
+    qemu_mutex_destroy(&d->lock);
+}
+/*########################################################################################################*/
+
+/*Metrics*/
+/*########################################################################################################*/
+/*
+ * With "metrics-interval" set, memory, application and disk status are
+ * sampled by a background thread and the commands answer from the latest
+ * snapshot, so a slow /proc walk never stalls the main loop. With the
+ * interval at 0 (the default) they are collected on each call.
+ *
+ * The same thread checks the samples against the thresholds from the
+ * configuration and queues an event when one is crossed; the events are
+ * sent from the main loop.
+ */
+#define GUEST_EVENTS_INTERVAL_DEFAULT 5
+/* qemu_sem_timedwait() takes an int number of milliseconds */
+#define GUEST_METRICS_INTERVAL_MAX (INT_MAX / 1000)
+typedef struct GuestMetricsStamp {
+    int64_t realtime;       /* ns since the Epoch */
+    int64_t monotonic;      /* us, g_get_monotonic_time() */
+} GuestMetricsStamp;
+
+typedef struct GuestMetricsState {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuSemaphore wakeup;
+    int interval;           /* seconds */
+    bool running;
+    bool stopping;
+    /* protected by lock */
+    GuestMemoryStatus *memory;
+    GuestMetricsStamp memory_stamp;
+    APPStatus *app;
+    GuestMetricsStamp app_stamp;
+    GuestDiskStatusList *disks;
+    GuestMetricsStamp disks_stamp;
+    /* only used by the sampler thread */
+    int memory_threshold;   /* percent, 0 if disabled */
+    int disk_threshold;     /* percent, 0 if disabled */
+    bool oom_events;
+    bool memory_alert;      /* above the threshold at the last sample */
+    GHashTable *disk_alerts; /* mount points above the threshold */
+    int64_t oom_cursor;
+} GuestMetricsState;
+
+static GuestMetricsState guest_metrics;
+
+static void guest_metrics_stamp(GuestMetricsStamp *stamp)
+{
+    qemu_timeval tv;
+
+    qemu_gettimeofday(&tv);
+    stamp->realtime = tv.tv_sec * 1000000000LL + tv.tv_usec * 1000;
+    stamp->monotonic = g_get_monotonic_time();
+}
+
+static int64_t guest_metrics_age(const GuestMetricsStamp *stamp)
+{
+    return (g_get_monotonic_time() - stamp->monotonic) / 1000;
+}
+
+static GuestMemoryStatus *guest_memory_status_copy(const GuestMemoryStatus *src)
+{
+    GuestMemoryStatus *dst = g_memdup(src, sizeof(*src));
+
+    dst->swap = g_memdup(src->swap, sizeof(*src->swap));
+    return dst;
+}
+
+static APPStatus *guest_app_status_copy(const APPStatus *src)
+{
+    APPStatus *dst = g_new0(APPStatus, 1);
+
+    dst->appStatus = g_strdup(src->appStatus);
+    return dst;
+}
+
+static GuestDiskStatusList *guest_disk_status_copy(const GuestDiskStatusList *src)
+{
+    GuestDiskStatusList *head = NULL, **link = &head;
+    GuestDiskStatusList *entry;
+    GuestDiskStatus *status;
+
+    for (; src; src = src->next) {
+        status = g_new0(GuestDiskStatus, 1);
+        status->mount_place = g_strdup(src->value->mount_place);
+        status->mount_info = g_new0(MountInfo, 1);
+        status->mount_info->total = g_strdup(src->value->mount_info->total);
+        status->mount_info->used = g_strdup(src->value->mount_info->used);
+        status->mount_info->writable = src->value->mount_info->writable;
+        status->mount_info->has_used_percent =
+            src->value->mount_info->has_used_percent;
+        status->mount_info->used_percent =
+            src->value->mount_info->used_percent;
+
+        entry = g_new0(GuestDiskStatusList, 1);
+        entry->value = status;
+
+        *link = entry;
+        link = &entry->next;
+    }
+
+    return head;
+}
+
+typedef struct GuestEvent {
+    qga_QAPIEvent event;
+    char *name;
+    int64_t args[3];
+} GuestEvent;
+
+static GuestOOMEventList *guest_oom_events_since(int64_t *cursor);
+
+static gboolean guest_event_emit(gpointer opaque)
+{
+    GuestEvent *ev = opaque;
+
+    switch (ev->event) {
+    case QGA_QAPI_EVENT_GUEST_MEMORY_THRESHOLD:
+        qapi_event_send_guest_memory_threshold(ev->args[0], ev->args[1],
+                                               ev->args[2], NULL);
+        break;
+    case QGA_QAPI_EVENT_GUEST_DISK_THRESHOLD:
+        qapi_event_send_guest_disk_threshold(ev->name, ev->args[0],
+                                             ev->args[1], NULL);
+        break;
+    case QGA_QAPI_EVENT_GUEST_OOM:
+        qapi_event_send_guest_oom(ev->args[0], ev->name, ev->args[1], NULL);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    g_free(ev->name);
+    g_free(ev);
+    return FALSE;
+}
+
+/* may be called from any thread */
+static void guest_event_queue(qga_QAPIEvent event, const char *name,
+                              int64_t arg0, int64_t arg1, int64_t arg2)
+{
+    GuestEvent *ev = g_new0(GuestEvent, 1);
+
+    ev->event = event;
+    ev->name = g_strdup(name);
+    ev->args[0] = arg0;
+    ev->args[1] = arg1;
+    ev->args[2] = arg2;
+    g_idle_add(guest_event_emit, ev);
+}
+
+/* an event is queued when a threshold is crossed, not while it stays so */
+static void guest_metrics_check(GuestMetricsState *m,
+                                const GuestMemoryStatus *memory,
+                                const GuestDiskStatusList *disks)
+{
+    const MountInfo *info;
+    const char *mount;
+    GuestOOMEventList *events, *entry;
+    int64_t used;
+
+    if (m->memory_threshold > 0 && memory && memory->total > 0) {
+        used = memory->used - memory->buffer - memory->cached;
+        if (used * 100 < memory->total * m->memory_threshold) {
+            m->memory_alert = false;
+        } else if (!m->memory_alert) {
+            m->memory_alert = true;
+            guest_event_queue(QGA_QAPI_EVENT_GUEST_MEMORY_THRESHOLD, NULL,
+                              used, memory->total, m->memory_threshold);
+        }
+    }
+
+    if (m->disk_threshold > 0) {
+        for (; disks; disks = disks->next) {
+            mount = disks->value->mount_place;
+            info = disks->value->mount_info;
+            if (!info->has_used_percent) {
+                continue;
+            }
+            if (info->used_percent < m->disk_threshold) {
+                g_hash_table_remove(m->disk_alerts, mount);
+            } else if (!g_hash_table_lookup(m->disk_alerts, mount)) {
+                g_hash_table_insert(m->disk_alerts, g_strdup(mount),
+                                    GINT_TO_POINTER(1));
+                guest_event_queue(QGA_QAPI_EVENT_GUEST_DISK_THRESHOLD, mount,
+                                  info->used_percent, m->disk_threshold, 0);
+            }
+        }
+    }
+
+    if (m->oom_events) {
+        events = guest_oom_events_since(&m->oom_cursor);
+        for (entry = events; entry; entry = entry->next) {
+            guest_event_queue(QGA_QAPI_EVENT_GUEST_OOM, entry->value->name,
+                              entry->value->pid, entry->value->seq, 0);
+        }
+        qapi_free_GuestOOMEventList(events);
+    }
+}
+
+/* Take a fresh sample; a collector that fails keeps its previous snapshot */
+static void guest_metrics_sample(GuestMetricsState *m)
+{
+    GuestMemoryStatus *memory, *old_memory = NULL;
+    APPStatus *app, *old_app = NULL;
+    GuestDiskStatusList *disks, *old_disks = NULL;
+    GuestMetricsStamp stamp;
+    Error *local_err = NULL;
+    bool disks_valid = true;
+
+    guest_metrics_stamp(&stamp);
+
+    memory = guest_collect_memory_status(&local_err);
+    if (local_err) {
+        slog("failed to sample memory status: %s",
+             error_get_pretty(local_err));
+        error_free(local_err);
+        local_err = NULL;
+    }
+    app = guest_collect_app_status(&local_err);
+    if (local_err) {
+        slog("failed to sample application status: %s",
+             error_get_pretty(local_err));
+        error_free(local_err);
+        local_err = NULL;
+    }
+    disks = guest_collect_disk_status(&local_err);
+    if (local_err) {
+        slog("failed to sample disk status: %s",
+             error_get_pretty(local_err));
+        error_free(local_err);
+        disks_valid = false;
+    }
 
-    return status;
+    qemu_mutex_lock(&m->lock);
+    if (memory) {
+        old_memory = m->memory;
+        m->memory = memory;
+        m->memory_stamp = stamp;
+    }
+    if (app) {
+        old_app = m->app;
+        m->app = app;
+        m->app_stamp = stamp;
+    }
+    if (disks_valid) {
+        old_disks = m->disks;
+        m->disks = disks;
+        m->disks_stamp = stamp;
+    }
+    qemu_mutex_unlock(&m->lock);
+
+    guest_metrics_check(m, memory, disks_valid ? disks : NULL);
+
+    qapi_free_GuestMemoryStatus(old_memory);
+    qapi_free_APPStatus(old_app);
+    qapi_free_GuestDiskStatusList(old_disks);
 }
-/*########################################################################################################*/
 
-/*OSStatus*/
-/*########################################################################################################*/
-GuestSystemInfo *qmp_guest_get_system_info(Error **errp)
+static void *guest_metrics_thread(void *opaque)
 {
-    GuestSystemInfo *info = g_malloc0(sizeof(GuestSystemInfo));
+    GuestMetricsState *m = opaque;
 
-    FILE * fp = NULL;
-    char line[200] = "";
+    while (qemu_sem_timedwait(&m->wakeup, m->interval * 1000) < 0) {
+        guest_metrics_sample(m);
+    }
 
-    fp = popen("timeout -s SIGKILL 2s uname -s","r");
-    if(fp !=NULL){
-        if(fgets(line, 200, fp) != NULL) {
-                info->os_name = g_strdup(line);
-        }
+    return NULL;
+}
+
+static void guest_metrics_init(void)
+{
+    GuestMetricsState *m = &guest_metrics;
+
+    m->interval = ga_metrics_interval(ga_state);
+    m->memory_threshold = ga_memory_threshold(ga_state);
+    m->disk_threshold = ga_disk_threshold(ga_state);
+    m->oom_events = ga_oom_events_enabled(ga_state);
+    if (m->interval <= 0 && (m->memory_threshold > 0 ||
+                             m->disk_threshold > 0 || m->oom_events)) {
+        m->interval = GUEST_EVENTS_INTERVAL_DEFAULT;
+    }
+    if (m->interval <= 0) {
+        return;
+    }
+    if (m->interval > GUEST_METRICS_INTERVAL_MAX) {
+        g_warning("metrics-interval %d is too large, using %d seconds",
+                  m->interval, GUEST_METRICS_INTERVAL_MAX);
+        m->interval = GUEST_METRICS_INTERVAL_MAX;
     }
-    pclose(fp);
 
-    fp = popen("timeout -s SIGKILL 2s uname -r","r");
-    if(fp !=NULL){
-        if(fgets(line, 200, fp) != NULL) {
-                info->kernel_version = g_strdup(line);
-        }
+    m->disk_alerts = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, NULL);
+    if (m->oom_events) {
+        /* only report kills that happen from now on */
+        qapi_free_GuestOOMEventList(guest_oom_events_since(&m->oom_cursor));
     }
-    pclose(fp);
 
-    fp = popen("timeout -s SIGKILL 2s uname -v","r");
-    if(fp !=NULL){
-        if(fgets(line, 200, fp) != NULL) {
-                info->system_version = g_strdup(line);
-        }
+    qemu_mutex_init(&m->lock);
+    qemu_sem_init(&m->wakeup, 0);
+    /* make sure there is something to answer with from the start */
+    guest_metrics_sample(m);
+    m->running = true;
+    qemu_thread_create(&m->thread, "qga-metrics", guest_metrics_thread, m,
+                       QEMU_THREAD_JOINABLE);
+}
+
+static void guest_metrics_cleanup(void)
+{
+    GuestMetricsState *m = &guest_metrics;
+
+    if (!m->running) {
+        return;
     }
-    pclose(fp);
 
-    fp = popen("timeout -s SIGKILL 2s hostname -f","r");
-    if(fp !=NULL){
-        if(fgets(line, 200, fp) != NULL) {
-                info->fqdn = g_strdup(line);
+    qemu_sem_post(&m->wakeup);
+    qemu_thread_join(&m->thread);
+    m->running = false;
+
+    qapi_free_GuestMemoryStatus(m->memory);
+    qapi_free_APPStatus(m->app);
+    qapi_free_GuestDiskStatusList(m->disks);
+    g_hash_table_destroy(m->disk_alerts);
+    qemu_sem_destroy(&m->wakeup);
+    qemu_mutex_destroy(&m->lock);
+}
+
+GuestMemoryStatus *qmp_guest_get_memory_status(Error **errp)
+{
+    GuestMetricsState *m = &guest_metrics;
+    GuestMemoryStatus *status = NULL;
+    GuestMetricsStamp stamp;
+
+    if (m->running) {
+        qemu_mutex_lock(&m->lock);
+        if (m->memory) {
+            status = guest_memory_status_copy(m->memory);
+            stamp = m->memory_stamp;
         }
+        qemu_mutex_unlock(&m->lock);
     }
-    pclose(fp);
-
-    fp = popen("timeout -s SIGKILL 2s lastlog","r");
-    if(fp !=NULL){
-        if(fgets(line, 200, fp) != NULL) {
-            if(fgets(line, 200, fp) != NULL) {
-                info->fqdn = g_strdup(line);
-            }
+    if (!status) {
+        guest_metrics_stamp(&stamp);
+        status = guest_collect_memory_status(errp);
+        if (!status) {
+            return NULL;
         }
     }
-    pclose(fp);
 
-    return info;
+    status->has_timestamp = true;
+    status->timestamp = stamp.realtime;
+    status->has_age = true;
+    status->age = guest_metrics_age(&stamp);
+
+    return status;
 }
-/*########################################################################################################*/
 
-/*APPStatus*/
-/*########################################################################################################*/
 struct APPStatus *qmp_guest_get_app_status(Error **errp)
 {
-    FILE * fp = NULL;
-    char buffer[40000] = "";
-    char line[200] = "";
-    APPStatus *status = g_malloc0(sizeof(APPStatus));
-    int count = 0;
-    fp = popen("timeout -s SIGKILL 2s top -n 1 -b","r");
-    if(fp !=NULL){
-        while ((fgets(line, 200, fp) != NULL) && count < 200 ){
-                strcat(buffer, line);
-                count++;
+    GuestMetricsState *m = &guest_metrics;
+    APPStatus *status = NULL;
+    GuestMetricsStamp stamp;
+
+    if (m->running) {
+        qemu_mutex_lock(&m->lock);
+        if (m->app) {
+            status = guest_app_status_copy(m->app);
+            stamp = m->app_stamp;
+        }
+        qemu_mutex_unlock(&m->lock);
+    }
+    if (!status) {
+        guest_metrics_stamp(&stamp);
+        status = guest_collect_app_status(errp);
+        if (!status) {
+            return NULL;
         }
     }
-    pclose(fp);
-    status->appStatus = g_strdup(buffer);
+
+    status->has_timestamp = true;
+    status->timestamp = stamp.realtime;
+    status->has_age = true;
+    status->age = guest_metrics_age(&stamp);
 
     return status;
 }
-/*########################################################################################################*/
 
-/*DiskStatus*/
-/*########################################################################################################*/
 struct GuestDiskStatusList *qmp_guest_get_disk_status(Error **errp)
 {
-    FILE * fp = NULL;
-    char line[200] = "";
-    GuestDiskStatusList *head, **link;
-
-    head = NULL;
-    link = &head;
-
-    char *p = NULL;
-    int i;
-
-    GuestDiskStatus *status = NULL;
-    GuestDiskStatusList *entry = NULL;
-
-    fp = popen("timeout -s SIGKILL 2s df -h","r");
-    if((fgets(line, 200, fp) != NULL) && (fp != NULL)) {
-        while (fgets(line, 200, fp) != NULL) {
-            status = g_malloc0(sizeof *status);
-            MountInfo *info = g_malloc0(sizeof(MountInfo));
-            p=strtok(line," ");
-            if(p){
-                for(i=0; i<5; i++ ){
-                    p=strtok(NULL," ");
-                    if(i == 0){
-                        info->total = g_strdup(p);
-                    }
-                    if(i==1){
-                        info->used = g_strdup(p);
-                    }
-                }
-                info->writable = true;
-                status->mount_place = g_strdup(p);
-                status->mount_info = info;
-            }
-
-            entry = g_malloc0(sizeof *entry);
-            entry->value = status;
+    GuestMetricsState *m = &guest_metrics;
+    GuestDiskStatusList *head = NULL, *entry;
+    GuestMetricsStamp stamp;
+    Error *local_err = NULL;
+    int64_t age;
 
-            *link = entry;
-            link = &entry->next;
+    if (m->running) {
+        qemu_mutex_lock(&m->lock);
+        head = guest_disk_status_copy(m->disks);
+        stamp = m->disks_stamp;
+        qemu_mutex_unlock(&m->lock);
+    } else {
+        guest_metrics_stamp(&stamp);
+        head = guest_collect_disk_status(&local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return NULL;
         }
     }
-    pclose(fp);
-    g_assert(head != NULL);
+
+    age = guest_metrics_age(&stamp);
+    for (entry = head; entry; entry = entry->next) {
+        entry->value->has_timestamp = true;
+        entry->value->timestamp = stamp.realtime;
+        entry->value->has_age = true;
+        entry->value->age = age;
+    }
 
     return head;
 }
@@ -2558,59 +5447,260 @@ struct GuestDiskStatusList *qmp_guest_get_disk_status(Error **errp)
 
 /*OOMStatus*/
 /*########################################################################################################*/
-struct OOMStatus *qmp_guest_get_oom_status(Error **errp)
+/*
+ * OOM kills are picked up incrementally: /dev/kmsg is kept open and every
+ * call reads only the records logged since the previous one. Without
+ * /dev/kmsg the system log file is followed instead, remembering its inode
+ * and offset so that only new lines are parsed. The most recent events are
+ * kept in a small ring.
+ */
+#define GUEST_OOM_EVENTS_MAX 64
+#define GUEST_OOM_KMSG_RECORD 8192
+
+typedef struct GuestOOMState {
+    QemuMutex lock;
+    int kmsg_fd;
+    bool kmsg_failed;
+    dev_t log_dev;
+    ino_t log_ino;
+    off_t log_offset;
+    bool log_failed;
+    int64_t count;          /* events seen, seq of the next one */
+    GuestOOMEvent *events[GUEST_OOM_EVENTS_MAX];
+} GuestOOMState;
+
+static GuestOOMState guest_oom;
+
+static const char *guest_oom_log_path = "/var/log/messages";
+
+static int64_t guest_oom_realtime(void)
 {
-    Error *local_err = NULL;
-    int oflag;
-    const char *mode = "r";
-    const char *path = "/var/log/messages";
-    OOMStatus *status = g_malloc0(sizeof(OOMStatus));
-    const char *oom = "Out of memory: Kill process";
+    qemu_timeval tv;
 
-    oflag = find_open_flag(mode, &local_err);
-    if (local_err == NULL) {
-        int fd;
+    qemu_gettimeofday(&tv);
+    return tv.tv_sec * 1000000000LL + tv.tv_usec * 1000;
+}
 
-        fd = open(path, oflag | ((oflag & O_CREAT) ? O_EXCL : 0), 0);
-        if (fd == -1 && errno == EEXIST) {
-            oflag &= ~(unsigned)O_CREAT;
-            fd = open(path, oflag);
+/*
+ * Record the kill if @msg is an OOM killer message, e.g.
+ * "Out of memory: Kill process 1234 (name) score 10 or sacrifice child"
+ * or "Memory cgroup out of memory: Killed process 1234 (name) ...".
+ */
+static void guest_oom_parse(GuestOOMState *o, const char *msg,
+                            int64_t timestamp)
+{
+    GuestOOMEvent *event;
+    const char *p;
+    char name[256];
+    int pid, slot;
+
+    p = strstr(msg, "of memory: Kill");
+    if (!p) {
+        return;
+    }
+    p = strstr(p, "process ");
+    if (!p || sscanf(p, "process %d (%255[^)])", &pid, name) != 2) {
+        return;
+    }
+
+    event = g_new0(GuestOOMEvent, 1);
+    event->pid = pid;
+    event->name = g_strdup(name);
+    event->timestamp = timestamp;
+    event->seq = o->count++;
+
+    slot = event->seq % GUEST_OOM_EVENTS_MAX;
+    qapi_free_GuestOOMEvent(o->events[slot]);
+    o->events[slot] = event;
+}
+
+/* Returns false if /dev/kmsg cannot be used */
+static bool guest_oom_read_kmsg(GuestOOMState *o)
+{
+    char buf[GUEST_OOM_KMSG_RECORD];
+    struct timespec ts;
+    int64_t boot;
+    unsigned long long usec;
+    char *msg, *end;
+    ssize_t len;
+
+    if (o->kmsg_failed) {
+        return false;
+    }
+    if (o->kmsg_fd < 0) {
+        /* reading starts at the oldest record still in the buffer */
+        o->kmsg_fd = qemu_open("/dev/kmsg", O_RDONLY | O_NONBLOCK);
+        if (o->kmsg_fd < 0) {
+            slog("failed to open /dev/kmsg, following %s instead: %s",
+                 guest_oom_log_path, strerror(errno));
+            o->kmsg_failed = true;
+            return false;
         }
+    }
 
-        if (fd == -1) {
-            error_setg_errno(&local_err, errno, "failed to open file '%s' "
-                             "(mode: '%s')", path, mode);
-        } else {
-            qemu_set_cloexec(fd);
-            FILE *f = NULL;
-            char StrLine[1024] = "";
-            f = fdopen(fd, mode);
-            if (f == NULL) {
-                error_setg_errno(&local_err, errno, "failed to associate "
-                                 "stdio stream with file descriptor %d, "
-                                 "file '%s' (mode: '%s')", fd, path, mode);
-            } else {
-                while (!feof(f)) {
-                    fgets(StrLine, 1024, f);
+    /* record timestamps are in microseconds since boot */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    boot = guest_oom_realtime() - (ts.tv_sec * 1000000000LL + ts.tv_nsec);
 
-                    char *p = NULL;
-                    p = strstr(StrLine,oom);
-                    if(p)
-                        status->oom_happened = true;
-                    else
-                        status->oom_happened = false;
-                }
-                fclose(f);
+    for (;;) {
+        /* each read returns exactly one "prio,seq,usec,flags;message" */
+        len = read(o->kmsg_fd, buf, sizeof(buf) - 1);
+        if (len < 0) {
+            if (errno == EINTR || errno == EPIPE) {
+                /* EPIPE: records were overwritten before we read them */
+                continue;
             }
-            close(fd);
-            if (oflag & O_CREAT) {
-                unlink(path);
+            if (errno != EAGAIN) {
+                slog("failed to read /dev/kmsg: %s", strerror(errno));
             }
+            break;
         }
-        error_free(local_err);
+        if (len == 0) {
+            break;
+        }
+        buf[len] = '\0';
+
+        msg = strchr(buf, ';');
+        if (!msg || sscanf(buf, "%*u,%*u,%llu", &usec) != 1) {
+            continue;
+        }
+        msg++;
+        end = strchr(msg, '\n');
+        if (end) {
+            *end = '\0';
+        }
+        guest_oom_parse(o, msg, boot + usec * 1000);
     }
-    else
-        error_propagate(errp, local_err);
+
+    return true;
+}
+
+static void guest_oom_read_log(GuestOOMState *o)
+{
+    struct stat st;
+    FILE *f;
+    char *line = NULL;
+    size_t n = 0;
+    ssize_t len;
+    int64_t now;
+
+    if (o->log_failed) {
+        return;
+    }
+
+    f = fopen(guest_oom_log_path, "r");
+    if (!f) {
+        slog("failed to open %s, OOM kills will not be reported: %s",
+             guest_oom_log_path, strerror(errno));
+        o->log_failed = true;
+        return;
+    }
+    qemu_set_cloexec(fileno(f));
+
+    if (fstat(fileno(f), &st) < 0) {
+        goto out;
+    }
+    if (st.st_dev != o->log_dev || st.st_ino != o->log_ino ||
+        st.st_size < o->log_offset) {
+        /* first call, rotated or truncated: start over */
+        o->log_dev = st.st_dev;
+        o->log_ino = st.st_ino;
+        o->log_offset = 0;
+    }
+    if (st.st_size == o->log_offset ||
+        fseeko(f, o->log_offset, SEEK_SET) < 0) {
+        goto out;
+    }
+
+    now = guest_oom_realtime();
+    while ((len = getline(&line, &n, f)) != -1) {
+        if (line[len - 1] != '\n') {
+            /* partial line, parse it once it is complete */
+            break;
+        }
+        o->log_offset += len;
+        guest_oom_parse(o, line, now);
+    }
+
+out:
+    g_free(line);
+    fclose(f);
+}
+
+static void guest_oom_init(void)
+{
+    GuestOOMState *o = &guest_oom;
+
+    qemu_mutex_init(&o->lock);
+    o->kmsg_fd = -1;
+}
+
+static void guest_oom_cleanup(void)
+{
+    GuestOOMState *o = &guest_oom;
+    int i;
+
+    if (o->kmsg_fd >= 0) {
+        close(o->kmsg_fd);
+    }
+    for (i = 0; i < GUEST_OOM_EVENTS_MAX; i++) {
+        qapi_free_GuestOOMEvent(o->events[i]);
+    }
+    qemu_mutex_destroy(&o->lock);
+}
+
+/*
+ * Pick up new kills and return the events with a sequence number of at
+ * least *cursor, which is then set to the sequence number of the next one.
+ */
+static GuestOOMEventList *guest_oom_events_since(int64_t *cursor)
+{
+    GuestOOMState *o = &guest_oom;
+    GuestOOMEventList *head = NULL, **link = &head, *entry;
+    GuestOOMEvent *event;
+    int64_t seq;
+
+    qemu_mutex_lock(&o->lock);
+    if (!guest_oom_read_kmsg(o)) {
+        guest_oom_read_log(o);
+    }
+
+    seq = MAX(*cursor, o->count - GUEST_OOM_EVENTS_MAX);
+    for (; seq < o->count; seq++) {
+        event = o->events[seq % GUEST_OOM_EVENTS_MAX];
+
+        entry = g_new0(GuestOOMEventList, 1);
+        entry->value = g_memdup(event, sizeof(*event));
+        entry->value->name = g_strdup(event->name);
+
+        *link = entry;
+        link = &entry->next;
+    }
+    *cursor = o->count;
+    qemu_mutex_unlock(&o->lock);
+
+    return head;
+}
+
+struct OOMStatus *qmp_guest_get_oom_status(bool has_cursor, int64_t cursor,
+                                           Error **errp)
+{
+    OOMStatus *status = g_new0(OOMStatus, 1);
+    int64_t next;
+
+    if (!has_cursor || cursor < 0) {
+        cursor = 0;
+    }
+
+    next = cursor;
+    status->has_events = true;
+    status->events = guest_oom_events_since(&next);
+
+    status->oom_happened = next > cursor;
+    status->has_count = true;
+    status->count = next;
+    status->has_cursor = true;
+    status->cursor = next;
 
     return status;
 }
@@ -2965,6 +6055,53 @@ GuestMemoryBlockInfo *qmp_guest_get_memory_block_info(Error **errp)
     return NULL;
 }
 
+GuestHotplugJob *
+qmp_guest_set_memory_blocks_async(GuestMemoryBlockList *mem_blks,
+                                  bool has_threads, int64_t threads,
+                                  Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestHotplugJob *qmp_guest_set_vcpus_async(GuestLogicalProcessorList *vcpus,
+                                           bool has_threads, int64_t threads,
+                                           Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestHotplugJobStatus *qmp_guest_hotplug_job_status(int64_t job_id,
+                                                    bool has_cursor,
+                                                    int64_t cursor,
+                                                    Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestProcessTable *qmp_guest_get_processes(bool has_count, int64_t count,
+                                           bool has_sort,
+                                           GuestProcessSort sort,
+                                           Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestCpuStats *qmp_guest_get_cpu_stats(Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestDiskIOStatsList *qmp_guest_get_disk_io_stats(Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
 #endif
 
 #if !defined(CONFIG_FSFREEZE)
@@ -2998,6 +6135,17 @@ int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
     return 0;
 }
 
+GuestFsfreezeResult *qmp_guest_fsfreeze_freeze_parallel(bool has_mountpoints,
+                                                        strList *mountpoints,
+                                                        bool has_sync_threads,
+                                                        int64_t sync_threads,
+                                                        Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+
+    return NULL;
+}
+
 int64_t qmp_guest_fsfreeze_thaw(Error **errp)
 {
     error_setg(errp, QERR_UNSUPPORTED);
@@ -3025,7 +6173,10 @@ GList *ga_command_blacklist_init(GList *blacklist)
             "guest-suspend-hybrid", "guest-network-get-interfaces",
             "guest-get-vcpus", "guest-set-vcpus",
             "guest-get-memory-blocks", "guest-set-memory-blocks",
-            "guest-get-memory-block-size", NULL};
+            "guest-get-memory-block-size", "guest-get-processes",
+            "guest-get-cpu-stats", "guest-get-disk-io-stats",
+            "guest-set-memory-blocks-async", "guest-set-vcpus-async",
+            "guest-hotplug-job-status", NULL};
         char **p = (char **)list;
 
         while (*p) {
@@ -3039,6 +6190,7 @@ GList *ga_command_blacklist_init(GList *blacklist)
         const char *list[] = {
             "guest-get-fsinfo", "guest-fsfreeze-status",
             "guest-fsfreeze-freeze", "guest-fsfreeze-freeze-list",
+            "guest-fsfreeze-freeze-parallel",
             "guest-fsfreeze-thaw", "guest-get-fsinfo", NULL};
         char **p = (char **)list;
 
@@ -3058,7 +6210,19 @@ GList *ga_command_blacklist_init(GList *blacklist)
 /* register init/cleanup routines for stateful command groups */
 void ga_command_state_init(GAState *s, GACommandState *cs)
 {
+    ga_command_state_add(cs, guest_file_init, NULL);
+#if defined(__linux__)
+    /* the metrics sampler uses the OOM tracker, set up before and after it */
+    ga_command_state_add(cs, guest_oom_init, NULL);
+    ga_command_state_add(cs, guest_metrics_init, guest_metrics_cleanup);
+    ga_command_state_add(cs, NULL, guest_oom_cleanup);
+    ga_command_state_add(cs, guest_procs_init, guest_procs_cleanup);
+    ga_command_state_add(cs, guest_cpustats_init, guest_cpustats_cleanup);
+    ga_command_state_add(cs, guest_diskstats_init, guest_diskstats_cleanup);
+    ga_command_state_add(cs, guest_hotplug_init, guest_hotplug_cleanup);
+#endif
 #if defined(CONFIG_FSFREEZE)
     ga_command_state_add(cs, NULL, guest_fsfreeze_cleanup);
+    ga_command_state_add(cs, guest_fsinfo_init, guest_fsinfo_cleanup);
 #endif
 }
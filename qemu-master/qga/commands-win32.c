@@ -392,6 +392,74 @@ void qmp_guest_file_flush(int64_t handle, Error **errp)
     }
 }
 
+GuestFileRead *qmp_guest_file_pread(int64_t handle, int64_t offset,
+                                    bool has_count, int64_t count,
+                                    Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestFileWrite *qmp_guest_file_pwrite(int64_t handle, int64_t offset,
+                                      const char *buf_b64, bool has_count,
+                                      int64_t count, Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestFileReadResultList *
+qmp_guest_file_read_vector(GuestFileReadRequestList *requests, Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestFileChecksum *qmp_guest_file_checksum(const char *path,
+                                           bool has_block_size,
+                                           int64_t block_size,
+                                           bool has_blocks, bool blocks,
+                                           Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestFileChecksum *qmp_guest_file_apply_delta(const char *path,
+                                              int64_t block_size,
+                                              GuestFileDeltaOpList *ops,
+                                              bool has_sha256,
+                                              const char *sha256,
+                                              Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestBinaryTransfer *qmp_guest_set_binary_transfer(bool enable,
+                                                   bool has_chunk_size,
+                                                   int64_t chunk_size,
+                                                   Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestFileReadRaw *qmp_guest_file_read_raw(int64_t handle, bool has_offset,
+                                          int64_t offset, bool has_count,
+                                          int64_t count, Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestFileWrite *qmp_guest_file_write_raw(int64_t handle, bool has_offset,
+                                         int64_t offset, Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
 #ifdef CONFIG_QGA_NTDDSCSI
 
 static STORAGE_BUS_TYPE win2qemu[] = {
@@ -756,6 +824,17 @@ int64_t qmp_guest_fsfreeze_freeze_list(bool has_mountpoints,
     return 0;
 }
 
+GuestFsfreezeResult *qmp_guest_fsfreeze_freeze_parallel(bool has_mountpoints,
+                                                        strList *mountpoints,
+                                                        bool has_sync_threads,
+                                                        int64_t sync_threads,
+                                                        Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+
+    return NULL;
+}
+
 /*
  * Thaw local file systems using Volume Shadow-copy Service.
  */
@@ -1290,6 +1369,53 @@ GuestMemoryBlockInfo *qmp_guest_get_memory_block_info(Error **errp)
     return NULL;
 }
 
+GuestHotplugJob *
+qmp_guest_set_memory_blocks_async(GuestMemoryBlockList *mem_blks,
+                                  bool has_threads, int64_t threads,
+                                  Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestHotplugJob *qmp_guest_set_vcpus_async(GuestLogicalProcessorList *vcpus,
+                                           bool has_threads, int64_t threads,
+                                           Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestHotplugJobStatus *qmp_guest_hotplug_job_status(int64_t job_id,
+                                                    bool has_cursor,
+                                                    int64_t cursor,
+                                                    Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestProcessTable *qmp_guest_get_processes(bool has_count, int64_t count,
+                                           bool has_sort,
+                                           GuestProcessSort sort,
+                                           Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestCpuStats *qmp_guest_get_cpu_stats(Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
+GuestDiskIOStatsList *qmp_guest_get_disk_io_stats(Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
 /* add unsupported commands to the blacklist */
 GList *ga_command_blacklist_init(GList *blacklist)
 {
@@ -1298,8 +1424,14 @@ GList *ga_command_blacklist_init(GList *blacklist)
         "guest-get-vcpus", "guest-set-vcpus",
         "guest-get-memory-blocks", "guest-set-memory-blocks",
         "guest-get-memory-block-size",
-        "guest-fsfreeze-freeze-list",
-        "guest-fstrim", NULL};
+        "guest-fsfreeze-freeze-list", "guest-fsfreeze-freeze-parallel",
+        "guest-fstrim", "guest-set-binary-transfer",
+        "guest-file-read-raw", "guest-file-write-raw",
+        "guest-file-pread", "guest-file-pwrite", "guest-file-read-vector",
+        "guest-file-checksum", "guest-file-apply-delta",
+        "guest-get-processes", "guest-get-cpu-stats",
+        "guest-get-disk-io-stats", "guest-set-memory-blocks-async",
+        "guest-set-vcpus-async", "guest-hotplug-job-status", NULL};
     char **p = (char **)list_unsupported;
 
     while (*p) {
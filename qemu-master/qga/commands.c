@@ -19,6 +19,8 @@
 #define GUEST_EXEC_MAX_OUTPUT (16*1024*1024)
 /* Allocation and I/O buffer for reading guest-exec out_data/err_data - 4KB */
 #define GUEST_EXEC_IO_SIZE (4*1024)
+/* Unacknowledged guest-exec-read output kept per stream - 64KB */
+#define GUEST_EXEC_RING_SIZE (64*1024)
 
 /* Note: in some situations, like with the fsfreeze, logging may be
  * temporarilly disabled. if it is necessary that a command be able
@@ -76,6 +78,136 @@ struct GuestAgentInfo *qmp_guest_info(Error **errp)
     return info;
 }
 
+/* commands that cannot be part of a batch */
+static const char *guest_batch_blacklist[] = {
+    "guest-batch",
+    /* these put raw data on the channel around their own response */
+    "guest-file-read-raw",
+    "guest-file-write-raw",
+    /* these change how the responses to the client are framed */
+    "guest-sync-delimited",
+    "guest-set-compression",
+    "guest-set-binary-transfer",
+    NULL
+};
+
+bool ga_batch_allowed(const char *command, Error **errp)
+{
+    int i;
+
+    for (i = 0; command && guest_batch_blacklist[i]; i++) {
+        if (!strcmp(command, guest_batch_blacklist[i])) {
+            error_setg(errp, "%s cannot be part of a batch", command);
+            return false;
+        }
+    }
+    return true;
+}
+
+static GuestBatchResponse *guest_batch_run(QObject *request)
+{
+    GuestBatchResponse *resp = g_new0(GuestBatchResponse, 1);
+    QDict *dict, *rsp;
+    QObject *rsp_obj;
+    const char *command = NULL;
+    Error *err = NULL;
+
+    dict = qobject_to_qdict(request);
+    if (dict) {
+        command = qdict_get_try_str(dict, "execute");
+    }
+    if (!ga_batch_allowed(command, &err)) {
+        resp->has_error = true;
+        resp->error = g_new0(GuestBatchError, 1);
+        resp->error->q_class = g_strdup("GenericError");
+        resp->error->desc = g_strdup(error_get_pretty(err));
+        error_free(err);
+        return resp;
+    }
+
+    /* qmp_dispatch() validates each request just like a standalone one */
+    rsp_obj = qmp_dispatch(request);
+    rsp = qobject_to_qdict(rsp_obj);
+    if (!rsp) {
+        /* success for a command without a success response */
+        return resp;
+    }
+
+    if (qdict_haskey(rsp, "error")) {
+        QDict *error = qdict_get_qdict(rsp, "error");
+
+        resp->has_error = true;
+        resp->error = g_new0(GuestBatchError, 1);
+        resp->error->q_class = g_strdup(qdict_get_try_str(error, "class"));
+        resp->error->desc = g_strdup(qdict_get_try_str(error, "desc"));
+    } else {
+        resp->has_q_return = true;
+        resp->q_return = qdict_get(rsp, "return");
+        qobject_incref(resp->q_return);
+    }
+    QDECREF(rsp);
+
+    return resp;
+}
+
+#define GA_COMPRESS_THRESHOLD_DEFAULT 4096
+#define GA_COMPRESS_THRESHOLD_MIN 64
+#define GA_COMPRESS_LEVEL_DEFAULT 1
+
+GuestCompression *qmp_guest_set_compression(bool enable, bool has_threshold,
+                                            int64_t threshold, bool has_level,
+                                            int64_t level, Error **errp)
+{
+    GuestCompression *info;
+
+    if (!has_threshold) {
+        threshold = GA_COMPRESS_THRESHOLD_DEFAULT;
+    }
+    if (!has_level) {
+        level = GA_COMPRESS_LEVEL_DEFAULT;
+    }
+    if (threshold < GA_COMPRESS_THRESHOLD_MIN || threshold > INT32_MAX) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "threshold",
+                   "a value of at least 64");
+        return NULL;
+    }
+    if (level < 1 || level > 9) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "level",
+                   "a value between 1 and 9");
+        return NULL;
+    }
+
+    ga_set_compression(ga_state, enable ? threshold : 0, level);
+
+    info = g_new0(GuestCompression, 1);
+    info->enabled = enable;
+    info->threshold = threshold;
+    info->level = level;
+    return info;
+}
+
+GuestAgentStats *qmp_guest_get_agent_stats(bool has_reset, bool reset,
+                                           Error **errp)
+{
+    return ga_get_agent_stats(ga_state, has_reset && reset);
+}
+
+GuestBatchResponseList *qmp_guest_batch(anyList *commands, Error **errp)
+{
+    GuestBatchResponseList *head = NULL, **link = &head;
+    GuestBatchResponseList *entry;
+
+    for (; commands; commands = commands->next) {
+        entry = g_new0(GuestBatchResponseList, 1);
+        entry->value = guest_batch_run(commands->value);
+
+        *link = entry;
+        link = &entry->next;
+    }
+
+    return head;
+}
+
 struct GuestExecIOData {
     guchar *data;
     gsize size;
@@ -83,6 +215,12 @@ struct GuestExecIOData {
     gint closed;
     bool truncated;
     const char *name;
+    /* stream-output mode: data is a ring of unacknowledged output */
+    bool ring;
+    gsize head;         /* index of the oldest byte in data */
+    int64_t start;      /* stream position of the oldest byte */
+    GIOChannel *ch;
+    guint watch;        /* 0 while reading is paused */
 };
 typedef struct GuestExecIOData GuestExecIOData;
 
@@ -139,10 +277,65 @@ static GuestExecInfo *guest_exec_info_find(int64_t pid_numeric)
     return NULL;
 }
 
+static bool guest_exec_finished(GuestExecInfo *gei)
+{
+    bool finished = g_atomic_int_get(&gei->finished);
+
+    /* need to wait till output channels are closed
+     * to be sure we captured all output at this point */
+    if (gei->has_output) {
+        finished = finished && g_atomic_int_get(&gei->out.closed);
+        finished = finished && g_atomic_int_get(&gei->err.closed);
+    }
+
+    return finished;
+}
+
+static void guest_exec_get_exit_status(GuestExecInfo *gei,
+                                       bool *has_exitcode, int64_t *exitcode,
+                                       bool *has_signal, int64_t *signal)
+{
+    /* Glib has no portable way to parse exit status.
+     * On UNIX, we can get either exit code from normal termination
+     * or signal number.
+     * On Windows, it is either the same exit code or the exception
+     * value for an unhandled exception that caused the process
+     * to terminate.
+     * See MSDN for GetExitCodeProcess() and ntstatus.h for possible
+     * well-known codes, e.g. C0000005 ACCESS_DENIED - analog of SIGSEGV
+     * References:
+     *   https://msdn.microsoft.com/en-us/library/windows/desktop/ms683189(v=vs.85).aspx
+     *   https://msdn.microsoft.com/en-us/library/aa260331(v=vs.60).aspx
+     */
+#ifdef G_OS_WIN32
+    /* Additionally WIN32 does not provide any additional information
+     * on whetherthe child exited or terminated via signal.
+     * We use this simple range check to distingish application exit code
+     * (usually value less then 256) and unhandled exception code with
+     * ntstatus (always value greater then 0xC0000005). */
+    if ((uint32_t)gei->status < 0xC0000000U) {
+        *has_exitcode = true;
+        *exitcode = gei->status;
+    } else {
+        *has_signal = true;
+        *signal = gei->status;
+    }
+#else
+    if (WIFEXITED(gei->status)) {
+        *has_exitcode = true;
+        *exitcode = WEXITSTATUS(gei->status);
+    } else if (WIFSIGNALED(gei->status)) {
+        *has_signal = true;
+        *signal = WTERMSIG(gei->status);
+    }
+#endif
+}
+
 GuestExecStatus *qmp_guest_exec_status(int64_t pid, Error **err)
 {
     GuestExecInfo *gei;
     GuestExecStatus *ges;
+    bool finished;
 
     slog("guest-exec-status called, pid: %u", (uint32_t)pid);
 
@@ -154,65 +347,31 @@ GuestExecStatus *qmp_guest_exec_status(int64_t pid, Error **err)
 
     ges = g_new0(GuestExecStatus, 1);
 
-    bool finished = g_atomic_int_get(&gei->finished);
-
-    /* need to wait till output channels are closed
-     * to be sure we captured all output at this point */
-    if (gei->has_output) {
-        finished = finished && g_atomic_int_get(&gei->out.closed);
-        finished = finished && g_atomic_int_get(&gei->err.closed);
-    }
-
+    finished = guest_exec_finished(gei);
     ges->exited = finished;
     if (finished) {
-        /* Glib has no portable way to parse exit status.
-         * On UNIX, we can get either exit code from normal termination
-         * or signal number.
-         * On Windows, it is either the same exit code or the exception
-         * value for an unhandled exception that caused the process
-         * to terminate.
-         * See MSDN for GetExitCodeProcess() and ntstatus.h for possible
-         * well-known codes, e.g. C0000005 ACCESS_DENIED - analog of SIGSEGV
-         * References:
-         *   https://msdn.microsoft.com/en-us/library/windows/desktop/ms683189(v=vs.85).aspx
-         *   https://msdn.microsoft.com/en-us/library/aa260331(v=vs.60).aspx
-         */
-#ifdef G_OS_WIN32
-        /* Additionally WIN32 does not provide any additional information
-         * on whetherthe child exited or terminated via signal.
-         * We use this simple range check to distingish application exit code
-         * (usually value less then 256) and unhandled exception code with
-         * ntstatus (always value greater then 0xC0000005). */
-        if ((uint32_t)gei->status < 0xC0000000U) {
-            ges->has_exitcode = true;
-            ges->exitcode = gei->status;
-        } else {
-            ges->has_signal = true;
-            ges->signal = gei->status;
-        }
-#else
-        if (WIFEXITED(gei->status)) {
-            ges->has_exitcode = true;
-            ges->exitcode = WEXITSTATUS(gei->status);
-        } else if (WIFSIGNALED(gei->status)) {
-            ges->has_signal = true;
-            ges->signal = WTERMSIG(gei->status);
-        }
-#endif
-        if (gei->out.length > 0) {
+        guest_exec_get_exit_status(gei, &ges->has_exitcode, &ges->exitcode,
+                                   &ges->has_signal, &ges->signal);
+        if (!gei->out.ring && gei->out.length > 0) {
             ges->has_out_data = true;
             ges->out_data = g_base64_encode(gei->out.data, gei->out.length);
             g_free(gei->out.data);
             ges->has_out_truncated = gei->out.truncated;
         }
 
-        if (gei->err.length > 0) {
+        if (!gei->err.ring && gei->err.length > 0) {
             ges->has_err_data = true;
             ges->err_data = g_base64_encode(gei->err.data, gei->err.length);
             g_free(gei->err.data);
             ges->has_err_truncated = gei->err.truncated;
         }
 
+        if (gei->out.ring) {
+            /* streamed output is only returned by guest-exec-read */
+            g_free(gei->out.data);
+            g_free(gei->err.data);
+        }
+
         QTAILQ_REMOVE(&guest_exec_state.processes, gei, next);
         g_free(gei);
     }
@@ -375,11 +534,172 @@ close:
     return false;
 }
 
+static gboolean guest_exec_ring_watch(GIOChannel *ch,
+        GIOCondition cond, gpointer p_)
+{
+    GuestExecIOData *p = (GuestExecIOData *)p_;
+    gsize tail, bytes_read;
+    GIOStatus gstatus;
+
+    if (cond == G_IO_HUP || cond == G_IO_ERR) {
+        goto close;
+    }
+
+    /* read into the free space, up to the end of the buffer at most */
+    tail = (p->head + p->length) % p->size;
+    gstatus = g_io_channel_read_chars(ch, (gchar *)p->data + tail,
+            MIN(p->size - p->length, p->size - tail), &bytes_read, NULL);
+    if (gstatus == G_IO_STATUS_EOF || gstatus == G_IO_STATUS_ERROR) {
+        goto close;
+    }
+
+    p->length += bytes_read;
+    if (p->length == p->size) {
+        /* stop reading until guest-exec-read makes room again */
+        p->watch = 0;
+        return false;
+    }
+
+    return true;
+
+close:
+    g_io_channel_unref(ch);
+    p->ch = NULL;
+    p->watch = 0;
+    g_atomic_int_set(&p->closed, 1);
+    return false;
+}
+
+static void guest_exec_ring_init(GuestExecIOData *p, GIOChannel *ch)
+{
+    p->ring = true;
+    p->size = GUEST_EXEC_RING_SIZE;
+    p->data = g_malloc(p->size);
+    p->ch = ch;
+    p->watch = g_io_add_watch(ch, G_IO_IN | G_IO_HUP,
+                              guest_exec_ring_watch, p);
+}
+
+static bool guest_exec_ring_check(GuestExecIOData *p, bool has_cursor,
+                                  int64_t cursor, Error **errp)
+{
+    if (has_cursor &&
+        (cursor < p->start || cursor > p->start + (int64_t)p->length)) {
+        error_setg(errp, "%s cursor %" PRId64 " is out of range, "
+                   "%" PRId64 "-%" PRId64 " is available", p->name, cursor,
+                   p->start, p->start + (int64_t)p->length);
+        return false;
+    }
+    return true;
+}
+
+/* drop the output before @cursor and resume reading if that made room */
+static void guest_exec_ring_ack(GuestExecIOData *p, int64_t cursor)
+{
+    gsize n = cursor - p->start;
+
+    p->head = (p->head + n) % p->size;
+    p->length -= n;
+    p->start = cursor;
+
+    if (n && p->ch && !p->watch) {
+        p->watch = g_io_add_watch(p->ch, G_IO_IN | G_IO_HUP,
+                                  guest_exec_ring_watch, p);
+    }
+}
+
+/* base64-encode up to @max bytes from the start of the ring */
+static char *guest_exec_ring_peek(GuestExecIOData *p, gsize max, gsize *count)
+{
+    gsize len = MIN(p->length, max);
+    gsize first = MIN(len, p->size - p->head);
+    gint state = 0, save = 0;
+    gchar *b64;
+    gsize n;
+
+    *count = len;
+    if (!len) {
+        return NULL;
+    }
+
+    /* the data may wrap around, encode it in two steps */
+    b64 = g_malloc((len / 3 + 1) * 4 + 5);
+    n = g_base64_encode_step(p->data + p->head, first, false, b64,
+                             &state, &save);
+    n += g_base64_encode_step(p->data, len - first, false, b64 + n,
+                              &state, &save);
+    n += g_base64_encode_close(false, b64 + n, &state, &save);
+    b64[n] = 0;
+
+    return b64;
+}
+
+GuestExecRead *qmp_guest_exec_read(int64_t pid,
+                                   bool has_out_cursor, int64_t out_cursor,
+                                   bool has_err_cursor, int64_t err_cursor,
+                                   bool has_max_bytes, int64_t max_bytes,
+                                   Error **err)
+{
+    GuestExecInfo *gei;
+    GuestExecRead *ger;
+    gsize out_count, err_count;
+
+    gei = guest_exec_info_find(pid);
+    if (gei == NULL) {
+        error_setg(err, QERR_INVALID_PARAMETER, "pid");
+        return NULL;
+    }
+    if (!gei->out.ring) {
+        error_setg(err, "process %" PRId64 " was not started with "
+                   "stream-output", pid);
+        return NULL;
+    }
+    if (!has_max_bytes) {
+        max_bytes = GUEST_EXEC_RING_SIZE;
+    } else if (max_bytes < 0) {
+        error_setg(err, QERR_INVALID_PARAMETER, "max-bytes");
+        return NULL;
+    }
+
+    if (!guest_exec_ring_check(&gei->out, has_out_cursor, out_cursor, err) ||
+        !guest_exec_ring_check(&gei->err, has_err_cursor, err_cursor, err)) {
+        return NULL;
+    }
+    if (has_out_cursor) {
+        guest_exec_ring_ack(&gei->out, out_cursor);
+    }
+    if (has_err_cursor) {
+        guest_exec_ring_ack(&gei->err, err_cursor);
+    }
+
+    ger = g_new0(GuestExecRead, 1);
+    ger->out_data = guest_exec_ring_peek(&gei->out, max_bytes, &out_count);
+    ger->has_out_data = ger->out_data != NULL;
+    ger->out_cursor = gei->out.start + out_count;
+    ger->err_data = guest_exec_ring_peek(&gei->err, max_bytes, &err_count);
+    ger->has_err_data = ger->err_data != NULL;
+    ger->err_cursor = gei->err.start + err_count;
+
+    if (guest_exec_finished(gei) && out_count == gei->out.length &&
+        err_count == gei->err.length) {
+        ger->exited = true;
+        guest_exec_get_exit_status(gei, &ger->has_exitcode, &ger->exitcode,
+                                   &ger->has_signal, &ger->signal);
+        QTAILQ_REMOVE(&guest_exec_state.processes, gei, next);
+        g_free(gei->out.data);
+        g_free(gei->err.data);
+        g_free(gei);
+    }
+
+    return ger;
+}
+
 GuestExec *qmp_guest_exec(const char *path,
                        bool has_arg, strList *arg,
                        bool has_env, strList *env,
                        bool has_input_data, const char *input_data,
                        bool has_capture_output, bool capture_output,
+                       bool has_stream_output, bool stream_output,
                        Error **err)
 {
     GPid pid;
@@ -392,7 +712,8 @@ GuestExec *qmp_guest_exec(const char *path,
     gint in_fd, out_fd, err_fd;
     GIOChannel *in_ch, *out_ch, *err_ch;
     GSpawnFlags flags;
-    bool has_output = (has_capture_output && capture_output);
+    bool has_stream = (has_stream_output && stream_output);
+    bool has_output = (has_capture_output && capture_output) || has_stream;
 
     arglist.value = (char *)path;
     arglist.next = has_arg ? arg : NULL;
@@ -419,6 +740,8 @@ GuestExec *qmp_guest_exec(const char *path,
 
     gei = guest_exec_info_add(pid);
     gei->has_output = has_output;
+    gei->out.name = "stdout";
+    gei->err.name = "stderr";
     g_child_watch_add(pid, guest_exec_child_watch, gei);
 
     if (has_input_data) {
@@ -446,10 +769,15 @@ GuestExec *qmp_guest_exec(const char *path,
         g_io_channel_set_encoding(err_ch, NULL, NULL);
         g_io_channel_set_buffered(out_ch, false);
         g_io_channel_set_buffered(err_ch, false);
-        g_io_add_watch(out_ch, G_IO_IN | G_IO_HUP,
-                guest_exec_output_watch, &gei->out);
-        g_io_add_watch(err_ch, G_IO_IN | G_IO_HUP,
-                guest_exec_output_watch, &gei->err);
+        if (has_stream) {
+            guest_exec_ring_init(&gei->out, out_ch);
+            guest_exec_ring_init(&gei->err, err_ch);
+        } else {
+            g_io_add_watch(out_ch, G_IO_IN | G_IO_HUP,
+                    guest_exec_output_watch, &gei->out);
+            g_io_add_watch(err_ch, G_IO_IN | G_IO_HUP,
+                    guest_exec_output_watch, &gei->err);
+        }
     }
 
 done:
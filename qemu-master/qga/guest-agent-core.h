@@ -36,7 +36,18 @@ bool ga_is_frozen(GAState *s);
 void ga_set_frozen(GAState *s);
 void ga_unset_frozen(GAState *s);
 const char *ga_fsfreeze_hook(GAState *s);
+int ga_metrics_interval(GAState *s);
+int ga_memory_threshold(GAState *s);
+int ga_disk_threshold(GAState *s);
+bool ga_oom_events_enabled(GAState *s);
 int64_t ga_get_fd_handle(GAState *s, Error **errp);
+void ga_set_binary_transfer(GAState *s, bool enable, size_t chunk_size);
+bool ga_binary_transfer_enabled(GAState *s);
+void ga_set_compression(GAState *s, size_t threshold, int level);
+struct GuestAgentStats *ga_get_agent_stats(GAState *s, bool reset);
+void ga_bulk_send(GAState *s, int fd, int64_t offset, int64_t count);
+void ga_bulk_receive(GAState *s, int fd, int64_t offset);
+bool ga_batch_allowed(const char *command, Error **errp);
 
 #ifndef _WIN32
 void reopen_fd_to_null(int fd);
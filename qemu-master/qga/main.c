@@ -25,8 +25,8 @@
 #include <errno.h>
 #include <unistd.h>
 #endif
+#include <zlib.h>
 #include "qapi/qmp/json-streamer.h"
-#include "qapi/qmp/json-parser.h"
 #include "qapi/qmp/qint.h"
 #include "qapi/qmp/qjson.h"
 #include "qga/guest-agent-core.h"
@@ -34,8 +34,13 @@
 #include "signal.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/qmp/dispatch.h"
+#include "qapi/qmp-event.h"
 #include "qga/channel.h"
 #include "qemu/bswap.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+#include "qemu/arena.h"
+#include "qga-qmp-commands.h"
 #ifdef _WIN32
 #include "qga/service-win32.h"
 #include "qga/vss-win32.h"
@@ -60,6 +65,7 @@
 #define QGA_FSFREEZE_HOOK_DEFAULT CONFIG_QEMU_CONFDIR "/fsfreeze-hook"
 #endif
 #define QGA_SENTINEL_BYTE 0xFF
+#define QGA_COMPRESSED_BYTE 0xFE
 #define QGA_CONF_DEFAULT CONFIG_QEMU_CONFDIR G_DIR_SEPARATOR_S "qemu-ga.conf"
 
 static struct {
@@ -72,8 +78,87 @@ typedef struct GAPersistentState {
     int64_t fd_counter;
 } GAPersistentState;
 
-struct GAState {
+typedef enum GABulkDirection {
+    GA_BULK_NONE,
+    GA_BULK_SEND,
+    GA_BULK_RECEIVE,
+} GABulkDirection;
+
+/* a raw file transfer riding on the channel, see ga_bulk_send() */
+typedef struct GABulkTransfer {
+    GABulkDirection dir;
+    int fd;                 /* -1 to discard received data */
+    int64_t offset;
+    int64_t count;          /* bytes to send */
+    int64_t done;           /* bytes transferred so far */
+    int err;                /* first error while writing received data */
+    uint8_t frame_hdr[4];
+    int frame_hdr_len;      /* received, or sent */
+    uint32_t frame_left;
+    bool padding;           /* the file ended early, sending zeroes */
+    bool last;              /* the terminating frame is being sent */
+    QObject *rsp;           /* held back until all data is received */
+    QObject *id;
+} GABulkTransfer;
+
+/*
+ * A client connection. unix-listen channels serve several clients at once;
+ * each has its own parser and transfer modes, and responses go back to the
+ * client that sent the request.
+ */
+typedef struct GASession {
+    GAState *s;
+    GAChannelClient *client;    /* NULL once the client has gone away */
     JSONMessageParser parser;
+    int scan_depth;             /* of the request, see ga_request_scan() */
+    char scan_quote;            /* of the string being scanned, or 0 */
+    bool scan_escape;
+    bool delimit_response;
+    bool binary_transfer;
+    size_t chunk_size;
+    GABulkTransfer bulk;
+    bool sending;               /* file data goes out, see ga_bulk_send() */
+    GQueue pending_output;      /* GByteArrays held back meanwhile */
+    GByteArray *pending_input;  /* requests received meanwhile */
+    size_t compress_threshold;  /* 0 when compression is off */
+    int compress_level;
+    unsigned int generation;    /* bumped by ga_session_reset() */
+    int refcnt;                 /* the connection and pending jobs */
+} GASession;
+
+/*
+ * Responses of synchronously dispatched commands, and the C structs their
+ * arguments are parsed into, are built in an arena that is emptied once the
+ * response is sent instead of being freed one object at a time. What does
+ * not fit comes from the heap.
+ */
+#define GA_ARENA_SIZE (64 * 1024)
+#define GA_ARENA_MAX_SIZE (4 * 1024 * 1024)
+
+/*
+ * Agent self-metrics. They are only updated from the main loop, so that
+ * keeping them costs no more than a hash table lookup per request.
+ */
+#define GA_STATS_BUCKETS 24     /* the last one counts anything >= 4s */
+
+typedef struct GACommandStats {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t total_time;        /* us */
+    uint64_t max_time;
+    uint64_t histogram[GA_STATS_BUCKETS];
+} GACommandStats;
+
+typedef struct GAStats {
+    int64_t start;              /* monotonic time of the last reset, us */
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t parse_errors;
+    uint64_t arena_allocs;      /* arena allocation count at the last reset */
+    GHashTable *commands;       /* command name -> GACommandStats */
+} GAStats;
+
+struct GAState {
     GMainLoop *main_loop;
     GAChannel *channel;
     bool virtio; /* fastpath to check for virtio to deal with poll() quirks */
@@ -84,9 +169,10 @@ struct GAState {
 #ifdef _WIN32
     GAService service;
 #endif
-    bool delimit_response;
     bool frozen;
-    GList *blacklist;
+    /* sets of command names */
+    GHashTable *blacklist;
+    GHashTable *freeze_whitelist;
     char *state_filepath_isfrozen;
     struct {
         const char *log_filepath;
@@ -97,6 +183,19 @@ struct GAState {
 #endif
     gchar *pstate_filepath;
     GAPersistentState pstate;
+    int metrics_interval;
+    int memory_threshold;
+    int disk_threshold;
+    bool oom_events;
+    GThreadPool *workers;
+    int max_workers;            /* async-workers */
+    int wedged_workers;         /* running commands that timed out */
+    int command_timeout;
+    int max_connections;
+    GList *sessions;
+    GASession *current;         /* session of the command being dispatched */
+    GAStats stats;
+    QemuArena *arena;           /* for synchronous dispatch, if enabled */
 };
 
 struct GAState *ga_state;
@@ -109,6 +208,7 @@ static const char *ga_freeze_whitelist[] = {
     "guest-sync-delimited",
     "guest-fsfreeze-status",
     "guest-fsfreeze-thaw",
+    "guest-get-agent-stats",
     NULL
 };
 
@@ -302,7 +402,8 @@ static void ga_log(const gchar *domain, GLogLevelFlags level,
 
 void ga_set_response_delimited(GAState *s)
 {
-    s->delimit_response = true;
+    g_assert(s->current);
+    s->current->delimit_response = true;
 }
 
 static FILE *ga_open_logfile(const char *logfile)
@@ -358,25 +459,13 @@ static bool ga_open_pidfile(const char *pidfile)
 }
 #endif
 
-static gint ga_strcmp(gconstpointer str1, gconstpointer str2)
-{
-    return strcmp(str1, str2);
-}
-
 /* disable commands that aren't safe for fsfreeze */
 static void ga_disable_non_whitelisted(QmpCommand *cmd, void *opaque)
 {
-    bool whitelisted = false;
-    int i = 0;
+    GHashTable *whitelist = opaque;
     const char *name = qmp_command_name(cmd);
 
-    while (ga_freeze_whitelist[i] != NULL) {
-        if (strcmp(name, ga_freeze_whitelist[i]) == 0) {
-            whitelisted = true;
-        }
-        i++;
-    }
-    if (!whitelisted) {
+    if (!g_hash_table_lookup(whitelist, name)) {
         g_debug("disabling command: %s", name);
         qmp_disable_command(name);
     }
@@ -385,10 +474,10 @@ static void ga_disable_non_whitelisted(QmpCommand *cmd, void *opaque)
 /* [re-]enable all commands, except those explicitly blacklisted by user */
 static void ga_enable_non_blacklisted(QmpCommand *cmd, void *opaque)
 {
-    GList *blacklist = opaque;
+    GHashTable *blacklist = opaque;
     const char *name = qmp_command_name(cmd);
 
-    if (g_list_find_custom(blacklist, name, ga_strcmp) == NULL &&
+    if (!g_hash_table_lookup(blacklist, name) &&
         !qmp_command_is_enabled(cmd)) {
         g_debug("enabling command: %s", name);
         qmp_enable_command(name);
@@ -428,7 +517,7 @@ void ga_set_frozen(GAState *s)
         return;
     }
     /* disable all non-whitelisted (for frozen state) commands */
-    qmp_for_each_command(ga_disable_non_whitelisted, NULL);
+    qmp_for_each_command(ga_disable_non_whitelisted, s->freeze_whitelist);
     g_warning("disabling logging due to filesystem freeze");
     ga_disable_logging(s);
     s->frozen = true;
@@ -479,6 +568,26 @@ const char *ga_fsfreeze_hook(GAState *s)
 }
 #endif
 
+int ga_metrics_interval(GAState *s)
+{
+    return s->metrics_interval;
+}
+
+int ga_memory_threshold(GAState *s)
+{
+    return s->memory_threshold;
+}
+
+int ga_disk_threshold(GAState *s)
+{
+    return s->disk_threshold;
+}
+
+bool ga_oom_events_enabled(GAState *s)
+{
+    return s->oom_events;
+}
+
 static void become_daemon(const char *pidfile)
 {
 #ifndef _WIN32
@@ -522,33 +631,233 @@ fail:
 #endif
 }
 
-static int send_response(GAState *s, QObject *payload)
+static bool ga_is_error_response(QObject *rsp)
 {
-    const char *buf;
-    QString *payload_qstr, *response_qstr;
-    GIOStatus status;
+    return rsp && qdict_haskey(qobject_to_qdict(rsp), "error");
+}
+
+/* account for a request of @name that took @time microseconds */
+static void ga_stats_record(GAState *s, const char *name, int64_t time,
+                            bool error)
+{
+    GACommandStats *cs = g_hash_table_lookup(s->stats.commands, name);
+    int bucket = time > 0 ? 64 - clz64(time) : 0;
+
+    if (!cs) {
+        cs = g_new0(GACommandStats, 1);
+        g_hash_table_insert(s->stats.commands, g_strdup(name), cs);
+    }
+    cs->calls++;
+    cs->errors += error;
+    cs->total_time += time;
+    cs->max_time = MAX(cs->max_time, time);
+    cs->histogram[MIN(bucket, GA_STATS_BUCKETS - 1)]++;
+}
+
+GuestAgentStats *ga_get_agent_stats(GAState *s, bool reset)
+{
+    GuestAgentStats *stats = g_new0(GuestAgentStats, 1);
+    GuestCommandStatsList **link = &stats->commands, *entry;
+    GuestCommandStats *info;
+    GACommandStats *cs;
+    GHashTableIter iter;
+    gpointer key, value;
+    intList **bucket;
+    int64_t now = g_get_monotonic_time();
+    int i;
+
+    stats->elapsed = (now - s->stats.start) / 1000;
+    stats->bytes_in = s->stats.bytes_in;
+    stats->bytes_out = s->stats.bytes_out;
+    stats->parse_errors = s->stats.parse_errors;
+    if (s->arena) {
+        stats->has_arena_allocations = true;
+        stats->arena_allocations = qemu_arena_get_allocs(s->arena) -
+                                   s->stats.arena_allocs;
+    }
+
+    g_hash_table_iter_init(&iter, s->stats.commands);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        cs = value;
+        info = g_new0(GuestCommandStats, 1);
+        info->name = g_strdup(key);
+        info->calls = cs->calls;
+        info->errors = cs->errors;
+        info->total_time = cs->total_time;
+        info->max_time = cs->max_time;
+        bucket = &info->histogram;
+        for (i = 0; i < GA_STATS_BUCKETS; i++) {
+            *bucket = g_new0(intList, 1);
+            (*bucket)->value = cs->histogram[i];
+            bucket = &(*bucket)->next;
+        }
+
+        entry = g_new0(GuestCommandStatsList, 1);
+        entry->value = info;
+        *link = entry;
+        link = &entry->next;
+    }
+
+    if (reset) {
+        g_hash_table_remove_all(s->stats.commands);
+        s->stats.start = now;
+        s->stats.bytes_in = 0;
+        s->stats.bytes_out = 0;
+        s->stats.parse_errors = 0;
+        if (s->arena) {
+            s->stats.arena_allocs = qemu_arena_get_allocs(s->arena);
+        }
+    }
 
-    g_assert(payload && s->channel);
+    return stats;
+}
+
+/*
+ * Responses are serialized into a chain of fixed-size chunks and go out
+ * with writev(), the guest-sync-delimited sentinel and the final newline
+ * as separate elements, so that even a large response is held in memory
+ * only once and never copied around.
+ */
+#define GA_RESPONSE_CHUNK_SIZE (64 * 1024)
+
+typedef struct GAResponse {
+    GPtrArray *chunks;
+    size_t used;            /* bytes used in the last chunk */
+    size_t len;
+} GAResponse;
+
+static void ga_response_emit(void *opaque, const char *buf, size_t len)
+{
+    GAResponse *r = opaque;
+    gchar *chunk;
+    size_t n;
+
+    while (len) {
+        if (r->used == GA_RESPONSE_CHUNK_SIZE) {
+            g_ptr_array_add(r->chunks, g_malloc(GA_RESPONSE_CHUNK_SIZE));
+            r->used = 0;
+        }
+        chunk = g_ptr_array_index(r->chunks, r->chunks->len - 1);
+        n = MIN(len, GA_RESPONSE_CHUNK_SIZE - r->used);
+        memcpy(chunk + r->used, buf, n);
+        r->used += n;
+        r->len += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+static size_t ga_response_chunk_len(GAResponse *r, guint i)
+{
+    return MIN(r->len - (size_t)i * GA_RESPONSE_CHUNK_SIZE,
+               GA_RESPONSE_CHUNK_SIZE);
+}
+
+/*
+ * Compressed responses are sent as a marker byte, the big-endian 32-bit
+ * lengths of the compressed and of the original data, and a zlib stream of
+ * the JSON text including its newline. A guest-sync-delimited sentinel
+ * stays in front of the frame. Returns NULL if compression would not make
+ * the response any smaller.
+ */
+#define GA_COMPRESSED_HDR_SIZE 9
+
+static gchar *ga_compress_response(GASession *ss, GAResponse *r,
+                                   gsize *frame_len)
+{
+    gsize len = r->len + 1;
+    z_stream zs = { 0 };
+    uLong zlen;
+    gchar *frame;
+    guint i;
+    int ret;
 
-    payload_qstr = qobject_to_json(payload);
-    if (!payload_qstr) {
-        return -EINVAL;
+    if (deflateInit(&zs, ss->compress_level) != Z_OK) {
+        return NULL;
+    }
+    zlen = deflateBound(&zs, len);
+    frame = g_malloc(GA_COMPRESSED_HDR_SIZE + zlen);
+    zs.next_out = (Bytef *)frame + GA_COMPRESSED_HDR_SIZE;
+    zs.avail_out = zlen;
+    for (i = 0; i < r->chunks->len; i++) {
+        zs.next_in = g_ptr_array_index(r->chunks, i);
+        zs.avail_in = ga_response_chunk_len(r, i);
+        deflate(&zs, Z_NO_FLUSH);
+    }
+    zs.next_in = (Bytef *)"\n";
+    zs.avail_in = 1;
+    ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END ||
+        zs.total_out + GA_COMPRESSED_HDR_SIZE >= len) {
+        g_free(frame);
+        return NULL;
     }
 
-    if (s->delimit_response) {
-        s->delimit_response = false;
-        response_qstr = qstring_new();
-        qstring_append_chr(response_qstr, QGA_SENTINEL_BYTE);
-        qstring_append(response_qstr, qstring_get_str(payload_qstr));
-        QDECREF(payload_qstr);
+    frame[0] = QGA_COMPRESSED_BYTE;
+    stl_be_p(frame + 1, zs.total_out);
+    stl_be_p(frame + 5, len);
+    *frame_len = GA_COMPRESSED_HDR_SIZE + zs.total_out;
+    return frame;
+}
+
+static int send_response(GASession *ss, QObject *payload)
+{
+    gchar sentinel = QGA_SENTINEL_BYTE;
+    GAResponse r;
+    struct iovec *iov;
+    unsigned int iovcnt = 0;
+    GIOStatus status;
+    gchar *frame = NULL;
+    gsize frame_len;
+    GByteArray *held;
+    guint i;
+
+    g_assert(payload && ss->client);
+
+    r.chunks = g_ptr_array_new_with_free_func(g_free);
+    r.used = GA_RESPONSE_CHUNK_SIZE;
+    r.len = 0;
+    qobject_to_json_emit(payload, ga_response_emit, &r);
+
+    iov = g_new(struct iovec, r.chunks->len + 2);
+    if (ss->delimit_response) {
+        ss->delimit_response = false;
+        iov[iovcnt].iov_base = &sentinel;
+        iov[iovcnt++].iov_len = 1;
+    }
+    if (ss->compress_threshold && r.len + 1 >= ss->compress_threshold) {
+        frame = ga_compress_response(ss, &r, &frame_len);
+    }
+    if (frame) {
+        iov[iovcnt].iov_base = frame;
+        iov[iovcnt++].iov_len = frame_len;
     } else {
-        response_qstr = payload_qstr;
+        for (i = 0; i < r.chunks->len; i++) {
+            iov[iovcnt].iov_base = g_ptr_array_index(r.chunks, i);
+            iov[iovcnt++].iov_len = ga_response_chunk_len(&r, i);
+        }
+        iov[iovcnt].iov_base = (char *)"\n";
+        iov[iovcnt++].iov_len = 1;
     }
 
-    qstring_append_chr(response_qstr, '\n');
-    buf = qstring_get_str(response_qstr);
-    status = ga_channel_write_all(s->channel, buf, strlen(buf));
-    QDECREF(response_qstr);
+    for (i = 0; i < iovcnt; i++) {
+        ss->s->stats.bytes_out += iov[i].iov_len;
+    }
+    if (ss->sending) {
+        /* copied, as @payload may live in the dispatch arena */
+        held = g_byte_array_new();
+        for (i = 0; i < iovcnt; i++) {
+            g_byte_array_append(held, iov[i].iov_base, iov[i].iov_len);
+        }
+        g_queue_push_tail(&ss->pending_output, held);
+        status = G_IO_STATUS_NORMAL;
+    } else {
+        status = ga_channel_writev_all(ss->client, iov, iovcnt);
+    }
+    g_free(iov);
+    g_free(frame);
+    g_ptr_array_free(r.chunks, true);
     if (status != G_IO_STATUS_NORMAL) {
         return -EIO;
     }
@@ -556,37 +865,811 @@ static int send_response(GAState *s, QObject *payload)
     return 0;
 }
 
-static void process_command(GAState *s, QDict *req)
+/* send a response, tagged with the id of the request it answers, if any */
+static void send_tagged_response(GASession *ss, QObject *rsp, QObject *id)
 {
-    QObject *rsp = NULL;
     int ret;
 
+    if (id) {
+        qobject_incref(id);
+        qdict_put_obj(qobject_to_qdict(rsp), "id", id);
+    }
+    ret = send_response(ss, rsp);
+    if (ret) {
+        g_warning("error sending response: %s", strerror(-ret));
+    }
+}
+
+/*
+ * QAPI events are written to the channel like responses, to every client.
+ * They must be sent from the main loop, so that they never end up in the
+ * middle of one.
+ */
+static void ga_event_emit(unsigned event, QDict *qdict, Error **errp)
+{
+    GAState *s = ga_state;
+    GList *l;
+    int ret;
+
+    for (l = s->sessions; l; l = l->next) {
+        ret = send_response(l->data, QOBJECT(qdict));
+        if (ret) {
+            g_debug("error sending event: %s", strerror(-ret));
+        }
+    }
+}
+
+/*
+ * Binary transfer mode. guest-file-read-raw and guest-file-write-raw move
+ * file data as length-prefixed frames right after the JSON response or
+ * request, so bulk transfers need neither base64 nor a buffer the size of
+ * the transfer. While a transfer is in flight the channel carries nothing
+ * else: file data is sent from the main loop as the channel drains, and
+ * responses, events and further requests of that client wait for it.
+ */
+#define GA_BULK_FRAME_HDR_SIZE 4
+
+void ga_set_binary_transfer(GAState *s, bool enable, size_t chunk_size)
+{
+    g_assert(s->current);
+    s->current->binary_transfer = enable;
+    s->current->chunk_size = chunk_size;
+}
+
+bool ga_binary_transfer_enabled(GAState *s)
+{
+    return s->current && s->current->binary_transfer;
+}
+
+/* compress responses of at least @threshold bytes, 0 turns it off */
+void ga_set_compression(GAState *s, size_t threshold, int level)
+{
+    g_assert(s->current);
+    s->current->compress_threshold = threshold;
+    s->current->compress_level = level;
+}
+
+/* stream @count bytes of @fd after the response to the current request */
+void ga_bulk_send(GAState *s, int fd, int64_t offset, int64_t count)
+{
+    GABulkTransfer *b = &s->current->bulk;
+
+    g_assert(b->dir == GA_BULK_NONE);
+    b->dir = GA_BULK_SEND;
+    b->fd = fd;
+    b->offset = offset;
+    b->count = count;
+}
+
+/* write the data following the current request to @fd */
+void ga_bulk_receive(GAState *s, int fd, int64_t offset)
+{
+    GABulkTransfer *b = &s->current->bulk;
+
+    g_assert(b->dir == GA_BULK_RECEIVE && b->fd == -1);
+    b->fd = fd;
+    b->offset = offset;
+}
+
+static void ga_bulk_reset(GASession *ss)
+{
+    GABulkTransfer *b = &ss->bulk;
+
+    if (b->dir != GA_BULK_NONE && b->fd != -1) {
+        close(b->fd);
+    }
+    qobject_decref(b->rsp);
+    qobject_decref(b->id);
+    memset(b, 0, sizeof(*b));
+}
+
+#ifndef _WIN32
+static void ga_channel_feed(GASession *ss, const gchar *buf, size_t size);
+
+/* pass on what was held back during a transfer */
+static void ga_session_resume(GASession *ss)
+{
+    GByteArray *data;
+
+    while ((data = g_queue_pop_head(&ss->pending_output))) {
+        if (ga_channel_write_all(ss->client, (gchar *)data->data,
+                                 data->len) != G_IO_STATUS_NORMAL) {
+            g_warning("error sending response");
+        }
+        g_byte_array_free(data, true);
+    }
+    data = ss->pending_input;
+    ss->pending_input = NULL;
+    if (data) {
+        ga_channel_feed(ss, (gchar *)data->data, data->len);
+        g_byte_array_free(data, true);
+    }
+}
+
+static const gchar ga_bulk_zeroes[4096];
+
+/* send a frame of file data, or what the channel takes of it */
+static GIOStatus ga_bulk_send_data(GASession *ss)
+{
+    GABulkTransfer *b = &ss->bulk;
+    GIOStatus status;
+    gsize len, sent;
+
+    if (b->frame_hdr_len == GA_BULK_FRAME_HDR_SIZE && !b->frame_left) {
+        /* start the next frame, one of length 0 ends the transfer */
+        b->frame_left = MIN(b->count - b->done, ss->chunk_size);
+        stl_be_p(b->frame_hdr, b->frame_left);
+        b->frame_hdr_len = 0;
+        b->last = !b->frame_left;
+    }
+    if (b->frame_hdr_len < GA_BULK_FRAME_HDR_SIZE) {
+        len = GA_BULK_FRAME_HDR_SIZE - b->frame_hdr_len;
+        status = ga_channel_write_some(ss->client, (gchar *)b->frame_hdr +
+                                       b->frame_hdr_len, len, &sent);
+        b->frame_hdr_len += sent;
+        ss->s->stats.bytes_out += sent;
+        return status;
+    }
+
+    if (!b->padding) {
+        status = ga_channel_write_file(ss->client, b->fd, b->offset + b->done,
+                                       b->frame_left, &sent);
+        if (status == G_IO_STATUS_EOF) {
+            /* the file shrank, but the frame length has been sent already */
+            b->padding = true;
+            status = G_IO_STATUS_NORMAL;
+        }
+    } else {
+        status = ga_channel_write_some(ss->client, ga_bulk_zeroes,
+                                       MIN(b->frame_left,
+                                           sizeof(ga_bulk_zeroes)),
+                                       &sent);
+    }
+    b->done += sent;
+    b->frame_left -= sent;
+    ss->s->stats.bytes_out += sent;
+
+    return status;
+}
+
+/*
+ * Called from the main loop while the channel can take more data. A frame
+ * at a time goes out, so that other clients are served in between.
+ */
+static gboolean ga_bulk_send_event(GIOCondition condition, gpointer opaque)
+{
+    GASession *ss = opaque;
+    GABulkTransfer *b = &ss->bulk;
+    GIOStatus status = G_IO_STATUS_ERROR;
+
+    if (!(condition & (G_IO_HUP | G_IO_ERR))) {
+        do {
+            status = ga_bulk_send_data(ss);
+        } while (status == G_IO_STATUS_NORMAL &&
+                 (b->frame_hdr_len < GA_BULK_FRAME_HDR_SIZE || b->frame_left));
+    }
+    if (status == G_IO_STATUS_AGAIN ||
+        (status == G_IO_STATUS_NORMAL && !b->last)) {
+        return true;
+    }
+
+    if (status != G_IO_STATUS_NORMAL) {
+        g_warning("error sending file data");
+    }
+    ga_bulk_reset(ss);
+    ss->sending = false;
+    ga_session_resume(ss);
+    /* a request held back may have started another transfer */
+    return ss->sending;
+}
+#endif
+
+/* start sending the data of a raw read, its response has gone out */
+static void ga_bulk_start_send(GASession *ss)
+{
+    GABulkTransfer *b = &ss->bulk;
+
+    if (b->dir != GA_BULK_SEND) {
+        return;
+    }
+#ifndef _WIN32
+    b->frame_hdr_len = GA_BULK_FRAME_HDR_SIZE;
+    ss->sending = true;
+    ga_channel_client_write_watch(ss->client, ga_bulk_send_event, ss);
+#else
+    ga_bulk_reset(ss);
+#endif
+}
+
+/*
+ * The data frames of a raw write follow the request whether or not the
+ * command succeeds, so they are consumed even if it fails before it gets
+ * to call ga_bulk_receive().
+ */
+static void ga_bulk_begin_receive(GASession *ss, QObject *id)
+{
+    GABulkTransfer *b = &ss->bulk;
+
+    g_assert(b->dir == GA_BULK_NONE);
+    b->dir = GA_BULK_RECEIVE;
+    b->fd = -1;
+    b->id = id;
+    qobject_incref(id);
+}
+
+/* keep the response to a raw write until its data has been written */
+static bool ga_bulk_hold_response(GASession *ss, QObject *rsp)
+{
+    GABulkTransfer *b = &ss->bulk;
+    QemuArena *arena;
+    QString *json;
+
+    if (b->dir != GA_BULK_RECEIVE) {
+        return false;
+    }
+    /* copied to the heap, as @rsp may go away with the dispatch arena */
+    arena = qemu_arena_set_current(NULL);
+    json = qobject_to_json(rsp);
+    b->rsp = qobject_from_json(qstring_get_str(json));
+    QDECREF(json);
+    qemu_arena_set_current(arena);
+    return true;
+}
+
+static void ga_bulk_receive_done(GASession *ss)
+{
+    GABulkTransfer *b = &ss->bulk;
+    QDict *rsp = qobject_to_qdict(b->rsp);
+    Error *err = NULL;
+
+    if (rsp && qdict_haskey(rsp, "return")) {
+        if (b->err) {
+            error_setg_errno(&err, b->err, "failed to write to file");
+            rsp = qdict_new();
+            qdict_put_obj(rsp, "error", qmp_build_error_object(err));
+            error_free(err);
+            qobject_decref(b->rsp);
+            b->rsp = QOBJECT(rsp);
+        } else {
+            qdict_put(qdict_get_qdict(rsp, "return"), "count",
+                      qint_from_int(b->done));
+        }
+    }
+    if (b->rsp) {
+        send_tagged_response(ss, b->rsp, b->id);
+    }
+    ga_bulk_reset(ss);
+}
+
+/* consume frame data of a raw write, returns the number of bytes used */
+static size_t ga_bulk_receive_data(GASession *ss, const gchar *buf,
+                                   size_t size)
+{
+    GABulkTransfer *b = &ss->bulk;
+    size_t len, left;
+    ssize_t ret;
+
+    if (b->frame_hdr_len < GA_BULK_FRAME_HDR_SIZE) {
+        len = MIN(size, GA_BULK_FRAME_HDR_SIZE - b->frame_hdr_len);
+        memcpy(b->frame_hdr + b->frame_hdr_len, buf, len);
+        b->frame_hdr_len += len;
+        if (b->frame_hdr_len == GA_BULK_FRAME_HDR_SIZE) {
+            b->frame_left = ldl_be_p(b->frame_hdr);
+            if (!b->frame_left) {
+                ga_bulk_receive_done(ss);
+            }
+        }
+        return len;
+    }
+
+    len = MIN(size, b->frame_left);
+    b->frame_left -= len;
+    if (!b->frame_left) {
+        b->frame_hdr_len = 0;
+    }
+
+    for (left = len; left && b->fd != -1 && !b->err; ) {
+#ifndef _WIN32
+        ret = pwrite(b->fd, buf, left, b->offset + b->done);
+#else
+        ret = -1;
+        errno = ENOSYS;
+#endif
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            b->err = ret ? errno : EIO;
+            break;
+        }
+        buf += ret;
+        left -= ret;
+        b->done += ret;
+    }
+
+    return len;
+}
+
+/*
+ * Length of @buf up to and including the end of the request it carries, or
+ * @size if the request goes on. Only nesting and quoting are tracked, which
+ * is all it takes to find the bracket that closes a top-level value.
+ */
+static size_t ga_request_scan(GASession *ss, const gchar *buf, size_t size)
+{
+    size_t i;
+    char c;
+
+    for (i = 0; i < size; i++) {
+        c = buf[i];
+        if ((unsigned char)c == 0xff) {
+            /* resets the lexer, see guest-sync-delimited */
+            ss->scan_depth = 0;
+            ss->scan_quote = 0;
+            ss->scan_escape = false;
+        } else if (ss->scan_quote) {
+            if (ss->scan_escape) {
+                ss->scan_escape = false;
+            } else if (c == '\\') {
+                ss->scan_escape = true;
+            } else if (c == ss->scan_quote) {
+                ss->scan_quote = 0;
+            }
+        } else if (c == '"' || c == '\'') {
+            ss->scan_quote = c;
+        } else if (c == '{' || c == '[') {
+            ss->scan_depth++;
+        } else if ((c == '}' || c == ']') && ss->scan_depth &&
+                   !--ss->scan_depth) {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+/* hand data read from the channel to the JSON parser or a raw write */
+static void ga_channel_feed(GASession *ss, const gchar *buf, size_t size)
+{
+    size_t len;
+
+    while (size) {
+        if (ss->sending) {
+            /* the rest waits for the file data to go out */
+            if (!ss->pending_input) {
+                ss->pending_input = g_byte_array_new();
+            }
+            g_byte_array_append(ss->pending_input, (guint8 *)buf, size);
+            return;
+        }
+        if (ss->bulk.dir == GA_BULK_RECEIVE) {
+            len = ga_bulk_receive_data(ss, buf, size);
+        } else {
+            /*
+             * The data of a raw write starts right after the request, so
+             * the parser is fed no further than the end of each request
+             */
+            len = ga_request_scan(ss, buf, size);
+            json_message_parser_feed(&ss->parser, buf, len);
+        }
+        buf += len;
+        size -= len;
+    }
+}
+
+/*
+ * In async mode, commands marked 'blocking' in the schema are run by a
+ * bounded pool of worker threads so that a slow disk or a hung network
+ * mount cannot stall guest-ping and guest-sync. Responses go out from the
+ * main loop in completion order, tagged with the request id. fsfreeze
+ * stays synchronous: it changes the agent's state (enabled commands,
+ * logging, the frozen flag), which only the main loop may touch.
+ */
+typedef enum GAJobState {
+    GA_JOB_QUEUED,
+    GA_JOB_RUNNING,
+    GA_JOB_CANCELLED,
+} GAJobState;
+
+static void ga_session_unref(GASession *ss)
+{
+    if (--ss->refcnt == 0) {
+        g_free(ss);
+    }
+}
+
+typedef struct GABatch GABatch;
+
+typedef struct GAJob {
+    GAState *s;
+    GASession *session;     /* where the response goes */
+    unsigned int generation;    /* of the session at submission */
+    GABatch *batch;         /* that takes the response, if any */
+    QDict *req;
+    QObject *id;
+    QObject *rsp;
+    gchar *command;
+    int state;              /* GAJobState, shared with the worker */
+    int64_t time;           /* execution time, us */
+    guint timeout_id;
+    bool timed_out;
+    bool wedged;            /* timed out while holding a worker */
+} GAJob;
+
+static void ga_job_free(GAJob *job)
+{
+    QDECREF(job->req);
+    qobject_decref(job->id);
+    qobject_decref(job->rsp);
+    g_free(job->command);
+    ga_session_unref(job->session);
+    g_free(job);
+}
+
+/* send a response that was not ready when the request was processed */
+static void ga_send_late_response(GASession *ss, unsigned int generation,
+                                  QObject *rsp, QObject *id)
+{
+    bool delimit = ss->delimit_response;
+
+    if (!ss->client || generation != ss->generation) {
+        /* the client that sent the request is gone */
+        return;
+    }
+
+    /* a pending guest-sync-delimited response keeps its sentinel */
+    ss->delimit_response = false;
+    send_tagged_response(ss, rsp, id);
+    ss->delimit_response = delimit;
+}
+
+static void ga_job_send_response(GAJob *job, QObject *rsp)
+{
+    ga_send_late_response(job->session, job->generation, rsp, job->id);
+}
+
+static void ga_batch_resume(GABatch *b, QObject *rsp);
+
+/*
+ * A worker stuck in a command that timed out is replaced, so that the
+ * pool keeps its size, until it has grown to twice the configured size.
+ * From then on blocking commands fail right away instead of queueing
+ * behind workers that may never be free again.
+ */
+static void ga_workers_wedged(GAState *s, int n)
+{
+    s->wedged_workers += n;
+    g_thread_pool_set_max_threads(s->workers, s->max_workers +
+                                  MIN(s->wedged_workers, s->max_workers),
+                                  NULL);
+}
+
+static bool ga_workers_available(GAState *s, Error **errp)
+{
+    if (s->wedged_workers >= 2 * s->max_workers) {
+        error_setg(errp, "all %d worker threads are stuck in commands that "
+                   "timed out", s->wedged_workers);
+        return false;
+    }
+    return true;
+}
+
+/* called from the main loop once the worker is done with the job */
+static gboolean ga_job_complete(gpointer opaque)
+{
+    GAJob *job = opaque;
+
+    if (job->timeout_id) {
+        g_source_remove(job->timeout_id);
+    }
+    if (job->wedged) {
+        ga_workers_wedged(job->s, -1);
+    }
+    if (atomic_read(&job->state) == GA_JOB_RUNNING) {
+        ga_stats_record(job->s, job->command, job->time,
+                        job->timed_out || ga_is_error_response(job->rsp));
+    }
+    if (job->batch) {
+        ga_batch_resume(job->batch, job->rsp);
+    } else if (!job->timed_out && job->rsp) {
+        ga_job_send_response(job, job->rsp);
+    }
+    ga_job_free(job);
+
+    return false;
+}
+
+static gboolean ga_job_timeout(gpointer opaque)
+{
+    GAJob *job = opaque;
+    Error *err = NULL;
+    QDict *rsp;
+
+    job->timeout_id = 0;
+    job->timed_out = true;
+    /* if it is still queued behind other jobs, don't start it at all */
+    if (atomic_cmpxchg(&job->state, GA_JOB_QUEUED, GA_JOB_CANCELLED) ==
+        GA_JOB_RUNNING) {
+        job->wedged = true;
+        ga_workers_wedged(job->s, 1);
+    }
+
+    error_setg(&err, "command %s timed out after %d seconds",
+               job->command, job->s->command_timeout);
+    rsp = qdict_new();
+    qdict_put_obj(rsp, "error", qmp_build_error_object(err));
+    error_free(err);
+    if (job->batch) {
+        /* the batch goes on without waiting for the worker */
+        ga_batch_resume(job->batch, QOBJECT(rsp));
+        job->batch = NULL;
+    } else {
+        ga_job_send_response(job, QOBJECT(rsp));
+    }
+    QDECREF(rsp);
+
+    return false;
+}
+
+/* runs in a worker thread */
+static void ga_job_run(gpointer data, gpointer unused)
+{
+    GAJob *job = data;
+    int64_t start;
+
+    if (atomic_cmpxchg(&job->state, GA_JOB_QUEUED, GA_JOB_RUNNING) ==
+        GA_JOB_QUEUED) {
+        start = g_get_monotonic_time();
+        job->rsp = qmp_dispatch(QOBJECT(job->req));
+        job->time = g_get_monotonic_time() - start;
+    }
+    g_idle_add(ga_job_complete, job);
+}
+
+static GAJob *ga_job_submit(GASession *ss, QDict *req, QObject *id,
+                            const char *command)
+{
+    GAState *s = ss->s;
+    GAJob *job = g_new0(GAJob, 1);
+
+    job->s = s;
+    job->session = ss;
+    job->generation = ss->generation;
+    ss->refcnt++;
+    job->req = req;
+    QINCREF(req);
+    job->id = id;
+    qobject_incref(id);
+    job->command = g_strdup(command);
+    job->state = GA_JOB_QUEUED;
+    if (s->command_timeout > 0) {
+        job->timeout_id = g_timeout_add_seconds(s->command_timeout,
+                                                ga_job_timeout, job);
+    }
+
+    g_debug("queueing blocking command %s", command);
+    g_thread_pool_push(s->workers, job, NULL);
+    return job;
+}
+
+/*
+ * A guest-batch with blocking commands, in async mode. Its commands still
+ * run in order, but the blocking ones go to the worker pool like
+ * standalone requests, and the main loop carries on meanwhile. The rest
+ * run on the main loop in between, and the response goes out once the
+ * last command is done.
+ */
+struct GABatch {
+    GASession *session;
+    unsigned int generation;    /* of the session at submission */
+    QObject *id;
+    QList *commands;            /* yet to run */
+    QList *results;             /* responses of those that ran */
+    int64_t start;
+};
+
+/* whether @req is a guest-batch request that has blocking commands */
+static bool ga_batch_is_blocking(QDict *req)
+{
+    QObject *args = qdict_get(req, "arguments");
+    QObject *commands;
+    const QListEntry *entry;
+    const char *command;
+    QmpCommand *cmd;
+
+    /* anything unusual is left to qmp_dispatch() to reject */
+    if (qdict_size(req) != 2 || !args || qobject_type(args) != QTYPE_QDICT ||
+        qdict_size(qobject_to_qdict(args)) != 1) {
+        return false;
+    }
+    commands = qdict_get(qobject_to_qdict(args), "commands");
+    if (!commands || qobject_type(commands) != QTYPE_QLIST) {
+        return false;
+    }
+
+    QLIST_FOREACH_ENTRY(qobject_to_qlist(commands), entry) {
+        if (qobject_type(entry->value) != QTYPE_QDICT) {
+            continue;
+        }
+        command = qdict_get_try_str(qobject_to_qdict(entry->value),
+                                    "execute");
+        cmd = command ? qmp_find_command(command) : NULL;
+        if (cmd && qmp_command_is_blocking(cmd) &&
+            qmp_command_is_enabled(cmd) && ga_batch_allowed(command, NULL)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void ga_batch_free(GABatch *b)
+{
+    qobject_decref(b->id);
+    QDECREF(b->commands);
+    QDECREF(b->results);
+    ga_session_unref(b->session);
+    g_free(b);
+}
+
+/* run commands up to the next blocking one, or until the batch is done */
+static void ga_batch_step(GABatch *b)
+{
+    GASession *ss = b->session;
+    GAState *s = ss->s;
+    const char *command;
+    Error *err = NULL;
+    QObject *req, *rsp;
+    QmpCommand *cmd;
+    QDict *dict;
+    bool blocking;
+
+    while (!qlist_empty(b->commands)) {
+        if (!ss->client || b->generation != ss->generation) {
+            /* nobody is waiting for the rest */
+            ga_batch_free(b);
+            return;
+        }
+
+        req = qlist_pop(b->commands);
+        dict = qobject_to_qdict(req);
+        command = dict ? qdict_get_try_str(dict, "execute") : NULL;
+        cmd = command ? qmp_find_command(command) : NULL;
+        blocking = cmd && qmp_command_is_blocking(cmd) &&
+                   qmp_command_is_enabled(cmd);
+        if (!ga_batch_allowed(command, &err) ||
+            (blocking && !ga_workers_available(s, &err))) {
+            rsp = QOBJECT(qdict_new());
+            qdict_put_obj(qobject_to_qdict(rsp), "error",
+                          qmp_build_error_object(err));
+            error_free(err);
+            err = NULL;
+        } else if (blocking) {
+            ga_job_submit(ss, dict, NULL, command)->batch = b;
+            qobject_decref(req);
+            return;
+        } else {
+            s->current = ss;
+            rsp = qmp_dispatch(req);
+            s->current = NULL;
+        }
+        qobject_decref(req);
+        /* a command without a success response has an empty entry */
+        qlist_append_obj(b->results, rsp ?: QOBJECT(qdict_new()));
+    }
+
+    rsp = QOBJECT(qdict_new());
+    qdict_put_obj(qobject_to_qdict(rsp), "return", QOBJECT(b->results));
+    b->results = NULL;
+    ga_stats_record(s, "guest-batch", g_get_monotonic_time() - b->start,
+                    false);
+    ga_send_late_response(ss, b->generation, rsp, b->id);
+    qobject_decref(rsp);
+    ga_batch_free(b);
+}
+
+static void ga_batch_start(GASession *ss, QDict *req, QObject *id)
+{
+    GABatch *b = g_new0(GABatch, 1);
+    QDict *args = qdict_get_qdict(req, "arguments");
+
+    b->session = ss;
+    b->generation = ss->generation;
+    ss->refcnt++;
+    b->id = id;
+    qobject_incref(id);
+    b->commands = qlist_copy(qdict_get_qlist(args, "commands"));
+    b->results = qlist_new();
+    b->start = g_get_monotonic_time();
+    ga_batch_step(b);
+}
+
+/* called from the main loop with the response of a blocking command */
+static void ga_batch_resume(GABatch *b, QObject *rsp)
+{
+    qobject_incref(rsp);
+    qlist_append_obj(b->results, rsp ?: QOBJECT(qdict_new()));
+    ga_batch_step(b);
+}
+
+static void process_command(GASession *ss, QDict *req)
+{
+    GAState *s = ss->s;
+    QObject *rsp = NULL, *id;
+    QmpCommand *cmd = NULL;
+    const char *command;
+    QemuArena *arena;
+    Error *err = NULL;
+    int64_t start;
+
     g_assert(req);
     g_debug("processing command");
-    rsp = qmp_dispatch(QOBJECT(req));
-    if (rsp) {
-        ret = send_response(s, rsp);
-        if (ret) {
-            g_warning("error sending response: %s", strerror(ret));
+
+    /* the id is only echoed back, it is not part of the command itself */
+    id = qdict_get(req, "id");
+    qobject_incref(id);
+    qdict_del(req, "id");
+
+    command = qdict_get_try_str(req, "execute");
+    if (command) {
+        cmd = qmp_find_command(command);
+    }
+
+    if (ss->binary_transfer && !g_strcmp0(command, "guest-file-write-raw")) {
+        ga_bulk_begin_receive(ss, id);
+    }
+
+    if (s->workers && cmd && qmp_command_is_blocking(cmd) &&
+        qmp_command_is_enabled(cmd)) {
+        if (ga_workers_available(s, &err)) {
+            ga_job_submit(ss, req, id, command);
+        } else {
+            rsp = QOBJECT(qdict_new());
+            qdict_put_obj(qobject_to_qdict(rsp), "error",
+                          qmp_build_error_object(err));
+            error_free(err);
+            send_tagged_response(ss, rsp, id);
+            qobject_decref(rsp);
+        }
+    } else if (s->workers && cmd && qmp_command_is_enabled(cmd) &&
+               !strcmp(command, "guest-batch") && ga_batch_is_blocking(req)) {
+        ga_batch_start(ss, req, id);
+    } else {
+        arena = s->arena;
+        qemu_arena_set_current(arena);
+        /* session state commands act on the client that sent them */
+        s->current = ss;
+        start = g_get_monotonic_time();
+        rsp = qmp_dispatch(QOBJECT(req));
+        if (cmd) {
+            ga_stats_record(s, cmd->name, g_get_monotonic_time() - start,
+                            ga_is_error_response(rsp));
+        }
+        s->current = NULL;
+        if (rsp && !ga_bulk_hold_response(ss, rsp)) {
+            send_tagged_response(ss, rsp, id);
+            ga_bulk_start_send(ss);
         }
         qobject_decref(rsp);
+        if (arena) {
+            qemu_arena_set_current(NULL);
+            qemu_arena_reset(arena);
+        }
     }
+
+    qobject_decref(id);
 }
 
 /* handle requests/control events coming in over the channel */
-static void process_event(JSONMessageParser *parser, QList *tokens)
+static void process_event(JSONMessageParser *parser, QObject *obj, Error *err)
 {
-    GAState *s = container_of(parser, GAState, parser);
-    QObject *obj;
+    GASession *ss = container_of(parser, GASession, parser);
     QDict *qdict;
-    Error *err = NULL;
     int ret;
 
-    g_assert(s && parser);
+    g_assert(ss && parser);
 
     g_debug("process_event: called");
-    obj = json_parser_parse_err(tokens, NULL, &err);
     if (err || !obj || qobject_type(obj) != QTYPE_QDICT) {
+        ss->s->stats.parse_errors++;
         qobject_decref(obj);
         qdict = qdict_new();
         if (!err) {
@@ -605,7 +1688,7 @@ static void process_event(JSONMessageParser *parser, QList *tokens)
 
     /* handle host->guest commands */
     if (qdict_haskey(qdict, "execute")) {
-        process_command(s, qdict);
+        process_command(ss, qdict);
     } else {
         if (!qdict_haskey(qdict, "error")) {
             QDECREF(qdict);
@@ -615,7 +1698,7 @@ static void process_event(JSONMessageParser *parser, QList *tokens)
             qdict_put_obj(qdict, "error", qmp_build_error_object(err));
             error_free(err);
         }
-        ret = send_response(s, QOBJECT(qdict));
+        ret = send_response(ss, QOBJECT(qdict));
         if (ret < 0) {
             g_warning("error sending error response: %s", strerror(-ret));
         }
@@ -625,13 +1708,14 @@ static void process_event(JSONMessageParser *parser, QList *tokens)
 }
 
 /* false return signals GAChannel to close the current client connection */
-static gboolean channel_event_cb(GIOCondition condition, gpointer data)
+static gboolean channel_read_event(GASession *ss, GIOCondition condition)
 {
-    GAState *s = data;
-    gchar buf[QGA_READ_COUNT_DEFAULT+1];
+    GAState *s = ss->s;
+    gchar buf[QGA_READ_COUNT_DEFAULT];
     gsize count;
     GError *err = NULL;
-    GIOStatus status = ga_channel_read(s->channel, buf, QGA_READ_COUNT_DEFAULT, &count);
+    GIOStatus status = ga_channel_read(ss->client, buf, QGA_READ_COUNT_DEFAULT,
+                                       &count);
     if (err != NULL) {
         g_warning("error reading channel: %s", err->message);
         g_error_free(err);
@@ -639,26 +1723,25 @@ static gboolean channel_event_cb(GIOCondition condition, gpointer data)
     }
     switch (status) {
     case G_IO_STATUS_ERROR:
+        if (s->virtio && (condition & G_IO_HUP)) {
+            /* some ports fail reads rather than return EOF once hung up */
+            g_debug("channel hung up");
+            return true;
+        }
         g_warning("error reading channel");
         return false;
     case G_IO_STATUS_NORMAL:
-        buf[count] = 0;
-        g_debug("read data, count: %d, data: %s", (int)count, buf);
-        json_message_parser_feed(&s->parser, (char *)buf, (int)count);
+        s->stats.bytes_in += count;
+        g_debug("read data, count: %d", (int)count);
+        ga_channel_feed(ss, buf, count);
         break;
     case G_IO_STATUS_EOF:
         g_debug("received EOF");
-        if (!s->virtio) {
-            return false;
-        }
-        /* fall through */
-    case G_IO_STATUS_AGAIN:
-        /* virtio causes us to spin here when no process is attached to
-         * host-side chardev. sleep a bit to mitigate this
+        /* a virtio-serial port is at EOF while the host is disconnected,
+         * the channel waits for it to reconnect
          */
-        if (s->virtio) {
-            usleep(100*1000);
-        }
+        return s->virtio;
+    case G_IO_STATUS_AGAIN:
         return true;
     default:
         g_warning("unknown channel read status, closing");
@@ -667,6 +1750,78 @@ static gboolean channel_event_cb(GIOCondition condition, gpointer data)
     return true;
 }
 
+static gpointer channel_accept_cb(GAChannelClient *client, gpointer opaque)
+{
+    GAState *s = opaque;
+    GASession *ss = g_new0(GASession, 1);
+
+    ss->s = s;
+    ss->client = client;
+    ss->refcnt = 1;
+    json_message_parser_init_direct(&ss->parser, process_event);
+    s->sessions = g_list_prepend(s->sessions, ss);
+    g_debug("client connected, %u sessions", g_list_length(s->sessions));
+
+    return ss;
+}
+
+/*
+ * Return a session to the state of a new connection. Responses still owed
+ * to the client are dropped, so a virtio-serial host that reconnects sees
+ * nothing of its predecessor's session.
+ */
+static void ga_session_reset(GASession *ss)
+{
+    GByteArray *data;
+
+    ga_bulk_reset(ss);
+    ss->sending = false;
+    while ((data = g_queue_pop_head(&ss->pending_output))) {
+        g_byte_array_free(data, true);
+    }
+    if (ss->pending_input) {
+        g_byte_array_free(ss->pending_input, true);
+        ss->pending_input = NULL;
+    }
+    json_message_parser_destroy(&ss->parser);
+    json_message_parser_init_direct(&ss->parser, process_event);
+    ss->scan_depth = 0;
+    ss->scan_quote = 0;
+    ss->scan_escape = false;
+    ss->delimit_response = false;
+    ss->binary_transfer = false;
+    ss->chunk_size = 0;
+    ss->compress_threshold = 0;
+    ss->compress_level = 0;
+    ss->generation++;
+}
+
+static void ga_session_close(GASession *ss)
+{
+    GAState *s = ss->s;
+
+    ga_session_reset(ss);
+    json_message_parser_destroy(&ss->parser);
+    ss->client = NULL;
+    s->sessions = g_list_remove(s->sessions, ss);
+    ga_session_unref(ss);
+}
+
+static gboolean channel_event_cb(GIOCondition condition, gpointer data)
+{
+    GASession *ss = data;
+
+    if (!channel_read_event(ss, condition)) {
+        ga_session_close(ss);
+        return false;
+    }
+    if (ss->s->virtio && (condition & G_IO_HUP)) {
+        /* the host went away, whoever connects next is a new client */
+        ga_session_reset(ss);
+    }
+    return true;
+}
+
 static gboolean channel_init(GAState *s, const gchar *method, const gchar *path)
 {
     GAChannelMethod channel_method;
@@ -683,7 +1838,8 @@ static gboolean channel_init(GAState *s, const gchar *method, const gchar *path)
         return false;
     }
 
-    s->channel = ga_channel_new(channel_method, path, channel_event_cb, s);
+    s->channel = ga_channel_new(channel_method, path, s->max_connections,
+                                channel_accept_cb, channel_event_cb, s);
     if (!s->channel) {
         g_critical("failed to create guest agent channel");
         return false;
@@ -949,6 +2105,14 @@ typedef struct GAConfig {
     int daemonize;
     GLogLevelFlags log_level;
     int dumpconf;
+    int metrics_interval;
+    int memory_threshold;
+    int disk_threshold;
+    int oom_events;
+    int async_workers;
+    int command_timeout;
+    int max_connections;
+    int dispatch_arena;
 } GAConfig;
 
 static void config_load(GAConfig *config)
@@ -1004,6 +2168,44 @@ static void config_load(GAConfig *config)
         config->blacklist = g_list_concat(config->blacklist,
                                           split_list(config->bliststr, ","));
     }
+    if (g_key_file_has_key(keyfile, "general", "metrics-interval", NULL)) {
+        config->metrics_interval =
+            g_key_file_get_integer(keyfile, "general", "metrics-interval",
+                                   &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "memory-threshold", NULL)) {
+        config->memory_threshold =
+            g_key_file_get_integer(keyfile, "general", "memory-threshold",
+                                   &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "disk-threshold", NULL)) {
+        config->disk_threshold =
+            g_key_file_get_integer(keyfile, "general", "disk-threshold",
+                                   &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "oom-events", NULL)) {
+        config->oom_events =
+            g_key_file_get_boolean(keyfile, "general", "oom-events", &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "async-workers", NULL)) {
+        config->async_workers =
+            g_key_file_get_integer(keyfile, "general", "async-workers", &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "command-timeout", NULL)) {
+        config->command_timeout =
+            g_key_file_get_integer(keyfile, "general", "command-timeout",
+                                   &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "max-connections", NULL)) {
+        config->max_connections =
+            g_key_file_get_integer(keyfile, "general", "max-connections",
+                                   &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "dispatch-arena", NULL)) {
+        config->dispatch_arena =
+            g_key_file_get_boolean(keyfile, "general", "dispatch-arena",
+                                   &gerr);
+    }
 
 end:
     g_key_file_free(keyfile);
@@ -1060,6 +2262,22 @@ static void config_dump(GAConfig *config)
     tmp = list_join(config->blacklist, ',');
     g_key_file_set_string(keyfile, "general", "blacklist", tmp);
     g_free(tmp);
+    g_key_file_set_integer(keyfile, "general", "metrics-interval",
+                           config->metrics_interval);
+    g_key_file_set_integer(keyfile, "general", "memory-threshold",
+                           config->memory_threshold);
+    g_key_file_set_integer(keyfile, "general", "disk-threshold",
+                           config->disk_threshold);
+    g_key_file_set_boolean(keyfile, "general", "oom-events",
+                           config->oom_events);
+    g_key_file_set_integer(keyfile, "general", "async-workers",
+                           config->async_workers);
+    g_key_file_set_integer(keyfile, "general", "command-timeout",
+                           config->command_timeout);
+    g_key_file_set_integer(keyfile, "general", "max-connections",
+                           config->max_connections);
+    g_key_file_set_boolean(keyfile, "general", "dispatch-arena",
+                           config->dispatch_arena);
 
     tmp = g_key_file_to_data(keyfile, NULL, &error);
     printf("%s", tmp);
@@ -1232,6 +2450,8 @@ static bool check_is_frozen(GAState *s)
 
 static int run_agent(GAState *s, GAConfig *config)
 {
+    GList *l;
+
     ga_state = s;
 
     g_log_set_default_handler(ga_log, s);
@@ -1263,7 +2483,7 @@ static int run_agent(GAState *s, GAConfig *config)
             s->deferred_options.log_filepath = config->log_filepath;
         }
         ga_disable_logging(s);
-        qmp_for_each_command(ga_disable_non_whitelisted, NULL);
+        qmp_for_each_command(ga_disable_non_whitelisted, s->freeze_whitelist);
     } else {
         if (config->daemonize) {
             become_daemon(config->pid_filepath);
@@ -1288,19 +2508,20 @@ static int run_agent(GAState *s, GAConfig *config)
     }
 
     config->blacklist = ga_command_blacklist_init(config->blacklist);
-    if (config->blacklist) {
-        GList *l = config->blacklist;
-        s->blacklist = config->blacklist;
-        do {
-            g_debug("disabling command: %s", (char *)l->data);
-            qmp_disable_command(l->data);
-            l = g_list_next(l);
-        } while (l);
+    for (l = config->blacklist; l; l = g_list_next(l)) {
+        g_debug("disabling command: %s", (char *)l->data);
+        qmp_disable_command(l->data);
+        g_hash_table_insert(s->blacklist, l->data, l->data);
     }
+    qmp_event_set_func_emit(ga_event_emit);
     s->command_state = ga_command_state_new();
     ga_command_state_init(s, s->command_state);
     ga_command_state_init_all(s->command_state);
-    json_message_parser_init(&s->parser, process_event);
+    if (config->async_workers > 0) {
+        s->workers = g_thread_pool_new(ga_job_run, NULL,
+                                       config->async_workers, false, NULL);
+        s->max_workers = config->async_workers;
+    }
     ga_state = s;
 #ifndef _WIN32
     if (!register_signal_handlers()) {
@@ -1309,6 +2530,9 @@ static int run_agent(GAState *s, GAConfig *config)
     }
 #endif
 
+    s->stats.commands = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, g_free);
+    s->stats.start = g_get_monotonic_time();
     s->main_loop = g_main_loop_new(NULL, false);
     if (!channel_init(ga_state, config->method, config->channel_path)) {
         g_critical("failed to initialize guest agent channel");
@@ -1387,11 +2611,20 @@ int main(int argc, char **argv)
     int ret = EXIT_SUCCESS;
     GAState *s = g_new0(GAState, 1);
     GAConfig *config = g_new0(GAConfig, 1);
+    const char **name;
 
     config->log_level = G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL;
+    config->max_connections = 1;
 
     module_call_init(MODULE_INIT_QAPI);
 
+    s->blacklist = g_hash_table_new(g_str_hash, g_str_equal);
+    s->freeze_whitelist = g_hash_table_new(g_str_hash, g_str_equal);
+    for (name = ga_freeze_whitelist; *name; name++) {
+        g_hash_table_insert(s->freeze_whitelist, (gpointer)*name,
+                            (gpointer)*name);
+    }
+
     init_dfl_pathnames();
     config_load(config);
     config_parse(config, argc, argv);
@@ -1425,6 +2658,15 @@ int main(int argc, char **argv)
 
     s->log_level = config->log_level;
     s->log_file = stderr;
+    s->metrics_interval = config->metrics_interval;
+    s->memory_threshold = config->memory_threshold;
+    s->disk_threshold = config->disk_threshold;
+    s->oom_events = config->oom_events;
+    s->command_timeout = config->command_timeout;
+    s->max_connections = config->max_connections;
+    if (config->dispatch_arena) {
+        s->arena = qemu_arena_new(GA_ARENA_SIZE, GA_ARENA_MAX_SIZE);
+    }
 #ifdef CONFIG_FSFREEZE
     s->fsfreeze_hook = config->fsfreeze_hook;
 #endif
@@ -1441,12 +2683,27 @@ int main(int argc, char **argv)
     ret = run_agent(s, config);
 
 end:
+    if (s->workers) {
+        /* don't wait for jobs that may never finish */
+        g_thread_pool_free(s->workers, true, false);
+    }
     if (s->command_state) {
         ga_command_state_cleanup_all(s->command_state);
     }
+    while (s->sessions) {
+        ga_session_close(s->sessions->data);
+    }
     if (s->channel) {
         ga_channel_free(s->channel);
     }
+    if (s->stats.commands) {
+        g_hash_table_destroy(s->stats.commands);
+    }
+    if (s->arena) {
+        qemu_arena_destroy(s->arena);
+    }
+    g_hash_table_destroy(s->blacklist);
+    g_hash_table_destroy(s->freeze_whitelist);
     g_list_foreach(config->blacklist, free_blacklist_entry, NULL);
     g_free(s->pstate_filepath);
     g_free(s->state_filepath_isfrozen);
@@ -76,15 +76,6 @@ static int token_is_operator(QObject *obj, char op)
     return (val[0] == op) && (val[1] == 0);
 }
 
-static int token_is_keyword(QObject *obj, const char *value)
-{
-    if (token_get_type(obj) != JSON_KEYWORD) {
-        return 0;
-    }
-
-    return strcmp(token_get_value(obj), value) == 0;
-}
-
 static int token_is_escape(QObject *obj, const char *value)
 {
     if (token_get_type(obj) != JSON_ESCAPE) {
@@ -176,9 +167,9 @@ static int hex2decimal(char ch)
  *      \t
  *      \u four-hex-digits 
  */
-static QString *qstring_from_escaped_str(JSONParserContext *ctxt, QObject *token)
+static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
+                                         const char *ptr)
 {
-    const char *ptr = token_get_value(token);
     QString *str;
     int double_quote = 1;
 
@@ -243,7 +234,7 @@ static QString *qstring_from_escaped_str(JSONParserContext *ctxt, QObject *token
                     if (qemu_isxdigit(*ptr)) {
                         unicode_char |= hex2decimal(*ptr) << ((3 - i) * 4);
                     } else {
-                        parse_error(ctxt, token,
+                        parse_error(ctxt, NULL,
                                     "invalid hex escape sequence in string");
                         goto out;
                     }
@@ -254,16 +245,11 @@ static QString *qstring_from_escaped_str(JSONParserContext *ctxt, QObject *token
                 qstring_append(str, utf8_char);
             }   break;
             default:
-                parse_error(ctxt, token, "invalid escape sequence in string");
+                parse_error(ctxt, NULL, "invalid escape sequence in string");
                 goto out;
             }
         } else {
-            char dummy[2];
-
-            dummy[0] = *ptr++;
-            dummy[1] = 0;
-
-            qstring_append(str, dummy);
+            qstring_append_chr(str, *ptr++);
         }
     }
 
@@ -542,6 +528,20 @@ out:
     return NULL;
 }
 
+static QObject *keyword_from_str(JSONParserContext *ctxt, const char *value)
+{
+    if (!strcmp(value, "true")) {
+        return QOBJECT(qbool_from_bool(true));
+    } else if (!strcmp(value, "false")) {
+        return QOBJECT(qbool_from_bool(false));
+    } else if (!strcmp(value, "null")) {
+        return qnull();
+    }
+
+    parse_error(ctxt, NULL, "invalid keyword `%s'", value);
+    return NULL;
+}
+
 static QObject *parse_keyword(JSONParserContext *ctxt)
 {
     QObject *token, *ret;
@@ -556,14 +556,8 @@ static QObject *parse_keyword(JSONParserContext *ctxt)
         goto out;
     }
 
-    if (token_is_keyword(token, "true")) {
-        ret = QOBJECT(qbool_from_bool(true));
-    } else if (token_is_keyword(token, "false")) {
-        ret = QOBJECT(qbool_from_bool(false));
-    } else if (token_is_keyword(token, "null")) {
-        ret = qnull();
-    } else {
-        parse_error(ctxt, token, "invalid keyword `%s'", token_get_value(token));
+    ret = keyword_from_str(ctxt, token_get_value(token));
+    if (!ret) {
         goto out;
     }
 
@@ -616,20 +610,9 @@ out:
     return NULL;
 }
 
-static QObject *parse_literal(JSONParserContext *ctxt)
+static QObject *number_from_str(JSONTokenType type, const char *value)
 {
-    QObject *token, *obj;
-    JSONParserContext saved_ctxt = parser_context_save(ctxt);
-
-    token = parser_context_pop_token(ctxt);
-    if (token == NULL) {
-        goto out;
-    }
-
-    switch (token_get_type(token)) {
-    case JSON_STRING:
-        obj = QOBJECT(qstring_from_escaped_str(ctxt, token));
-        break;
+    switch (type) {
     case JSON_INTEGER: {
         /* A possibility exists that this is a whole-valued float where the
          * fractional part was left out due to being 0 (.0). It's not a big
@@ -643,19 +626,40 @@ static QObject *parse_literal(JSONParserContext *ctxt)
          *
          * strtoll() indicates these instances by setting errno to ERANGE
          */
-        int64_t value;
+        int64_t num;
 
         errno = 0; /* strtoll doesn't set errno on success */
-        value = strtoll(token_get_value(token), NULL, 10);
+        num = strtoll(value, NULL, 10);
         if (errno != ERANGE) {
-            obj = QOBJECT(qint_from_int(value));
-            break;
+            return QOBJECT(qint_from_int(num));
         }
         /* fall through to JSON_FLOAT */
     }
     case JSON_FLOAT:
         /* FIXME dependent on locale */
-        obj = QOBJECT(qfloat_from_double(strtod(token_get_value(token), NULL)));
+        return QOBJECT(qfloat_from_double(strtod(value, NULL)));
+    default:
+        abort();
+    }
+}
+
+static QObject *parse_literal(JSONParserContext *ctxt)
+{
+    QObject *token, *obj;
+    JSONParserContext saved_ctxt = parser_context_save(ctxt);
+
+    token = parser_context_pop_token(ctxt);
+    if (token == NULL) {
+        goto out;
+    }
+
+    switch (token_get_type(token)) {
+    case JSON_STRING:
+        obj = QOBJECT(qstring_from_escaped_str(ctxt, token_get_value(token)));
+        break;
+    case JSON_INTEGER:
+    case JSON_FLOAT:
+        obj = number_from_str(token_get_type(token), token_get_value(token));
         break;
     default:
         goto out;
@@ -669,6 +673,7 @@ out:
     return NULL;
 }
 
+
 static QObject *parse_value(JSONParserContext *ctxt, va_list *ap)
 {
     QObject *obj;
@@ -712,3 +717,33 @@ QObject *json_parser_parse_err(QList *tokens, va_list *ap, Error **errp)
 
     return result;
 }
+
+/*
+ * Convert a single string, number or keyword token to a QObject, for
+ * parsers that build up arrays and objects by themselves.
+ */
+QObject *json_parser_parse_scalar(JSONTokenType type, const char *token,
+                                  Error **errp)
+{
+    JSONParserContext ctxt = {};
+    QObject *obj = NULL;
+
+    switch (type) {
+    case JSON_STRING:
+        obj = QOBJECT(qstring_from_escaped_str(&ctxt, token));
+        break;
+    case JSON_INTEGER:
+    case JSON_FLOAT:
+        obj = number_from_str(type, token);
+        break;
+    case JSON_KEYWORD:
+        obj = keyword_from_str(&ctxt, token);
+        break;
+    default:
+        parse_error(&ctxt, NULL, "unexpected token `%s'", token);
+        break;
+    }
+
+    error_propagate(errp, ctxt.err);
+    return obj;
+}
@@ -16,11 +16,189 @@
 #include "qapi/qmp/qdict.h"
 #include "qemu-common.h"
 #include "qapi/qmp/json-lexer.h"
+#include "qapi/qmp/json-parser.h"
 #include "qapi/qmp/json-streamer.h"
 
 #define MAX_TOKEN_SIZE (64ULL << 20)
 #define MAX_NESTING (1ULL << 10)
 
+/*
+ * Direct mode builds the QObject as tokens come in, instead of queueing
+ * each token as a QDict and parsing the whole list once the message is
+ * complete.
+ */
+enum {
+    DIRECT_VALUE,               /* expecting a value */
+    DIRECT_VALUE_OR_END,        /* after '[' */
+    DIRECT_KEY,                 /* after ',' in an object */
+    DIRECT_KEY_OR_END,          /* after '{' */
+    DIRECT_COLON,
+    DIRECT_COMMA_OR_END,
+};
+
+static void json_direct_reset(JSONMessageParser *parser)
+{
+    while (parser->depth) {
+        qobject_decref(parser->stack[--parser->depth]);
+    }
+    QDECREF(parser->key);
+    parser->key = NULL;
+    qobject_decref(parser->result);
+    parser->result = NULL;
+    error_free(parser->err);
+    parser->err = NULL;
+    parser->state = DIRECT_VALUE;
+}
+
+static void GCC_FMT_ATTR(2, 3) json_direct_error(JSONMessageParser *parser,
+                                                 const char *msg, ...)
+{
+    va_list ap;
+    char message[1024];
+
+    va_start(ap, msg);
+    vsnprintf(message, sizeof(message), msg, ap);
+    va_end(ap);
+    error_setg(&parser->err, "JSON parse error, %s", message);
+}
+
+/* a value is complete: store it in its container, or it is the result */
+static void json_direct_value(JSONMessageParser *parser, QObject *obj)
+{
+    QObject *top;
+
+    if (!parser->depth) {
+        parser->result = obj;
+        parser->state = DIRECT_COMMA_OR_END;
+        return;
+    }
+
+    top = parser->stack[parser->depth - 1];
+    if (qobject_type(top) == QTYPE_QDICT) {
+        qdict_put_obj(qobject_to_qdict(top), qstring_get_str(parser->key), obj);
+        QDECREF(parser->key);
+        parser->key = NULL;
+    } else {
+        qlist_append_obj(qobject_to_qlist(top), obj);
+    }
+    parser->state = DIRECT_COMMA_OR_END;
+}
+
+static void json_direct_push(JSONMessageParser *parser, QObject *obj)
+{
+    if (parser->depth == parser->stack_size) {
+        parser->stack_size = parser->stack_size ? parser->stack_size * 2 : 8;
+        parser->stack = g_renew(QObject *, parser->stack, parser->stack_size);
+    }
+    parser->stack[parser->depth++] = obj;
+}
+
+static void json_direct_token(JSONMessageParser *parser, QString *token,
+                              JSONTokenType type)
+{
+    const char *str = qstring_get_str(token);
+    char op = type == JSON_OPERATOR ? str[0] : 0;
+    QObject *top, *obj;
+
+    if (parser->err) {
+        /* skip the rest of a bad message */
+        return;
+    }
+    if (parser->result) {
+        json_direct_error(parser, "unexpected token `%s' after value", str);
+        return;
+    }
+
+    top = parser->depth ? parser->stack[parser->depth - 1] : NULL;
+
+    switch (parser->state) {
+    case DIRECT_VALUE_OR_END:
+        if (op == ']') {
+            goto close;
+        }
+        /* fall through */
+    case DIRECT_VALUE:
+        if (op == '{') {
+            json_direct_push(parser, QOBJECT(qdict_new()));
+            parser->state = DIRECT_KEY_OR_END;
+        } else if (op == '[') {
+            json_direct_push(parser, QOBJECT(qlist_new()));
+            parser->state = DIRECT_VALUE_OR_END;
+        } else if (op) {
+            json_direct_error(parser, "expecting value");
+        } else {
+            obj = json_parser_parse_scalar(type, str, &parser->err);
+            if (obj) {
+                json_direct_value(parser, obj);
+            }
+        }
+        break;
+    case DIRECT_KEY_OR_END:
+        if (op == '}') {
+            goto close;
+        }
+        /* fall through */
+    case DIRECT_KEY:
+        if (type != JSON_STRING) {
+            json_direct_error(parser, "key is not a string in object");
+            break;
+        }
+        obj = json_parser_parse_scalar(type, str, &parser->err);
+        if (obj) {
+            parser->key = qobject_to_qstring(obj);
+            parser->state = DIRECT_COLON;
+        }
+        break;
+    case DIRECT_COLON:
+        if (op != ':') {
+            json_direct_error(parser, "missing : in object pair");
+            break;
+        }
+        parser->state = DIRECT_VALUE;
+        break;
+    case DIRECT_COMMA_OR_END:
+        if (op == ',') {
+            parser->state = qobject_type(top) == QTYPE_QDICT ?
+                            DIRECT_KEY : DIRECT_VALUE;
+            break;
+        }
+        if ((op == '}' && qobject_type(top) == QTYPE_QDICT) ||
+            (op == ']' && qobject_type(top) == QTYPE_QLIST)) {
+            goto close;
+        }
+        json_direct_error(parser, "expected separator in %s",
+                          qobject_type(top) == QTYPE_QDICT ? "dict" : "list");
+        break;
+    }
+    return;
+
+close:
+    parser->depth--;
+    json_direct_value(parser, top);
+}
+
+static void json_direct_emit(JSONMessageParser *parser, bool lexer_error)
+{
+    QObject *obj = NULL;
+    Error *err = NULL;
+
+    if (!lexer_error) {
+        if (parser->err) {
+            err = parser->err;
+            parser->err = NULL;
+        } else if (parser->result) {
+            obj = parser->result;
+            parser->result = NULL;
+        } else {
+            json_direct_error(parser, "premature EOI");
+            err = parser->err;
+            parser->err = NULL;
+        }
+    }
+    json_direct_reset(parser);
+    parser->emit_object(parser, obj, err);
+}
+
 static void json_message_process_token(JSONLexer *lexer, QString *token, JSONTokenType type, int x, int y)
 {
     JSONMessageParser *parser = container_of(lexer, JSONMessageParser, lexer);
@@ -45,16 +223,21 @@ static void json_message_process_token(JSONLexer *lexer, QString *token, JSONTok
         }
     }
 
-    dict = qdict_new();
-    qdict_put(dict, "type", qint_from_int(type));
-    QINCREF(token);
-    qdict_put(dict, "token", token);
-    qdict_put(dict, "x", qint_from_int(x));
-    qdict_put(dict, "y", qint_from_int(y));
-
     parser->token_size += token->length;
 
-    qlist_append(parser->tokens, dict);
+    if (parser->emit_object) {
+        if (type != JSON_ERROR) {
+            json_direct_token(parser, token, type);
+        }
+    } else {
+        dict = qdict_new();
+        qdict_put(dict, "type", qint_from_int(type));
+        QINCREF(token);
+        qdict_put(dict, "token", token);
+        qdict_put(dict, "x", qint_from_int(x));
+        qdict_put(dict, "y", qint_from_int(y));
+        qlist_append(parser->tokens, dict);
+    }
 
     if (type == JSON_ERROR) {
         goto out_emit_bad;
@@ -75,12 +258,27 @@ static void json_message_process_token(JSONLexer *lexer, QString *token, JSONTok
     return;
 
 out_emit_bad:
+    if (parser->emit_object) {
+        /* as below, a lexer error is signalled with no object and no error */
+        parser->brace_count = 0;
+        parser->bracket_count = 0;
+        parser->token_size = 0;
+        json_direct_emit(parser, true);
+        return;
+    }
     /* clear out token list and tell the parser to emit and error
      * indication by passing it a NULL list
      */
     QDECREF(parser->tokens);
     parser->tokens = NULL;
 out_emit:
+    if (parser->emit_object) {
+        parser->brace_count = 0;
+        parser->bracket_count = 0;
+        parser->token_size = 0;
+        json_direct_emit(parser, false);
+        return;
+    }
     /* send current list of tokens to parser and reset tokenizer */
     parser->brace_count = 0;
     parser->bracket_count = 0;
@@ -95,11 +293,25 @@ out_emit:
 void json_message_parser_init(JSONMessageParser *parser,
                               void (*func)(JSONMessageParser *, QList *))
 {
+    memset(parser, 0, sizeof(*parser));
     parser->emit = func;
-    parser->brace_count = 0;
-    parser->bracket_count = 0;
     parser->tokens = qlist_new();
-    parser->token_size = 0;
+
+    json_lexer_init(&parser->lexer, json_message_process_token);
+}
+
+/*
+ * Like json_message_parser_init(), but @func receives each message as a
+ * QObject built while the tokens are lexed, or an error: @obj and @err
+ * are NULL if the lexer hit invalid input. @func owns @obj and @err.
+ */
+void json_message_parser_init_direct(JSONMessageParser *parser,
+                                     void (*func)(JSONMessageParser *,
+                                                  QObject *, Error *))
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->emit_object = func;
+    parser->state = DIRECT_VALUE;
 
     json_lexer_init(&parser->lexer, json_message_process_token);
 }
@@ -119,4 +331,6 @@ void json_message_parser_destroy(JSONMessageParser *parser)
 {
     json_lexer_destroy(&parser->lexer);
     QDECREF(parser->tokens);
+    json_direct_reset(parser);
+    g_free(parser->stack);
 }
@@ -18,6 +18,7 @@
 #include "qapi/qmp/qobject.h"
 #include "qemu/queue.h"
 #include "qemu-common.h"
+#include "qemu/arena.h"
 
 static void qdict_destroy_obj(QObject *obj);
 
@@ -35,7 +36,7 @@ QDict *qdict_new(void)
 {
     QDict *qdict;
 
-    qdict = g_malloc0(sizeof(*qdict));
+    qdict = qemu_arena_malloc0(sizeof(*qdict));
     QOBJECT_INIT(qdict, &qdict_type);
 
     return qdict;
@@ -75,8 +76,8 @@ static QDictEntry *alloc_entry(const char *key, QObject *value)
 {
     QDictEntry *entry;
 
-    entry = g_malloc0(sizeof(*entry));
-    entry->key = g_strdup(key);
+    entry = qemu_arena_malloc0(sizeof(*entry));
+    entry->key = qemu_arena_strdup(key);
     entry->value = value;
 
     return entry;
@@ -432,8 +433,8 @@ static void qentry_destroy(QDictEntry *e)
     assert(e->value != NULL);
 
     qobject_decref(e->value);
-    g_free(e->key);
-    g_free(e);
+    qemu_arena_free(e->key);
+    qemu_arena_free(e);
 }
 
 /**
@@ -474,7 +475,7 @@ static void qdict_destroy_obj(QObject *obj)
         }
     }
 
-    g_free(qdict);
+    qemu_arena_free(qdict);
 }
 
 /**
@@ -14,6 +14,7 @@
 #include "qapi/qmp/qfloat.h"
 #include "qapi/qmp/qobject.h"
 #include "qemu-common.h"
+#include "qemu/arena.h"
 
 static void qfloat_destroy_obj(QObject *obj);
 
@@ -31,7 +32,7 @@ QFloat *qfloat_from_double(double value)
 {
     QFloat *qf;
 
-    qf = g_malloc(sizeof(*qf));
+    qf = qemu_arena_malloc(sizeof(*qf));
     qf->value = value;
     QOBJECT_INIT(qf, &qfloat_type);
 
@@ -64,5 +65,5 @@ QFloat *qobject_to_qfloat(const QObject *obj)
 static void qfloat_destroy_obj(QObject *obj)
 {
     assert(obj != NULL);
-    g_free(qobject_to_qfloat(obj));
+    qemu_arena_free(qobject_to_qfloat(obj));
 }
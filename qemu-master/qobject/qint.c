@@ -13,6 +13,7 @@
 #include "qapi/qmp/qint.h"
 #include "qapi/qmp/qobject.h"
 #include "qemu-common.h"
+#include "qemu/arena.h"
 
 static void qint_destroy_obj(QObject *obj);
 
@@ -30,7 +31,7 @@ QInt *qint_from_int(int64_t value)
 {
     QInt *qi;
 
-    qi = g_malloc(sizeof(*qi));
+    qi = qemu_arena_malloc(sizeof(*qi));
     qi->value = value;
     QOBJECT_INIT(qi, &qint_type);
 
@@ -63,5 +64,5 @@ QInt *qobject_to_qint(const QObject *obj)
 static void qint_destroy_obj(QObject *obj)
 {
     assert(obj != NULL);
-    g_free(qobject_to_qint(obj));
+    qemu_arena_free(qobject_to_qint(obj));
 }
@@ -70,72 +70,95 @@ QObject *qobject_from_jsonf(const char *string, ...)
     return obj;
 }
 
+/* where to_json() puts its output */
+typedef struct JSONOutput {
+    JSONEmitFunc *emit;
+    void *opaque;
+} JSONOutput;
+
+static void json_emit(JSONOutput *out, const char *str)
+{
+    out->emit(out->opaque, str, strlen(str));
+}
+
+static void json_emit_indent(JSONOutput *out, int indent)
+{
+    int j;
+
+    json_emit(out, "\n");
+    for (j = 0; j < indent; j++) {
+        json_emit(out, "    ");
+    }
+}
+
 typedef struct ToJsonIterState
 {
     int indent;
     int pretty;
     int count;
-    QString *str;
+    JSONOutput *out;
 } ToJsonIterState;
 
-static void to_json(const QObject *obj, QString *str, int pretty, int indent);
+static void to_json(const QObject *obj, JSONOutput *out, int pretty,
+                    int indent);
 
 static void to_json_dict_iter(const char *key, QObject *obj, void *opaque)
 {
     ToJsonIterState *s = opaque;
     QString *qkey;
-    int j;
 
     if (s->count) {
-        qstring_append(s->str, s->pretty ? "," : ", ");
+        json_emit(s->out, s->pretty ? "," : ", ");
     }
 
     if (s->pretty) {
-        qstring_append(s->str, "\n");
-        for (j = 0 ; j < s->indent ; j++)
-            qstring_append(s->str, "    ");
+        json_emit_indent(s->out, s->indent);
     }
 
     qkey = qstring_from_str(key);
-    to_json(QOBJECT(qkey), s->str, s->pretty, s->indent);
+    to_json(QOBJECT(qkey), s->out, s->pretty, s->indent);
     QDECREF(qkey);
 
-    qstring_append(s->str, ": ");
-    to_json(obj, s->str, s->pretty, s->indent);
+    json_emit(s->out, ": ");
+    to_json(obj, s->out, s->pretty, s->indent);
     s->count++;
 }
 
 static void to_json_list_iter(QObject *obj, void *opaque)
 {
     ToJsonIterState *s = opaque;
-    int j;
 
     if (s->count) {
-        qstring_append(s->str, s->pretty ? "," : ", ");
+        json_emit(s->out, s->pretty ? "," : ", ");
     }
 
     if (s->pretty) {
-        qstring_append(s->str, "\n");
-        for (j = 0 ; j < s->indent ; j++)
-            qstring_append(s->str, "    ");
+        json_emit_indent(s->out, s->indent);
     }
 
-    to_json(obj, s->str, s->pretty, s->indent);
+    to_json(obj, s->out, s->pretty, s->indent);
     s->count++;
 }
 
-static void to_json(const QObject *obj, QString *str, int pretty, int indent)
+/* characters that go into a JSON string as they are */
+static bool to_json_plain_chr(char c)
+{
+    return c >= 0x20 && c < 0x7F && c != '\"' && c != '\\';
+}
+
+static void to_json(const QObject *obj, JSONOutput *out, int pretty,
+                    int indent)
 {
     switch (qobject_type(obj)) {
     case QTYPE_QNULL:
-        qstring_append(str, "null");
+        json_emit(out, "null");
         break;
     case QTYPE_QINT: {
         QInt *val = qobject_to_qint(obj);
         char buffer[1024];
 
         snprintf(buffer, sizeof(buffer), "%" PRId64, qint_get_int(val));
-        qstring_append(str, buffer);
+        json_emit(out, buffer);
         break;
     }
     case QTYPE_QSTRING: {
@@ -146,31 +169,40 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         char *end;
 
         ptr = qstring_get_str(val);
-        qstring_append(str, "\"");
+        json_emit(out, "\"");
 
         for (; *ptr; ptr = end) {
+            /* pass on runs of plain ASCII, such as base64 data, in one go */
+            for (end = (char *)ptr; to_json_plain_chr(*end); end++) {
+                /* nothing */
+            }
+            if (end != ptr) {
+                out->emit(out->opaque, ptr, end - ptr);
+                continue;
+            }
+
             cp = mod_utf8_codepoint(ptr, 6, &end);
             switch (cp) {
             case '\"':
-                qstring_append(str, "\\\"");
+                json_emit(out, "\\\"");
                 break;
             case '\\':
-                qstring_append(str, "\\\\");
+                json_emit(out, "\\\\");
                 break;
             case '\b':
-                qstring_append(str, "\\b");
+                json_emit(out, "\\b");
                 break;
             case '\f':
-                qstring_append(str, "\\f");
+                json_emit(out, "\\f");
                 break;
             case '\n':
-                qstring_append(str, "\\n");
+                json_emit(out, "\\n");
                 break;
             case '\r':
-                qstring_append(str, "\\r");
+                json_emit(out, "\\r");
                 break;
             case '\t':
-                qstring_append(str, "\\t");
+                json_emit(out, "\\t");
                 break;
             default:
                 if (cp < 0) {
@@ -187,11 +219,11 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
                     buf[0] = cp;
                     buf[1] = 0;
                 }
-                qstring_append(str, buf);
+                json_emit(out, buf);
             }
         };
 
-        qstring_append(str, "\"");
+        json_emit(out, "\"");
         break;
     }
     case QTYPE_QDICT: {
@@ -199,18 +231,15 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         QDict *val = qobject_to_qdict(obj);
 
         s.count = 0;
-        s.str = str;
+        s.out = out;
         s.indent = indent + 1;
         s.pretty = pretty;
-        qstring_append(str, "{");
+        json_emit(out, "{");
         qdict_iter(val, to_json_dict_iter, &s);
         if (pretty) {
-            int j;
-            qstring_append(str, "\n");
-            for (j = 0 ; j < indent ; j++)
-                qstring_append(str, "    ");
+            json_emit_indent(out, indent);
         }
-        qstring_append(str, "}");
+        json_emit(out, "}");
         break;
     }
     case QTYPE_QLIST: {
@@ -218,18 +247,15 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         QList *val = qobject_to_qlist(obj);
 
         s.count = 0;
-        s.str = str;
+        s.out = out;
         s.indent = indent + 1;
         s.pretty = pretty;
-        qstring_append(str, "[");
+        json_emit(out, "[");
         qlist_iter(val, (void *)to_json_list_iter, &s);
         if (pretty) {
-            int j;
-            qstring_append(str, "\n");
-            for (j = 0 ; j < indent ; j++)
-                qstring_append(str, "    ");
+            json_emit_indent(out, indent);
         }
-        qstring_append(str, "]");
+        json_emit(out, "]");
         break;
     }
     case QTYPE_QFLOAT: {
@@ -248,16 +274,16 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
             buffer[len] = 0;
         }
         
-        qstring_append(str, buffer);
+        json_emit(out, buffer);
         break;
     }
     case QTYPE_QBOOL: {
         QBool *val = qobject_to_qbool(obj);
 
         if (qbool_get_bool(val)) {
-            qstring_append(str, "true");
+            json_emit(out, "true");
         } else {
-            qstring_append(str, "false");
+            json_emit(out, "false");
         }
         break;
     }
@@ -266,11 +292,17 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
     }
 }
 
+static void to_qstring(void *opaque, const char *buf, size_t len)
+{
+    qstring_append_len(opaque, buf, len);
+}
+
 QString *qobject_to_json(const QObject *obj)
 {
     QString *str = qstring_new();
+    JSONOutput out = { to_qstring, str };
 
-    to_json(obj, str, 0, 0);
+    to_json(obj, &out, 0, 0);
 
     return str;
 }
@@ -278,8 +310,21 @@ QString *qobject_to_json(const QObject *obj)
 QString *qobject_to_json_pretty(const QObject *obj)
 {
     QString *str = qstring_new();
+    JSONOutput out = { to_qstring, str };
 
-    to_json(obj, str, 1, 0);
+    to_json(obj, &out, 1, 0);
 
     return str;
 }
+
+/*
+ * Like qobject_to_json(), but without building the whole text in memory:
+ * @emit gets it in pieces as they are produced.
+ */
+void qobject_to_json_emit(const QObject *obj, JSONEmitFunc *emit,
+                          void *opaque)
+{
+    JSONOutput out = { emit, opaque };
+
+    to_json(obj, &out, 0, 0);
+}
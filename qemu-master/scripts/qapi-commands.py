@@ -190,10 +190,13 @@ out:
     return ret
 
 
-def gen_register_command(name, success_response):
-    options = 'QCO_NO_OPTIONS'
+def gen_register_command(name, success_response, blocking):
+    options = []
     if not success_response:
-        options = 'QCO_NO_SUCCESS_RESP'
+        options.append('QCO_NO_SUCCESS_RESP')
+    if blocking:
+        options.append('QCO_BLOCKING')
+    options = ' | '.join(options) or 'QCO_NO_OPTIONS'
 
     ret = mcgen('''
     qmp_register_command("%(name)s", qmp_marshal_%(c_name)s, %(opts)s);
@@ -238,7 +241,7 @@ class QAPISchemaGenCommandVisitor(QAPISchemaVisitor):
         self._visited_ret_types = None
 
     def visit_command(self, name, info, arg_type, ret_type,
-                      gen, success_response):
+                      gen, success_response, blocking):
         if not gen:
             return
         self.decl += gen_command_decl(name, arg_type, ret_type)
@@ -249,7 +252,8 @@ class QAPISchemaGenCommandVisitor(QAPISchemaVisitor):
             self.decl += gen_marshal_decl(name)
         self.defn += gen_marshal(name, arg_type, ret_type)
         if not middle_mode:
-            self._regy += gen_register_command(name, success_response)
+            self._regy += gen_register_command(name, success_response,
+                                               blocking)
 
 
 middle_mode = False
@@ -19,6 +19,8 @@
 #include "qapi/qmp/qfloat.h"
 #include "qapi/qmp/qbool.h"
 #include "qapi/qmp/qjson.h"
+#include "qapi/qmp/json-parser.h"
+#include "qapi/qmp/json-streamer.h"
 
 #include "qemu-common.h"
 
@@ -1484,6 +1486,146 @@ static void unterminated_literal(void)
     g_assert(obj == NULL);
 }
 
+typedef struct DirectParser {
+    JSONMessageParser parser;
+    QObject *obj;
+    int messages;
+} DirectParser;
+
+static void direct_emit(JSONMessageParser *parser, QObject *obj, Error *err)
+{
+    DirectParser *dp = container_of(parser, DirectParser, parser);
+
+    g_assert(!obj || !err);
+    error_free(err);
+    qobject_decref(dp->obj);
+    dp->obj = obj;
+    dp->messages++;
+}
+
+/* parse @string with the streamer in direct mode, returns the last message */
+static QObject *direct_from_json(const char *string, int *messages)
+{
+    DirectParser dp = {};
+
+    json_message_parser_init_direct(&dp.parser, direct_emit);
+    json_message_parser_feed(&dp.parser, string, strlen(string));
+    json_message_parser_flush(&dp.parser);
+    json_message_parser_destroy(&dp.parser);
+
+    if (messages) {
+        *messages = dp.messages;
+    }
+    return dp.obj;
+}
+
+static void direct_parser(void)
+{
+    const char *inputs[] = {
+        "{'abc': 32, 'def': [1, 2.5, true, false, null],"
+        " 'g': {'h': \"a\\nb\\u00e9\"}}",
+        "[]", "{}", "[[], {}, [[1]], [{'a': []}]]",
+        "\"abc\"", "42", "-1.5e3", "9223372036854775808", "true",
+        "[32", "[32,}", "{'abc':32,}", "{'abc' 32}", "{32: 1}", "[1 2]",
+        "nul", "\"\\x\"",
+        NULL
+    };
+    QObject *expected, *obj;
+    QString *str1, *str2;
+    int i, messages;
+
+    for (i = 0; inputs[i]; i++) {
+        expected = qobject_from_json(inputs[i]);
+        obj = direct_from_json(inputs[i], NULL);
+        if (!expected) {
+            g_assert(obj == NULL);
+            continue;
+        }
+        g_assert(obj != NULL);
+        str1 = qobject_to_json(expected);
+        str2 = qobject_to_json(obj);
+        g_assert_cmpstr(qstring_get_str(str1), ==, qstring_get_str(str2));
+        QDECREF(str1);
+        QDECREF(str2);
+        qobject_decref(expected);
+        qobject_decref(obj);
+    }
+
+    /* a bad message is skipped as a whole */
+    obj = direct_from_json("{'a' [1, {}]} {'b': 2}", &messages);
+    g_assert_cmpint(messages, ==, 2);
+    g_assert(obj != NULL);
+    g_assert_cmpint(qdict_get_int(qobject_to_qdict(obj), "b"), ==, 2);
+    qobject_decref(obj);
+}
+
+static void token_list_drop(JSONMessageParser *parser, QList *tokens)
+{
+    qobject_decref(json_parser_parse_err(tokens, NULL, NULL));
+}
+
+static void direct_drop(JSONMessageParser *parser, QObject *obj, Error *err)
+{
+    qobject_decref(obj);
+    error_free(err);
+}
+
+static void perf_streamer_run(const char *desc, const char *json, bool direct)
+{
+    JSONMessageParser parser;
+    size_t len = strlen(json);
+    int i, max = MAX(1, (64 << 20) / len);
+    double duration;
+
+    if (direct) {
+        json_message_parser_init_direct(&parser, direct_drop);
+    } else {
+        json_message_parser_init(&parser, token_list_drop);
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        json_message_parser_feed(&parser, json, len);
+    }
+    duration = g_test_timer_elapsed();
+    json_message_parser_destroy(&parser);
+
+    g_test_message("%s, %s: %d messages, %f MB/s, %f messages/s\n",
+                   desc, direct ? "direct" : "token list", max,
+                   len * max / duration / (1 << 20), max / duration);
+}
+
+static void perf_streamer(void)
+{
+    guchar *data = g_malloc0(48 * 1024);
+    gchar *b64 = g_base64_encode(data, 48 * 1024);
+    gchar *write_req;
+    GString *batch_req = g_string_new("{'execute': 'guest-batch',"
+                                      " 'arguments': {'commands': [");
+    int i;
+
+    /* a large payload in a single token */
+    write_req = g_strdup_printf("{'execute': 'guest-file-write', 'arguments':"
+                                " {'handle': 1000, 'buf-b64': '%s'}}", b64);
+
+    /* many small tokens */
+    for (i = 0; i < 1000; i++) {
+        g_string_append_printf(batch_req, "%s{'execute': 'guest-sync',"
+                               " 'arguments': {'id': %d}}", i ? ", " : "", i);
+    }
+    g_string_append(batch_req, "]}}");
+
+    perf_streamer_run("guest-file-write 64KiB", write_req, false);
+    perf_streamer_run("guest-file-write 64KiB", write_req, true);
+    perf_streamer_run("guest-batch 1000 commands", batch_req->str, false);
+    perf_streamer_run("guest-batch 1000 commands", batch_req->str, true);
+
+    g_string_free(batch_req, true);
+    g_free(write_req);
+    g_free(b64);
+    g_free(data);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1520,5 +1662,10 @@ int main(int argc, char **argv)
     g_test_add_func("/errors/invalid_dict_comma", invalid_dict_comma);
     g_test_add_func("/errors/unterminated/literal", unterminated_literal);
 
+    g_test_add_func("/streamer/direct", direct_parser);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/streamer", perf_streamer);
+    }
+
     return g_test_run();
 }
@@ -36,10 +36,11 @@ class QAPISchemaTestVisitor(QAPISchemaVisitor):
         self._print_variants(variants)
 
     def visit_command(self, name, info, arg_type, ret_type,
-                      gen, success_response):
+                      gen, success_response, blocking):
         print 'command %s %s -> %s' % \
             (name, arg_type and arg_type.name, ret_type and ret_type.name)
-        print '   gen=%s success_response=%s' % (gen, success_response)
+        print '   gen=%s success_response=%s blocking=%s' % \
+            (gen, success_response, blocking)
 
     def visit_event(self, name, info, arg_type):
         print 'event %s %s' % (name, arg_type and arg_type.name)
@@ -0,0 +1,730 @@
+/*
+ * QEMU Guest Agent load generator and latency benchmark
+ *
+ * Starts qemu-ga on a unix-listen socket and drives it with a weighted mix
+ * of commands, keeping up to --depth requests in flight. Reports
+ * throughput, latency percentiles per command and for the whole mix, and
+ * the CPU time and memory used by the agent, as text or as JSON for
+ * tracking results commit by commit.
+ *
+ * Example:
+ *   tests/qga-bench --mix ping=8,file-read:65536=2,exec=1 --depth 16 \
+ *                   --requests 100000 --json --label "$(git describe)"
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "qemu-common.h"
+#include "qemu/sockets.h"
+#include "qapi/qmp/json-streamer.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qint.h"
+#include "qapi/qmp/qfloat.h"
+#include "qapi/qmp/qstring.h"
+
+#define BENCH_READ_SIZE (64 * 1024)
+
+typedef enum BenchOpType {
+    BENCH_PING,
+    BENCH_SYNC_DELIMITED,
+    BENCH_MEMORY_STATUS,
+    BENCH_FILE_READ,
+    BENCH_FILE_WRITE,
+    BENCH_EXEC,
+} BenchOpType;
+
+static const char *bench_op_names[] = {
+    [BENCH_PING] = "ping",
+    [BENCH_SYNC_DELIMITED] = "sync-delimited",
+    [BENCH_MEMORY_STATUS] = "memory-status",
+    [BENCH_FILE_READ] = "file-read",
+    [BENCH_FILE_WRITE] = "file-write",
+    [BENCH_EXEC] = "exec",
+};
+
+typedef struct BenchOp {
+    BenchOpType type;
+    int64_t size;           /* bytes, for file reads and writes */
+    int weight;
+    gchar *name;
+    gchar *request;         /* JSON text, ending in an "id": member */
+    GArray *latency;        /* of int64_t, us */
+    uint64_t errors;
+} BenchOp;
+
+typedef struct Bench {
+    const char *qga;
+    const char *label;
+    int depth;
+    int64_t requests;
+    int64_t warmup;
+    int workers;
+    bool json;
+
+    gchar *dir;
+    gchar *sock;
+    gchar *conf;
+    GPid pid;
+    int fd;
+    int64_t file;           /* guest-file handle used by file operations */
+
+    GPtrArray *ops;
+    GArray *schedule;       /* indices into ops, by weight */
+
+    JSONMessageParser parser;
+    GString *out;           /* requests not written yet */
+    gsize out_done;
+    int64_t next_id;
+    int64_t inflight;
+    int64_t completed;
+    bool record;
+    GHashTable *pending;    /* id -> BenchPending */
+} Bench;
+
+typedef struct BenchPending {
+    BenchOp *op;            /* NULL for setup commands */
+    QObject **ret;          /* where setup commands store their return */
+    int64_t start;
+} BenchPending;
+
+static void bench_die(const char *fmt, ...) G_GNUC_PRINTF(1, 2);
+
+static void bench_die(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "qga-bench: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+/* parse "name[:size]=weight,..." */
+static void bench_parse_mix(Bench *b, const char *mix)
+{
+    gchar **items = g_strsplit(mix, ",", 0);
+    gchar **item, *eq, *colon;
+    BenchOp *op;
+    int i;
+
+    for (item = items; *item; item++) {
+        op = g_new0(BenchOp, 1);
+        op->weight = 1;
+        eq = strchr(*item, '=');
+        if (eq) {
+            *eq = 0;
+            op->weight = atoi(eq + 1);
+        }
+        colon = strchr(*item, ':');
+        if (colon) {
+            *colon = 0;
+            op->size = g_ascii_strtoll(colon + 1, NULL, 0);
+        }
+        for (i = 0; i < ARRAY_SIZE(bench_op_names); i++) {
+            if (!strcmp(*item, bench_op_names[i])) {
+                break;
+            }
+        }
+        if (i == ARRAY_SIZE(bench_op_names) || op->weight <= 0) {
+            bench_die("invalid mix entry '%s'", *item);
+        }
+        op->type = i;
+        if ((op->type == BENCH_FILE_READ || op->type == BENCH_FILE_WRITE) &&
+            op->size <= 0) {
+            op->size = 4096;
+        }
+        op->name = op->size ?
+            g_strdup_printf("%s:%" PRId64, *item, op->size) : g_strdup(*item);
+        op->latency = g_array_new(false, false, sizeof(int64_t));
+        g_ptr_array_add(b->ops, op);
+    }
+    g_strfreev(items);
+}
+
+static void bench_start_agent(Bench *b)
+{
+    struct sockaddr_un addr;
+    GError *err = NULL;
+    gchar *cmd, **argv;
+    int i;
+
+    b->dir = g_strdup("/tmp/qga-bench.XXXXXX");
+    if (!mkdtemp(b->dir)) {
+        bench_die("mkdtemp: %s", strerror(errno));
+    }
+    b->sock = g_build_filename(b->dir, "sock", NULL);
+    b->conf = g_build_filename(b->dir, "qemu-ga.conf", NULL);
+    cmd = g_strdup_printf("[general]\nasync-workers=%d\n", b->workers);
+    if (!g_file_set_contents(b->conf, cmd, -1, &err)) {
+        bench_die("%s", err->message);
+    }
+    g_free(cmd);
+
+    g_setenv("QGA_CONF", b->conf, true);
+    cmd = g_strdup_printf("%s -m unix-listen -t %s -p %s", b->qga, b->dir,
+                          b->sock);
+    if (!g_shell_parse_argv(cmd, NULL, &argv, &err) ||
+        !g_spawn_async(b->dir, argv, NULL,
+                       G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                       NULL, NULL, &b->pid, &err)) {
+        bench_die("cannot start %s: %s", b->qga, err->message);
+    }
+    g_strfreev(argv);
+    g_free(cmd);
+
+    b->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    pstrcpy(addr.sun_path, sizeof(addr.sun_path), b->sock);
+    for (i = 0; connect(b->fd, (struct sockaddr *)&addr, sizeof(addr)); i++) {
+        if (i == 100) {
+            bench_die("cannot connect to %s: %s", b->sock, strerror(errno));
+        }
+        g_usleep(G_USEC_PER_SEC / 20);
+    }
+}
+
+static void bench_stop_agent(Bench *b)
+{
+    gchar *path;
+    int status;
+
+    close(b->fd);
+    kill(b->pid, SIGTERM);
+    waitpid(b->pid, &status, 0);
+    g_spawn_close_pid(b->pid);
+
+    unlink(b->sock);
+    unlink(b->conf);
+    path = g_build_filename(b->dir, "bench-file", NULL);
+    unlink(path);
+    g_free(path);
+    path = g_build_filename(b->dir, "qga.state", NULL);
+    unlink(path);
+    g_free(path);
+    g_rmdir(b->dir);
+}
+
+static void bench_receive(JSONMessageParser *parser, QObject *obj, Error *err)
+{
+    Bench *b = container_of(parser, Bench, parser);
+    BenchPending *p;
+    QDict *rsp = qobject_to_qdict(obj);
+    int64_t id;
+
+    if (err || !rsp || !qdict_haskey(rsp, "id")) {
+        /* sync-delimited sentinels are stripped before parsing */
+        bench_die("unexpected response from the agent");
+    }
+    id = qdict_get_int(rsp, "id");
+    p = g_hash_table_lookup(b->pending, &id);
+    if (!p) {
+        bench_die("response to unknown request %" PRId64, id);
+    }
+    if (p->ret) {
+        if (!qdict_haskey(rsp, "return")) {
+            bench_die("setup command failed: %s",
+                      qstring_get_str(qobject_to_json(obj)));
+        }
+        *p->ret = qdict_get(rsp, "return");
+        qobject_incref(*p->ret);
+    } else if (b->record) {
+        int64_t latency = g_get_monotonic_time() - p->start;
+
+        g_array_append_val(p->op->latency, latency);
+        p->op->errors += qdict_haskey(rsp, "error");
+    }
+    g_hash_table_remove(b->pending, &id);
+    b->inflight--;
+    b->completed++;
+    qobject_decref(obj);
+}
+
+/* @request is a JSON object with its closing brace left off */
+static void bench_queue_request(Bench *b, const char *request, BenchOp *op,
+                                QObject **ret)
+{
+    BenchPending *p = g_new0(BenchPending, 1);
+    int64_t *key = g_new(int64_t, 1);
+
+    *key = b->next_id++;
+    p->op = op;
+    p->ret = ret;
+    p->start = g_get_monotonic_time();
+    g_hash_table_insert(b->pending, key, p);
+    g_string_append_printf(b->out, "%s, \"id\": %" PRId64 "}\n",
+                           request, *key);
+    b->inflight++;
+}
+
+/* write what is queued and parse what has arrived, waiting if neither can
+ * make progress */
+static void bench_pump(Bench *b)
+{
+    struct pollfd pfd = { .fd = b->fd, .events = POLLIN };
+    char buf[BENCH_READ_SIZE];
+    ssize_t len, i, j;
+
+    if (b->out_done < b->out->len) {
+        pfd.events |= POLLOUT;
+    }
+    if (poll(&pfd, 1, -1) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        bench_die("poll: %s", strerror(errno));
+    }
+
+    if (pfd.revents & POLLOUT) {
+        len = write(b->fd, b->out->str + b->out_done,
+                    b->out->len - b->out_done);
+        if (len < 0 && errno != EAGAIN && errno != EINTR) {
+            bench_die("write: %s", strerror(errno));
+        }
+        if (len > 0) {
+            b->out_done += len;
+        }
+        if (b->out_done == b->out->len) {
+            g_string_truncate(b->out, 0);
+            b->out_done = 0;
+        }
+    }
+
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+        len = read(b->fd, buf, sizeof(buf));
+        if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+        if (len <= 0) {
+            bench_die("agent closed the connection");
+        }
+        /* drop the 0xFF sentinels that precede guest-sync-delimited
+         * responses, the lexer would only report them as errors */
+        for (i = j = 0; i < len; i++) {
+            if ((unsigned char)buf[i] != 0xFF) {
+                buf[j++] = buf[i];
+            }
+        }
+        json_message_parser_feed(&b->parser, buf, j);
+    }
+}
+
+/* send a setup request outside of the measurements and return its result */
+static QObject *bench_command(Bench *b, const char *fmt, ...)
+{
+    QObject *ret = NULL;
+    gchar *request;
+    va_list ap;
+
+    va_start(ap, fmt);
+    request = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    bench_queue_request(b, request, NULL, &ret);
+    while (b->inflight) {
+        bench_pump(b);
+    }
+    g_free(request);
+    return ret;
+}
+
+static void bench_prepare_ops(Bench *b)
+{
+    QObject *ret;
+    gchar *path, *data, *b64;
+    int64_t max_read = 0;
+    BenchOp *op;
+    int i, j;
+
+    for (i = 0; i < b->ops->len; i++) {
+        op = g_ptr_array_index(b->ops, i);
+        if (op->type == BENCH_FILE_READ) {
+            max_read = MAX(max_read, op->size);
+        }
+    }
+
+    path = g_build_filename(b->dir, "bench-file", NULL);
+    ret = bench_command(b, "{\"execute\": \"guest-file-open\", "
+                        "\"arguments\": {\"path\": \"%s\", "
+                        "\"mode\": \"w+\"}", path);
+    b->file = qint_get_int(qobject_to_qint(ret));
+    qobject_decref(ret);
+    g_free(path);
+
+    /* give reads something to return */
+    if (max_read) {
+        data = g_malloc0(max_read);
+        b64 = g_base64_encode((guchar *)data, max_read);
+        qobject_decref(bench_command(b, "{\"execute\": "
+                                     "\"guest-file-pwrite\", "
+                                     "\"arguments\": {\"handle\": %"
+                                     PRId64 ", \"offset\": 0, "
+                                     "\"buf-b64\": \"%s\"}",
+                                     b->file, b64));
+        g_free(b64);
+        g_free(data);
+    }
+
+    for (i = 0; i < b->ops->len; i++) {
+        op = g_ptr_array_index(b->ops, i);
+        switch (op->type) {
+        case BENCH_PING:
+            op->request = g_strdup("{\"execute\": \"guest-ping\"");
+            break;
+        case BENCH_SYNC_DELIMITED:
+            op->request = g_strdup("{\"execute\": "
+                                   "\"guest-sync-delimited\", "
+                                   "\"arguments\": {\"id\": 1}");
+            break;
+        case BENCH_MEMORY_STATUS:
+            op->request = g_strdup("{\"execute\": "
+                                   "\"guest-get-memory-status\"");
+            break;
+        case BENCH_FILE_READ:
+            op->request = g_strdup_printf("{\"execute\": "
+                                          "\"guest-file-pread\", "
+                                          "\"arguments\": {\"handle\": %"
+                                          PRId64 ", \"offset\": 0, "
+                                          "\"count\": %" PRId64 "}",
+                                          b->file, op->size);
+            break;
+        case BENCH_FILE_WRITE:
+            data = g_malloc(op->size);
+            memset(data, 'q', op->size);
+            b64 = g_base64_encode((guchar *)data, op->size);
+            op->request = g_strdup_printf("{\"execute\": "
+                                          "\"guest-file-pwrite\", "
+                                          "\"arguments\": {\"handle\": %"
+                                          PRId64 ", \"offset\": 0, "
+                                          "\"buf-b64\": \"%s\"}",
+                                          b->file, b64);
+            g_free(b64);
+            g_free(data);
+            break;
+        case BENCH_EXEC:
+            op->request = g_strdup("{\"execute\": \"guest-exec\", "
+                                   "\"arguments\": "
+                                   "{\"path\": \"/bin/true\"}");
+            break;
+        }
+        for (j = 0; j < op->weight; j++) {
+            g_array_append_val(b->schedule, i);
+        }
+    }
+}
+
+/* issue @count requests from the mix, keeping up to depth of them in
+ * flight, and wait for all of them to complete */
+static void bench_run(Bench *b, int64_t count)
+{
+    int64_t issued = 0;
+    BenchOp *op;
+    int idx;
+
+    while (issued < count || b->inflight) {
+        while (issued < count && b->inflight < b->depth) {
+            idx = g_array_index(b->schedule, int,
+                                issued % b->schedule->len);
+            op = g_ptr_array_index(b->ops, idx);
+            bench_queue_request(b, op->request, op, NULL);
+            issued++;
+        }
+        bench_pump(b);
+    }
+}
+
+typedef struct BenchUsage {
+    int64_t cpu_us;
+    int64_t rss_kb;
+    int64_t hwm_kb;
+} BenchUsage;
+
+static void bench_get_usage(Bench *b, BenchUsage *u)
+{
+    gchar *path, *contents, *p;
+    unsigned long utime, stime;
+
+    memset(u, 0, sizeof(*u));
+
+    path = g_strdup_printf("/proc/%d/stat", b->pid);
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        /* utime and stime are fields 14 and 15, comm may contain spaces */
+        p = strrchr(contents, ')');
+        if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                        "%lu %lu", &utime, &stime) == 2) {
+            u->cpu_us = (int64_t)(utime + stime) * G_USEC_PER_SEC /
+                        sysconf(_SC_CLK_TCK);
+        }
+        g_free(contents);
+    }
+    g_free(path);
+
+    path = g_strdup_printf("/proc/%d/status", b->pid);
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        p = strstr(contents, "VmRSS:");
+        if (p) {
+            u->rss_kb = g_ascii_strtoll(p + 6, NULL, 10);
+        }
+        p = strstr(contents, "VmHWM:");
+        if (p) {
+            u->hwm_kb = g_ascii_strtoll(p + 6, NULL, 10);
+        }
+        g_free(contents);
+    }
+    g_free(path);
+}
+
+static int bench_cmp_latency(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int64_t bench_percentile(GArray *latency, double p)
+{
+    guint idx;
+
+    if (!latency->len) {
+        return 0;
+    }
+    idx = MIN(latency->len - 1, (guint)(p * latency->len));
+    return g_array_index(latency, int64_t, idx);
+}
+
+static QDict *bench_report_op(const char *name, GArray *latency,
+                              uint64_t errors, int64_t elapsed_us, bool json)
+{
+    QDict *dict;
+    double rate;
+
+    qsort(latency->data, latency->len, sizeof(int64_t), bench_cmp_latency);
+    rate = elapsed_us ? latency->len * 1e6 / elapsed_us : 0;
+
+    if (!json) {
+        printf("%-20s %10u %8" PRIu64 " %12.1f %8" PRId64 " %8" PRId64
+               " %8" PRId64 "\n", name, latency->len, errors, rate,
+               bench_percentile(latency, 0.50),
+               bench_percentile(latency, 0.99),
+               bench_percentile(latency, 0.999));
+        return NULL;
+    }
+
+    dict = qdict_new();
+    qdict_put(dict, "name", qstring_from_str(name));
+    qdict_put(dict, "requests", qint_from_int(latency->len));
+    qdict_put(dict, "errors", qint_from_int(errors));
+    qdict_put(dict, "throughput", qfloat_from_double(rate));
+    qdict_put(dict, "p50-us", qint_from_int(bench_percentile(latency, 0.50)));
+    qdict_put(dict, "p99-us", qint_from_int(bench_percentile(latency, 0.99)));
+    qdict_put(dict, "p999-us",
+              qint_from_int(bench_percentile(latency, 0.999)));
+    return dict;
+}
+
+static void bench_report(Bench *b, int64_t elapsed_us, BenchUsage *before,
+                         BenchUsage *after)
+{
+    GArray *all = g_array_new(false, false, sizeof(int64_t));
+    QDict *result = NULL, *dict;
+    QList *ops = NULL;
+    QString *str;
+    uint64_t errors = 0;
+    BenchOp *op;
+    int i;
+
+    if (b->json) {
+        result = qdict_new();
+        ops = qlist_new();
+        if (b->label) {
+            qdict_put(result, "label", qstring_from_str(b->label));
+        }
+        qdict_put(result, "depth", qint_from_int(b->depth));
+        qdict_put(result, "workers", qint_from_int(b->workers));
+        qdict_put(result, "elapsed-us", qint_from_int(elapsed_us));
+    } else {
+        if (b->label) {
+            printf("%s\n", b->label);
+        }
+        printf("depth %d, async-workers %d, %.3f s\n\n", b->depth,
+               b->workers, elapsed_us / 1e6);
+        printf("%-20s %10s %8s %12s %8s %8s %8s\n", "command", "requests",
+               "errors", "req/s", "p50 us", "p99 us", "p999 us");
+    }
+
+    for (i = 0; i < b->ops->len; i++) {
+        op = g_ptr_array_index(b->ops, i);
+        g_array_append_vals(all, op->latency->data, op->latency->len);
+        errors += op->errors;
+        dict = bench_report_op(op->name, op->latency, op->errors, elapsed_us,
+                               b->json);
+        if (dict) {
+            qlist_append(ops, dict);
+        }
+    }
+    dict = bench_report_op("total", all, errors, elapsed_us, b->json);
+
+    if (b->json) {
+        qdict_put(result, "total", dict);
+        qdict_put(result, "commands", ops);
+        qdict_put(result, "agent-cpu-us",
+                  qint_from_int(after->cpu_us - before->cpu_us));
+        qdict_put(result, "agent-rss-kb", qint_from_int(after->rss_kb));
+        qdict_put(result, "agent-hwm-kb", qint_from_int(after->hwm_kb));
+        str = qobject_to_json_pretty(QOBJECT(result));
+        printf("%s\n", qstring_get_str(str));
+        QDECREF(str);
+        QDECREF(result);
+    } else {
+        printf("\nagent: cpu %.3f s (%.1f%%), rss %" PRId64 " kB, "
+               "peak rss %" PRId64 " kB\n",
+               (after->cpu_us - before->cpu_us) / 1e6,
+               elapsed_us ?
+               (after->cpu_us - before->cpu_us) * 100.0 / elapsed_us : 0,
+               after->rss_kb, after->hwm_kb);
+    }
+    g_array_free(all, true);
+}
+
+static void bench_free_pending(gpointer data)
+{
+    g_free(data);
+}
+
+static void usage(const char *cmd)
+{
+    printf(
+"Usage: %s [OPTION]...\n"
+"Drive a qemu-ga instance with a mix of commands and report its latency,\n"
+"throughput and resource usage.\n"
+"\n"
+"  -q, --qga PATH       qemu-ga binary to run (default qga/qemu-ga)\n"
+"  -m, --mix SPEC       comma separated command mix, each entry\n"
+"                       NAME[:SIZE][=WEIGHT] with NAME one of ping,\n"
+"                       sync-delimited, memory-status, file-read,\n"
+"                       file-write, exec (default ping)\n"
+"  -d, --depth N        requests kept in flight (default 1)\n"
+"  -n, --requests N     measured requests (default 10000)\n"
+"  -W, --warmup N       requests sent before measuring (default 100)\n"
+"  -w, --workers N      async-workers of the agent (default 0)\n"
+"  -l, --label TEXT     tag for the results, e.g. a commit id\n"
+"  -j, --json           print results as JSON\n"
+"  -h, --help           display this help and exit\n"
+"\n"
+"exec measures guest-exec of /bin/true, up to the return of its pid.\n",
+    cmd);
+}
+
+int main(int argc, char **argv)
+{
+    const char *sopt = "q:m:d:n:W:w:l:jh";
+    const struct option lopt[] = {
+        { "qga", 1, NULL, 'q' },
+        { "mix", 1, NULL, 'm' },
+        { "depth", 1, NULL, 'd' },
+        { "requests", 1, NULL, 'n' },
+        { "warmup", 1, NULL, 'W' },
+        { "workers", 1, NULL, 'w' },
+        { "label", 1, NULL, 'l' },
+        { "json", 0, NULL, 'j' },
+        { "help", 0, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *mix = "ping";
+    BenchUsage before, after;
+    int64_t start, elapsed;
+    Bench b = {
+        .qga = "qga/qemu-ga",
+        .depth = 1,
+        .requests = 10000,
+        .warmup = 100,
+    };
+    int ch;
+
+    while ((ch = getopt_long(argc, argv, sopt, lopt, NULL)) != -1) {
+        switch (ch) {
+        case 'q':
+            b.qga = optarg;
+            break;
+        case 'm':
+            mix = optarg;
+            break;
+        case 'd':
+            b.depth = atoi(optarg);
+            break;
+        case 'n':
+            b.requests = g_ascii_strtoll(optarg, NULL, 10);
+            break;
+        case 'W':
+            b.warmup = g_ascii_strtoll(optarg, NULL, 10);
+            break;
+        case 'w':
+            b.workers = atoi(optarg);
+            break;
+        case 'l':
+            b.label = optarg;
+            break;
+        case 'j':
+            b.json = true;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (b.depth < 1 || b.requests < 1 || b.warmup < 0 || b.workers < 0) {
+        bench_die("invalid arguments, see --help");
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    b.ops = g_ptr_array_new();
+    b.schedule = g_array_new(false, false, sizeof(int));
+    b.out = g_string_new(NULL);
+    b.pending = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                      bench_free_pending, bench_free_pending);
+    json_message_parser_init_direct(&b.parser, bench_receive);
+    bench_parse_mix(&b, mix);
+
+    bench_start_agent(&b);
+    qemu_set_nonblock(b.fd);
+    bench_prepare_ops(&b);
+
+    bench_run(&b, b.warmup);
+    b.record = true;
+    bench_get_usage(&b, &before);
+    start = g_get_monotonic_time();
+    bench_run(&b, b.requests);
+    elapsed = g_get_monotonic_time() - start;
+    bench_get_usage(&b, &after);
+
+    bench_report(&b, elapsed, &before, &after);
+
+    bench_stop_agent(&b);
+    json_message_parser_destroy(&b.parser);
+    g_hash_table_destroy(b.pending);
+    g_string_free(b.out, true);
+    return EXIT_SUCCESS;
+}
+
@@ -6,19 +6,29 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
 #include <inttypes.h>
+#include <zlib.h>
 
 #include "libqtest.h"
 #include "config-host.h"
+#include "qemu/bswap.h"
+#include "qapi/qmp/qint.h"
+#include "qapi/qmp/qjson.h"
 
 typedef struct {
     char *test_dir;
     GMainLoop *loop;
     int fd;
     GPid pid;
+    char *conf;     /* configuration file, see fixture_setup_with_conf() */
 } TestFixture;
 
 static int connect_qga(char *path)
@@ -61,6 +71,7 @@ fixture_setup(TestFixture *fixture, gconstpointer data)
     gchar *cwd, *path, *cmd, **argv = NULL;
 
     fixture->loop = g_main_loop_new(NULL, FALSE);
+    fixture->conf = NULL;
 
     fixture->test_dir = g_strdup("/tmp/qgatest.XXXXXX");
     g_assert_nonnull(mkdtemp(fixture->test_dir));
@@ -91,6 +102,26 @@ fixture_setup(TestFixture *fixture, gconstpointer data)
     g_free(path);
 }
 
+/* like fixture_setup(), with @conf_text as the agent's configuration */
+static void fixture_setup_with_conf(TestFixture *fixture,
+                                    const char *conf_text)
+{
+    GError *error = NULL;
+    char *conf;
+    int tmp;
+
+    tmp = g_file_open_tmp(NULL, &conf, &error);
+    g_assert_no_error(error);
+    close(tmp);
+    g_file_set_contents(conf, conf_text, -1, &error);
+    g_assert_no_error(error);
+
+    g_setenv("QGA_CONF", conf, true);
+    fixture_setup(fixture, NULL);
+    g_unsetenv("QGA_CONF");
+    fixture->conf = conf;
+}
+
 static void
 fixture_tear_down(TestFixture *fixture, gconstpointer data)
 {
@@ -117,6 +148,11 @@ fixture_tear_down(TestFixture *fixture, gconstpointer data)
 
     g_rmdir(fixture->test_dir);
     g_free(fixture->test_dir);
+
+    if (fixture->conf) {
+        unlink(fixture->conf);
+        g_free(fixture->conf);
+    }
 }
 
 static void qmp_assertion_message_error(const char     *domain,
@@ -242,6 +278,121 @@ static void test_qga_info(gconstpointer fix)
     QDECREF(ret);
 }
 
+static void test_qga_batch(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *entry, *error;
+    QList *list;
+    const gchar *class;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-batch', 'arguments': {"
+                 "'commands': [ {'execute': 'guest-sync',"
+                 "               'arguments': {'id': 42}},"
+                 "              {'execute': 'guest-invalid-cmd'},"
+                 "              {'execute': 'guest-batch',"
+                 "               'arguments': {'commands': []}},"
+                 "              {'execute': 'guest-ping'} ] } }");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    list = qdict_get_qlist(ret, "return");
+    g_assert_cmpint(qlist_size(list), ==, 4);
+
+    entry = qobject_to_qdict(qlist_pop(list));
+    g_assert_cmpint(qdict_get_int(entry, "return"), ==, 42);
+    QDECREF(entry);
+
+    entry = qobject_to_qdict(qlist_pop(list));
+    error = qdict_get_qdict(entry, "error");
+    class = qdict_get_try_str(error, "class");
+    g_assert_cmpstr(class, ==, "CommandNotFound");
+    QDECREF(entry);
+
+    entry = qobject_to_qdict(qlist_pop(list));
+    g_assert(qdict_haskey(entry, "error"));
+    QDECREF(entry);
+
+    entry = qobject_to_qdict(qlist_pop(list));
+    g_assert_nonnull(qdict_get_qdict(entry, "return"));
+    QDECREF(entry);
+
+    QDECREF(ret);
+
+    /* commands that change the framing of responses are refused */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-batch', 'arguments': {"
+                 "'commands': [ {'execute': 'guest-set-compression',"
+                 "               'arguments': {'enable': true}} ] } }");
+    qmp_assert_no_error(ret);
+    list = qdict_get_qlist(ret, "return");
+    entry = qobject_to_qdict(qlist_pop(list));
+    g_assert(qdict_haskey(entry, "error"));
+    QDECREF(entry);
+    QDECREF(ret);
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-info'}");
+    g_assert_nonnull(qdict_get_qdict(ret, "return"));
+    QDECREF(ret);
+}
+
+static void test_qga_agent_stats(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    const QListEntry *entry, *bucket;
+    QDict *ret, *val, *cmd;
+    int64_t n, calls = 0;
+    int i;
+
+    /* start from scratch */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-agent-stats',"
+                 " 'arguments': { 'reset': true } }");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    for (i = 0; i < 3; i++) {
+        ret = qmp_fd(fixture->fd, "{'execute': 'guest-ping'}");
+        qmp_assert_no_error(ret);
+        QDECREF(ret);
+    }
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-file-close',"
+                 " 'arguments': { 'handle': -1 } }");
+    g_assert_nonnull(qdict_get_qdict(ret, "error"));
+    QDECREF(ret);
+    ret = qmp_fd(fixture->fd, "[ 'guest-ping' ]");
+    g_assert_nonnull(qdict_get_qdict(ret, "error"));
+    QDECREF(ret);
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-agent-stats'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "bytes-in"), >, 0);
+    g_assert_cmpint(qdict_get_int(val, "bytes-out"), >, 0);
+    g_assert_cmpint(qdict_get_int(val, "parse-errors"), ==, 1);
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(val, "commands"), entry) {
+        cmd = qobject_to_qdict(entry->value);
+        if (!g_strcmp0(qdict_get_str(cmd, "name"), "guest-ping")) {
+            g_assert_cmpint(qdict_get_int(cmd, "calls"), ==, 3);
+            g_assert_cmpint(qdict_get_int(cmd, "errors"), ==, 0);
+            g_assert_cmpint(qdict_get_int(cmd, "max-time"), <=,
+                            qdict_get_int(cmd, "total-time"));
+            n = 0;
+            QLIST_FOREACH_ENTRY(qdict_get_qlist(cmd, "histogram"), bucket) {
+                n += qint_get_int(qobject_to_qint(bucket->value));
+            }
+            g_assert_cmpint(n, ==, 3);
+        } else if (!g_strcmp0(qdict_get_str(cmd, "name"),
+                              "guest-file-close")) {
+            g_assert_cmpint(qdict_get_int(cmd, "errors"), ==, 1);
+        }
+        calls += qdict_get_int(cmd, "calls");
+    }
+    /* the pings, guest-file-close and the reset */
+    g_assert_cmpint(calls, ==, 5);
+    QDECREF(ret);
+}
+
 static void test_qga_get_vcpus(gconstpointer fix)
 {
     const TestFixture *fixture = fix;
@@ -262,12 +413,71 @@ static void test_qga_get_vcpus(gconstpointer fix)
     QDECREF(ret);
 }
 
-static void test_qga_get_fsinfo(gconstpointer fix)
+static void test_qga_set_vcpus_async(gconstpointer fix)
 {
     const TestFixture *fixture = fix;
-    QDict *ret;
+    QDict *ret, *vcpu;
     QList *list;
-    const QListEntry *entry;
+    int64_t job, cursor = 0, results = 0;
+    gchar *cmd;
+    bool done = false;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-vcpus'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    /* request the state the first cpu is already in */
+    list = qdict_get_qlist(ret, "return");
+    vcpu = qobject_to_qdict(qlist_first(list)->value);
+    cmd = g_strdup_printf("{'execute': 'guest-set-vcpus-async',"
+                          " 'arguments': {'vcpus': [{'logical-id': %" PRId64
+                          ", 'online': %s}], 'threads': 2}}",
+                          qdict_get_int(vcpu, "logical-id"),
+                          qdict_get_bool(vcpu, "online") ? "true" : "false");
+    QDECREF(ret);
+
+    ret = qmp_fd(fixture->fd, cmd);
+    g_free(cmd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    job = qdict_get_int(qdict_get_qdict(ret, "return"), "job-id");
+    QDECREF(ret);
+
+    while (!done) {
+        QDict *val;
+
+        ret = qmp_fd(fixture->fd, "{'execute': 'guest-hotplug-job-status',"
+                     " 'arguments': {'job-id': %" PRId64 ", 'cursor': %"
+                     PRId64 "}}", job, cursor);
+        g_assert_nonnull(ret);
+        qmp_assert_no_error(ret);
+        val = qdict_get_qdict(ret, "return");
+        g_assert_cmpint(qdict_get_int(val, "total"), ==, 1);
+        g_assert(!qdict_haskey(val, "mem-blks"));
+        results += qlist_size(qdict_get_qlist(val, "vcpus"));
+        cursor = qdict_get_int(val, "cursor");
+        done = qdict_get_bool(val, "done");
+        QDECREF(ret);
+        if (!done) {
+            g_usleep(G_USEC_PER_SEC / 100);
+        }
+    }
+    g_assert_cmpint(results, ==, 1);
+
+    /* the job is forgotten once it has been reported as done */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-hotplug-job-status',"
+                 " 'arguments': {'job-id': %" PRId64 "}}", job);
+    g_assert_nonnull(ret);
+    g_assert_nonnull(qdict_get_qdict(ret, "error"));
+    QDECREF(ret);
+}
+
+static void test_qga_get_fsinfo(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *ret2;
+    QList *list, *list2;
+    const QListEntry *entry, *entry2;
 
     ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-fsinfo'}");
     g_assert_nonnull(ret);
@@ -281,6 +491,18 @@ static void test_qga_get_fsinfo(gconstpointer fix)
     g_assert(qdict_haskey(qobject_to_qdict(entry->value), "type"));
     g_assert(qdict_haskey(qobject_to_qdict(entry->value), "disk"));
 
+    /* a second call is served from the cache, it must be identical */
+    ret2 = qmp_fd(fixture->fd, "{'execute': 'guest-get-fsinfo'}");
+    g_assert_nonnull(ret2);
+    qmp_assert_no_error(ret2);
+    list2 = qdict_get_qlist(ret2, "return");
+    g_assert_cmpint(qlist_size(list), ==, qlist_size(list2));
+    entry2 = qlist_first(list2);
+    g_assert_cmpstr(qdict_get_str(qobject_to_qdict(entry->value), "mountpoint"),
+                    ==,
+                    qdict_get_str(qobject_to_qdict(entry2->value), "mountpoint"));
+
+    QDECREF(ret2);
     QDECREF(ret);
 }
 
@@ -328,6 +550,167 @@ static void test_qga_get_memory_blocks(gconstpointer fix)
     QDECREF(ret);
 }
 
+static void test_qga_get_memory_status(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *val;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-memory-status'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "total"), >, 0);
+    g_assert_cmpint(qdict_get_int(val, "timestamp"), >, 0);
+    g_assert_cmpint(qdict_get_int(val, "age"), >=, 0);
+
+    QDECREF(ret);
+}
+
+static void test_qga_get_oom_status(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *val;
+    int64_t count;
+    gchar *cmd;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-oom-status'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    val = qdict_get_qdict(ret, "return");
+    count = qdict_get_int(val, "count");
+    g_assert_cmpint(count, >=, 0);
+    g_assert_cmpint(qdict_get_int(val, "cursor"), ==, count);
+    g_assert(qdict_get_bool(val, "oom-happened") == (count > 0));
+    g_assert_cmpint(qlist_size(qdict_get_qlist(val, "events")), <=, count);
+    QDECREF(ret);
+
+    /* nothing new since the cursor, unless the guest is really OOMing */
+    cmd = g_strdup_printf("{'execute': 'guest-get-oom-status',"
+                          " 'arguments': {'cursor': %" PRId64 "}}", count);
+    ret = qmp_fd(fixture->fd, cmd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "count"), >=, count);
+    g_assert_cmpint(qlist_size(qdict_get_qlist(val, "events")), ==,
+                    qdict_get_int(val, "count") - count);
+
+    QDECREF(ret);
+    g_free(cmd);
+}
+
+static void test_qga_get_processes(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *val, *proc;
+    const QListEntry *entry;
+    QList *list;
+    int64_t rss = INT64_MAX;
+    bool found = false;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-processes',"
+                 " 'arguments': {'count': 5, 'sort': 'rss'}}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "total"), >, 0);
+    list = qdict_get_qlist(val, "processes");
+    g_assert_cmpint(qlist_size(list), >, 0);
+    g_assert_cmpint(qlist_size(list), <=, 5);
+    for (entry = qlist_first(list); entry; entry = qlist_next(entry)) {
+        proc = qobject_to_qdict(entry->value);
+        g_assert_cmpint(qdict_get_int(proc, "rss"), <=, rss);
+        rss = qdict_get_int(proc, "rss");
+        g_assert_cmpint(strlen(qdict_get_str(proc, "state")), ==, 1);
+    }
+    QDECREF(ret);
+
+    /* the agent itself is in the list if all processes are asked for */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-processes',"
+                 " 'arguments': {'count': 1000}}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "interval"), >, 0);
+    list = qdict_get_qlist(val, "processes");
+    for (entry = qlist_first(list); entry; entry = qlist_next(entry)) {
+        proc = qobject_to_qdict(entry->value);
+        g_assert_cmpfloat(qdict_get_double(proc, "cpu"), >=, 0);
+        if (qdict_get_int(proc, "pid") == fixture->pid) {
+            g_assert_cmpstr(qdict_get_str(proc, "name"), ==, "qemu-ga");
+            found = true;
+        }
+    }
+    g_assert(found || qdict_get_int(val, "total") > 1000);
+    QDECREF(ret);
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-processes',"
+                 " 'arguments': {'count': -1}}");
+    g_assert_nonnull(ret);
+    val = qdict_get_qdict(ret, "error");
+    g_assert_cmpstr(qdict_get_try_str(val, "class"), ==, "GenericError");
+    QDECREF(ret);
+}
+
+static void test_qga_get_cpu_stats(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *val, *total;
+    QList *list;
+    double sum;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-cpu-stats'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "interval"), >, 0);
+    g_assert_cmpfloat(qdict_get_double(val, "load1"), >=, 0);
+    g_assert_cmpfloat(qdict_get_double(val, "context-switches"), >=, 0);
+    list = qdict_get_qlist(val, "cpus");
+    g_assert_cmpint(qlist_size(list), >, 0);
+
+    total = qdict_get_qdict(val, "total");
+    g_assert(!qdict_haskey(total, "cpu"));
+    sum = qdict_get_double(total, "user") + qdict_get_double(total, "nice") +
+          qdict_get_double(total, "system") + qdict_get_double(total, "idle") +
+          qdict_get_double(total, "iowait") + qdict_get_double(total, "irq") +
+          qdict_get_double(total, "softirq") +
+          qdict_get_double(total, "steal");
+    /* all zero if no tick elapsed */
+    g_assert(sum == 0 || (sum > 99.9 && sum < 100.1));
+
+    QDECREF(ret);
+}
+
+static void test_qga_get_disk_io_stats(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *val;
+    QList *list;
+    const QListEntry *entry;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-disk-io-stats'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    list = qdict_get_qlist(ret, "return");
+    for (entry = qlist_first(list); entry; entry = qlist_next(entry)) {
+        val = qobject_to_qdict(entry->value);
+        g_assert(qdict_haskey(val, "mount-points"));
+        g_assert_cmpint(qdict_get_int(val, "interval"), >, 0);
+        g_assert_cmpfloat(qdict_get_double(val, "read-iops"), >=, 0);
+        g_assert_cmpfloat(qdict_get_double(val, "utilization"), <=, 100);
+    }
+
+    QDECREF(ret);
+}
+
 static void test_qga_network_get_interfaces(gconstpointer fix)
 {
     const TestFixture *fixture = fix;
@@ -494,113 +877,1115 @@ static void test_qga_file_ops(gconstpointer fix)
     g_free(cmd);
 }
 
-static void test_qga_get_time(gconstpointer fix)
+static void test_qga_file_pread(gconstpointer fix)
 {
     const TestFixture *fixture = fix;
-    QDict *ret;
-    int64_t time;
+    const guchar hello[] = "Hello World!";
+    gchar *enc, *cmd;
+    const char *b64;
+    QDict *ret, *val;
+    QList *list;
+    int64_t id;
+    guchar *dec;
+    gsize count;
 
-    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-time'}");
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-file-open',"
+                 " 'arguments': { 'path': 'pread', 'mode': 'w+' } }");
     g_assert_nonnull(ret);
     qmp_assert_no_error(ret);
-
-    time = qdict_get_int(ret, "return");
-    g_assert_cmpint(time, >, 0);
-
+    id = qdict_get_int(ret, "return");
     QDECREF(ret);
-}
-
-static void test_qga_set_time(gconstpointer fix)
-{
-    const TestFixture *fixture = fix;
-    QDict *ret;
-    int64_t current, time;
-    gchar *cmd;
 
-    /* get current time */
-    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-time'}");
+    /* write the second word first, at its offset */
+    enc = g_base64_encode(hello + 6, 6);
+    cmd = g_strdup_printf("{'execute': 'guest-file-pwrite',"
+                          " 'arguments': { 'handle': %" PRId64 ","
+                          " 'offset': 6, 'buf-b64': '%s' } }", id, enc);
+    ret = qmp_fd(fixture->fd, cmd);
     g_assert_nonnull(ret);
     qmp_assert_no_error(ret);
-    current = qdict_get_int(ret, "return");
-    g_assert_cmpint(current, >, 0);
+    g_assert_cmpint(qdict_get_int(qdict_get_qdict(ret, "return"), "count"),
+                    ==, 6);
     QDECREF(ret);
+    g_free(cmd);
+    g_free(enc);
 
-    /* set some old time */
-    ret = qmp_fd(fixture->fd, "{'execute': 'guest-set-time',"
-                 " 'arguments': { 'time': 1000 } }");
+    enc = g_base64_encode(hello, 6);
+    cmd = g_strdup_printf("{'execute': 'guest-file-pwrite',"
+                          " 'arguments': { 'handle': %" PRId64 ","
+                          " 'offset': 0, 'buf-b64': '%s' } }", id, enc);
+    ret = qmp_fd(fixture->fd, cmd);
     g_assert_nonnull(ret);
     qmp_assert_no_error(ret);
     QDECREF(ret);
+    g_free(cmd);
+    g_free(enc);
 
-    /* check old time */
-    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-time'}");
+    /* positional read */
+    cmd = g_strdup_printf("{'execute': 'guest-file-pread',"
+                          " 'arguments': { 'handle': %" PRId64 ","
+                          " 'offset': 6, 'count': 100 } }", id);
+    ret = qmp_fd(fixture->fd, cmd);
     g_assert_nonnull(ret);
     qmp_assert_no_error(ret);
-    time = qdict_get_int(ret, "return");
-    g_assert_cmpint(time / 1000, <, G_USEC_PER_SEC * 10);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "count"), ==, 6);
+    g_assert(qdict_get_bool(val, "eof"));
+    dec = g_base64_decode(qdict_get_str(val, "buf-b64"), &count);
+    g_assert_cmpmem(dec, count, hello + 6, 6);
+    g_free(dec);
     QDECREF(ret);
+    g_free(cmd);
 
-    /* set back current time */
-    cmd = g_strdup_printf("{'execute': 'guest-set-time',"
-                          " 'arguments': { 'time': %" PRId64 " } }",
-                          current + time * 1000);
+    /* vectored read, the file position is still at 0 */
+    cmd = g_strdup_printf("{'execute': 'guest-file-read-vector',"
+                          " 'arguments': { 'requests': ["
+                          " { 'handle': %" PRId64 ", 'count': 5 },"
+                          " { 'handle': -1 },"
+                          " { 'handle': %" PRId64 ", 'offset': 6 } ] } }",
+                          id, id);
     ret = qmp_fd(fixture->fd, cmd);
-    g_free(cmd);
     g_assert_nonnull(ret);
     qmp_assert_no_error(ret);
+    list = qdict_get_qlist(ret, "return");
+    g_assert_cmpint(qlist_size(list), ==, 3);
+
+    val = qobject_to_qdict(qlist_pop(list));
+    b64 = qdict_get_str(qdict_get_qdict(val, "data"), "buf-b64");
+    dec = g_base64_decode(b64, &count);
+    g_assert_cmpmem(dec, count, hello, 5);
+    g_free(dec);
+    QDECREF(val);
+
+    val = qobject_to_qdict(qlist_pop(list));
+    g_assert(qdict_haskey(val, "error"));
+    g_assert(!qdict_haskey(val, "data"));
+    QDECREF(val);
+
+    val = qobject_to_qdict(qlist_pop(list));
+    g_assert_cmpint(qdict_get_int(qdict_get_qdict(val, "data"), "count"),
+                    ==, 6);
+    QDECREF(val);
+    QDECREF(ret);
+    g_free(cmd);
+
+    cmd = g_strdup_printf("{'execute': 'guest-file-close',"
+                          " 'arguments': {'handle': %" PRId64 "} }", id);
+    ret = qmp_fd(fixture->fd, cmd);
+    qmp_assert_no_error(ret);
     QDECREF(ret);
+    g_free(cmd);
 }
 
-static void test_qga_fstrim(gconstpointer fix)
+static void test_qga_file_delta(gconstpointer fix)
 {
     const TestFixture *fixture = fix;
-    QDict *ret;
+    guchar content[3 * 512 + 100];
+    gchar *path, *symlink_path, *cmd, *sha, *expected, *enc;
+    gchar *data = NULL;
+    gsize len;
+    QDict *ret, *val, *block;
     QList *list;
-    const QListEntry *entry;
+    int i;
 
-    ret = qmp_fd(fixture->fd, "{'execute': 'guest-fstrim',"
-                 " arguments: { minimum: 4194304 } }");
+    for (i = 0; i < sizeof(content); i++) {
+        content[i] = i * 7;
+    }
+    path = g_build_filename(fixture->test_dir, "delta", NULL);
+    g_assert(g_file_set_contents(path, (gchar *)content, sizeof(content),
+                                 NULL));
+
+    cmd = g_strdup_printf("{'execute': 'guest-file-checksum',"
+                          " 'arguments': { 'path': '%s',"
+                          " 'block-size': 512 } }", path);
+    ret = qmp_fd(fixture->fd, cmd);
+    g_free(cmd);
     g_assert_nonnull(ret);
     qmp_assert_no_error(ret);
-    list = qdict_get_qlist(ret, "return");
-    entry = qlist_first(list);
-    g_assert(qdict_haskey(qobject_to_qdict(entry->value), "paths"));
-
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "size"), ==, sizeof(content));
+    sha = g_compute_checksum_for_data(G_CHECKSUM_SHA256, content,
+                                      sizeof(content));
+    g_assert_cmpstr(qdict_get_str(val, "sha256"), ==, sha);
+    g_free(sha);
+    list = qdict_get_qlist(val, "blocks");
+    g_assert_cmpint(qlist_size(list), ==, 4);
+    block = qobject_to_qdict(qlist_first(list)->value);
+    g_assert_cmpint(strlen(qdict_get_str(block, "strong")), ==, 16);
     QDECREF(ret);
-}
-
-static void test_qga_blacklist(gconstpointer data)
-{
-    TestFixture fix;
-    QDict *ret, *error;
-    const gchar *class, *desc;
 
-    fixture_setup(&fix, "-b guest-ping,guest-get-time");
+    /* new version: last two blocks, some data, then the first block */
+    expected = g_malloc(sizeof(content) + 3);
+    memcpy(expected, content + 1024, sizeof(content) - 1024);
+    memcpy(expected + sizeof(content) - 1024, "new", 3);
+    memcpy(expected + sizeof(content) - 1024 + 3, content, 512);
+    len = sizeof(content) - 1024 + 3 + 512;
+    sha = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (guchar *)expected,
+                                      len);
+    enc = g_base64_encode((const guchar *)"new", 3);
+
+    /* a wrong checksum leaves the file alone */
+    cmd = g_strdup_printf("{'execute': 'guest-file-apply-delta',"
+                          " 'arguments': { 'path': '%s', 'block-size': 512,"
+                          " 'ops': [ { 'block': 2, 'count': 2 },"
+                          " { 'data': '%s' }, { 'block': 0 } ],"
+                          " 'sha256': '%s' } }", path, enc,
+                          "00000000000000000000000000000000"
+                          "00000000000000000000000000000000");
+    ret = qmp_fd(fixture->fd, cmd);
+    g_free(cmd);
+    g_assert_nonnull(ret);
+    g_assert_nonnull(qdict_get_qdict(ret, "error"));
+    QDECREF(ret);
+    g_assert(g_file_get_contents(path, &data, &len, NULL));
+    g_assert_cmpmem(data, len, content, sizeof(content));
+    g_free(data);
+
+    /* going through a symlink updates its target and keeps the link */
+    symlink_path = g_build_filename(fixture->test_dir, "delta-link", NULL);
+    g_assert_cmpint(symlink(path, symlink_path), ==, 0);
+    cmd = g_strdup_printf("{'execute': 'guest-file-apply-delta',"
+                          " 'arguments': { 'path': '%s', 'block-size': 512,"
+                          " 'ops': [ { 'block': 2, 'count': 2 },"
+                          " { 'data': '%s' }, { 'block': 0 } ],"
+                          " 'sha256': '%s' } }", symlink_path, enc, sha);
+    ret = qmp_fd(fixture->fd, cmd);
+    g_free(cmd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpstr(qdict_get_str(val, "sha256"), ==, sha);
+    QDECREF(ret);
+
+    g_assert(g_file_get_contents(path, &data, &len, NULL));
+    g_assert_cmpmem(data, len, expected, sizeof(content) - 1024 + 3 + 512);
+    g_free(data);
+    g_assert(g_file_test(symlink_path, G_FILE_TEST_IS_SYMLINK));
+
+    unlink(symlink_path);
+    g_free(symlink_path);
+    unlink(path);
+    g_free(enc);
+    g_free(sha);
+    g_free(expected);
+    g_free(path);
+}
+
+static int64_t qga_set_binary_transfer(int fd, bool enable,
+                                       int64_t chunk_size)
+{
+    QDict *ret, *val;
+    int64_t size;
+
+    ret = qmp_fd(fd, "{'execute': 'guest-set-binary-transfer',"
+                 " 'arguments': { 'enable': %i, 'chunk-size': %" PRId64 " } }",
+                 enable, chunk_size);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_bool(val, "enabled"), ==, enable);
+    size = qdict_get_int(val, "chunk-size");
+    QDECREF(ret);
+
+    return size;
+}
+
+static int64_t qga_file_open(int fd, const char *path, const char *mode)
+{
+    QDict *ret;
+    int64_t id;
+
+    ret = qmp_fd(fd, "{'execute': 'guest-file-open',"
+                 " 'arguments': { 'path': %s, 'mode': %s } }", path, mode);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    id = qdict_get_int(ret, "return");
+    QDECREF(ret);
+
+    return id;
+}
+
+static void qga_file_close(int fd, int64_t id)
+{
+    QDict *ret;
+
+    ret = qmp_fd(fd, "{'execute': 'guest-file-close',"
+                 " 'arguments': {'handle': %" PRId64 "} }", id);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+}
+
+static void read_all(int fd, void *buf, size_t size)
+{
+    ssize_t ret;
+
+    while (size) {
+        ret = read(fd, buf, size);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(ret, >, 0);
+        buf = (char *)buf + ret;
+        size -= ret;
+    }
+}
+
+static void write_all(int fd, const void *buf, size_t size)
+{
+    ssize_t ret;
+
+    while (size) {
+        ret = write(fd, buf, size);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(ret, >, 0);
+        buf = (const char *)buf + ret;
+        size -= ret;
+    }
+}
+
+/* send @size bytes of @buf as data frames, followed by the end frame */
+static void qga_send_frames(int fd, const guchar *buf, size_t size,
+                            size_t chunk_size)
+{
+    uint8_t hdr[4];
+    size_t len;
+
+    do {
+        len = MIN(size, chunk_size);
+        stl_be_p(hdr, len);
+        write_all(fd, hdr, sizeof(hdr));
+        write_all(fd, buf, len);
+        buf += len;
+        size -= len;
+    } while (len);
+}
+
+/* receive data frames into @buf up to the end frame, returns the total */
+/* the frames start after the newline that ends the JSON response */
+static size_t qga_receive_frames(int fd, guchar *buf, size_t size,
+                                 size_t chunk_size)
+{
+    uint8_t hdr[4];
+    size_t len, total = 0;
+    char c;
+
+    read_all(fd, &c, 1);
+    g_assert_cmpint(c, ==, '\n');
+    do {
+        read_all(fd, hdr, sizeof(hdr));
+        len = ldl_be_p(hdr);
+        g_assert_cmpint(len, <=, chunk_size);
+        g_assert_cmpint(total + len, <=, size);
+        read_all(fd, buf + total, len);
+        total += len;
+    } while (len);
+
+    return total;
+}
+
+static int64_t qga_set_compression(int fd, bool enable, int64_t threshold)
+{
+    QDict *ret;
+
+    ret = qmp_fd(fd, "{'execute': 'guest-set-compression',"
+                 " 'arguments': { 'enable': %i, 'threshold': %" PRId64 " } }",
+                 enable, threshold);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    g_assert_cmpint(qdict_get_bool(qdict_get_qdict(ret, "return"), "enabled"),
+                    ==, enable);
+    QDECREF(ret);
+
+    return threshold;
+}
+
+/*
+ * Receive a response that may be compressed, optionally adding the number
+ * of bytes it took on the channel to @wire.
+ */
+static QDict *qga_receive_response(int fd, size_t *wire, bool *compressed)
+{
+    GString *json = g_string_new(NULL);
+    uint8_t hdr[8];
+    uLongf len;
+    guchar *zbuf;
+    QObject *obj;
+    char c;
+
+    read_all(fd, &c, 1);
+    *compressed = (uint8_t)c == 0xFE;
+    if (*compressed) {
+        read_all(fd, hdr, sizeof(hdr));
+        zbuf = g_malloc(ldl_be_p(hdr));
+        read_all(fd, zbuf, ldl_be_p(hdr));
+        len = ldl_be_p(hdr + 4);
+        g_string_set_size(json, len);
+        g_assert_cmpint(uncompress((Bytef *)json->str, &len, zbuf,
+                                   ldl_be_p(hdr)), ==, Z_OK);
+        g_assert_cmpint(len, ==, ldl_be_p(hdr + 4));
+        g_free(zbuf);
+        if (wire) {
+            *wire += 1 + sizeof(hdr) + ldl_be_p(hdr);
+        }
+    } else {
+        while (c != '\n') {
+            g_string_append_c(json, c);
+            read_all(fd, &c, 1);
+        }
+        if (wire) {
+            *wire += json->len + 1;
+        }
+    }
+
+    obj = qobject_from_json(json->str);
+    g_assert_nonnull(obj);
+    g_string_free(json, true);
+    return qobject_to_qdict(obj);
+}
+
+static void test_qga_compression(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    bool compressed;
+    QDict *ret;
+
+    qga_set_compression(fixture->fd, true, 64);
+
+    /* the list of commands is large and repetitive */
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-info'}");
+    ret = qga_receive_response(fixture->fd, NULL, &compressed);
+    g_assert(compressed);
+    qmp_assert_no_error(ret);
+    g_assert(qdict_haskey(qdict_get_qdict(ret, "return"), "version"));
+    QDECREF(ret);
+
+    /* small responses are sent as is */
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-ping'}");
+    ret = qga_receive_response(fixture->fd, NULL, &compressed);
+    g_assert(!compressed);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-set-compression',"
+                " 'arguments': { 'enable': false } }");
+    ret = qga_receive_response(fixture->fd, NULL, &compressed);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-info'}");
+    ret = qga_receive_response(fixture->fd, NULL, &compressed);
+    g_assert(!compressed);
+    QDECREF(ret);
+}
+
+static void test_qga_file_raw(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    const size_t size = 10000;
+    guchar *data, *buf;
+    int64_t id, chunk_size;
+    QDict *ret, *val;
+    size_t i, count;
+
+    data = g_malloc(size);
+    buf = g_malloc(size);
+    for (i = 0; i < size; i++) {
+        data[i] = i * 7;
+    }
+
+    /* raw transfers need to be negotiated first */
+    id = qga_file_open(fixture->fd, "raw", "w+");
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-file-read-raw',"
+                 " 'arguments': {'handle': %" PRId64 "} }", id);
+    g_assert_nonnull(ret);
+    g_assert(qdict_haskey(ret, "error"));
+    QDECREF(ret);
+
+    chunk_size = qga_set_binary_transfer(fixture->fd, true, 1);
+    g_assert_cmpint(chunk_size, ==, 4096);
+
+    /* write, the data follows the request */
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-file-write-raw',"
+                " 'arguments': {'handle': %" PRId64 "} }", id);
+    qga_send_frames(fixture->fd, data, size, 3000);
+    ret = qmp_fd_receive(fixture->fd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "count"), ==, size);
+    QDECREF(ret);
+
+    /* the frames of a failing write are consumed all the same */
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-file-write-raw',"
+                " 'arguments': {'handle': -1} }");
+    qga_send_frames(fixture->fd, data, 100, 3000);
+    ret = qmp_fd_receive(fixture->fd);
+    g_assert_nonnull(ret);
+    g_assert(qdict_haskey(ret, "error"));
+    QDECREF(ret);
+
+    /*
+     * read back from an offset, the data follows the response; a request
+     * sent meanwhile is answered once the data is through
+     */
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-file-read-raw',"
+                " 'arguments': {'handle': %" PRId64 ", 'offset': 100} }",
+                id);
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-ping'}");
+    ret = qmp_fd_receive(fixture->fd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "count"), ==, size - 100);
+    g_assert(qdict_get_bool(val, "eof"));
+    QDECREF(ret);
+
+    count = qga_receive_frames(fixture->fd, buf, size, chunk_size);
+    g_assert_cmpint(count, ==, size - 100);
+    g_assert(memcmp(buf, data + 100, count) == 0);
+    ret = qmp_fd_receive(fixture->fd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    /* the channel is back to plain JSON afterwards */
+    qga_file_close(fixture->fd, id);
+    qga_set_binary_transfer(fixture->fd, false, 0);
+
+    g_free(data);
+    g_free(buf);
+}
+
+static void test_qga_exec_read(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    const int64_t max_bytes = 16 * 1024;
+    int64_t pid, out_cursor = 0, err_cursor = 0, out_total = 0;
+    GString *err_data = g_string_new(NULL);
+    const char *b64;
+    QDict *ret, *val;
+    guchar *dec;
+    gsize len, i;
+    bool exited;
+
+    /* more output than the agent buffers, so reading has to pause */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-exec', 'arguments': {"
+                 " 'path': '/bin/sh', 'arg': [ '-c',"
+                 " 'head -c 200000 /dev/zero; echo done >&2' ],"
+                 " 'stream-output': true } }");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    pid = qdict_get_int(qdict_get_qdict(ret, "return"), "pid");
+    QDECREF(ret);
+
+    do {
+        ret = qmp_fd(fixture->fd, "{'execute': 'guest-exec-read',"
+                     " 'arguments': { 'pid': %" PRId64 ","
+                     " 'out-cursor': %" PRId64 ", 'err-cursor': %" PRId64 ","
+                     " 'max-bytes': %" PRId64 " } }",
+                     pid, out_cursor, err_cursor, max_bytes);
+        g_assert_nonnull(ret);
+        qmp_assert_no_error(ret);
+        val = qdict_get_qdict(ret, "return");
+
+        b64 = qdict_get_try_str(val, "out-data");
+        if (b64) {
+            dec = g_base64_decode(b64, &len);
+            g_assert_cmpint(len, <=, max_bytes);
+            for (i = 0; i < len; i++) {
+                g_assert_cmpint(dec[i], ==, 0);
+            }
+            out_total += len;
+            g_free(dec);
+        }
+        out_cursor = qdict_get_int(val, "out-cursor");
+        g_assert_cmpint(out_cursor, ==, out_total);
+
+        b64 = qdict_get_try_str(val, "err-data");
+        if (b64) {
+            dec = g_base64_decode(b64, &len);
+            g_string_append_len(err_data, (gchar *)dec, len);
+            g_free(dec);
+        }
+        err_cursor = qdict_get_int(val, "err-cursor");
+        g_assert_cmpint(err_cursor, ==, err_data->len);
+
+        exited = qdict_get_bool(val, "exited");
+        if (exited) {
+            g_assert_cmpint(qdict_get_int(val, "exitcode"), ==, 0);
+        } else if (!qdict_haskey(val, "out-data") &&
+                   !qdict_haskey(val, "err-data")) {
+            g_usleep(10 * 1000);
+        }
+        QDECREF(ret);
+    } while (!exited);
+
+    g_assert_cmpint(out_total, ==, 200000);
+    g_assert_cmpstr(err_data->str, ==, "done\n");
+    g_string_free(err_data, true);
+
+    /* the process has been reaped */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-exec-status',"
+                 " 'arguments': { 'pid': %" PRId64 " } }", pid);
+    g_assert_nonnull(ret);
+    g_assert(qdict_haskey(ret, "error"));
+    QDECREF(ret);
+}
+
+static void test_qga_get_time(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret;
+    int64_t time;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-time'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    time = qdict_get_int(ret, "return");
+    g_assert_cmpint(time, >, 0);
+
+    QDECREF(ret);
+}
+
+static void test_qga_set_time(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret;
+    int64_t current, time;
+    gchar *cmd;
+
+    /* get current time */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-time'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    current = qdict_get_int(ret, "return");
+    g_assert_cmpint(current, >, 0);
+    QDECREF(ret);
+
+    /* set some old time */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-set-time',"
+                 " 'arguments': { 'time': 1000 } }");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    /* check old time */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-get-time'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    time = qdict_get_int(ret, "return");
+    g_assert_cmpint(time / 1000, <, G_USEC_PER_SEC * 10);
+    QDECREF(ret);
+
+    /* set back current time */
+    cmd = g_strdup_printf("{'execute': 'guest-set-time',"
+                          " 'arguments': { 'time': %" PRId64 " } }",
+                          current + time * 1000);
+    ret = qmp_fd(fixture->fd, cmd);
+    g_free(cmd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+}
+
+static void test_qga_fstrim(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret;
+    QList *list;
+    const QListEntry *entry;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-fstrim',"
+                 " arguments: { minimum: 4194304 } }");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    list = qdict_get_qlist(ret, "return");
+    entry = qlist_first(list);
+    g_assert(qdict_haskey(qobject_to_qdict(entry->value), "paths"));
+
+    QDECREF(ret);
+}
+
+static void test_qga_blacklist(gconstpointer data)
+{
+    TestFixture fix;
+    QDict *ret, *error;
+    const gchar *class, *desc;
+
+    fixture_setup(&fix, "-b guest-ping,guest-get-time");
+
+    /* check blacklist */
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-ping'}");
+    g_assert_nonnull(ret);
+    error = qdict_get_qdict(ret, "error");
+    class = qdict_get_try_str(error, "class");
+    desc = qdict_get_try_str(error, "desc");
+    g_assert_cmpstr(class, ==, "GenericError");
+    g_assert_nonnull(g_strstr_len(desc, -1, "has been disabled"));
+    QDECREF(ret);
+
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-get-time'}");
+    g_assert_nonnull(ret);
+    error = qdict_get_qdict(ret, "error");
+    class = qdict_get_try_str(error, "class");
+    desc = qdict_get_try_str(error, "desc");
+    g_assert_cmpstr(class, ==, "GenericError");
+    g_assert_nonnull(g_strstr_len(desc, -1, "has been disabled"));
+    QDECREF(ret);
+
+    /* check something work */
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-get-fsinfo'}");
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    fixture_tear_down(&fix, NULL);
+}
+
+static void test_qga_async(gconstpointer data)
+{
+    TestFixture fix;
+    QDict *ret, *entry;
+    QList *list;
+
+    fixture_setup_with_conf(&fix, "[general]\n"
+                            "async-workers=2\n"
+                            "command-timeout=30\n");
+
+    /* guest-get-fsinfo is a blocking command, run by a worker */
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-get-fsinfo', 'id': 'fsinfo'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    g_assert_cmpstr(qdict_get_try_str(ret, "id"), ==, "fsinfo");
+    QDECREF(ret);
+
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-ping', 'id': 42}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    g_assert_cmpint(qdict_get_int(ret, "id"), ==, 42);
+    QDECREF(ret);
+
+    /* so are blocking commands of a batch, the others stay in order */
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-batch', 'id': 'batch',"
+                 " 'arguments': { 'commands': ["
+                 "   {'execute': 'guest-sync', 'arguments': {'id': 1}},"
+                 "   {'execute': 'guest-get-fsinfo'},"
+                 "   {'execute': 'guest-invalid-cmd'},"
+                 "   {'execute': 'guest-sync', 'arguments': {'id': 2}} ] } }");
+    qmp_assert_no_error(ret);
+    g_assert_cmpstr(qdict_get_try_str(ret, "id"), ==, "batch");
+    list = qdict_get_qlist(ret, "return");
+    g_assert_cmpint(qlist_size(list), ==, 4);
+    entry = qobject_to_qdict(qlist_pop(list));
+    g_assert_cmpint(qdict_get_int(entry, "return"), ==, 1);
+    QDECREF(entry);
+    entry = qobject_to_qdict(qlist_pop(list));
+    qmp_assert_no_error(entry);
+    g_assert(qdict_haskey(entry, "return"));
+    QDECREF(entry);
+    entry = qobject_to_qdict(qlist_pop(list));
+    g_assert(qdict_haskey(entry, "error"));
+    QDECREF(entry);
+    entry = qobject_to_qdict(qlist_pop(list));
+    g_assert_cmpint(qdict_get_int(entry, "return"), ==, 2);
+    QDECREF(entry);
+    QDECREF(ret);
+
+    fixture_tear_down(&fix, NULL);
+}
+
+static void test_qga_async_wedged(gconstpointer data)
+{
+    TestFixture fix;
+    QDict *ret, *error;
+    char *fifo;
+    int fd, i;
+
+    fixture_setup_with_conf(&fix, "[general]\n"
+                            "async-workers=1\n"
+                            "command-timeout=1\n");
+
+    /* opening a fifo without a writer wedges the worker */
+    fifo = g_build_filename(fix.test_dir, "fifo", NULL);
+    g_assert_cmpint(mkfifo(fifo, 0600), ==, 0);
+
+    for (i = 0; i < 2; i++) {
+        ret = qmp_fd(fix.fd, "{'execute': 'guest-file-checksum',"
+                     " 'arguments': { 'path': %s } }", fifo);
+        g_assert_nonnull(qdict_get_qdict(ret, "error"));
+        QDECREF(ret);
+
+        /* the stuck worker is replaced once, then commands fail fast */
+        ret = qmp_fd(fix.fd, "{'execute': 'guest-get-fsinfo'}");
+        if (i == 0) {
+            qmp_assert_no_error(ret);
+        } else {
+            error = qdict_get_qdict(ret, "error");
+            g_assert_nonnull(error);
+            g_assert_nonnull(strstr(qdict_get_str(error, "desc"), "stuck"));
+        }
+        QDECREF(ret);
+    }
+
+    /* a writer lets both workers go */
+    fd = open(fifo, O_WRONLY | O_NONBLOCK);
+    g_assert_cmpint(fd, !=, -1);
+    close(fd);
+
+    for (i = 0; i < 50; i++) {
+        ret = qmp_fd(fix.fd, "{'execute': 'guest-get-fsinfo'}");
+        if (!qdict_haskey(ret, "error")) {
+            break;
+        }
+        QDECREF(ret);
+        g_usleep(G_USEC_PER_SEC / 10);
+    }
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    unlink(fifo);
+    g_free(fifo);
+    fixture_tear_down(&fix, NULL);
+}
+
+static void test_qga_multi_client(gconstpointer data)
+{
+    TestFixture fix;
+    QDict *ret;
+    char *path;
+    int fd;
+
+    fixture_setup_with_conf(&fix, "[general]\n"
+                            "max-connections=2\n");
 
-    /* check blacklist */
-    ret = qmp_fd(fix.fd, "{'execute': 'guest-ping'}");
-    g_assert_nonnull(ret);
-    error = qdict_get_qdict(ret, "error");
-    class = qdict_get_try_str(error, "class");
-    desc = qdict_get_try_str(error, "desc");
-    g_assert_cmpstr(class, ==, "GenericError");
-    g_assert_nonnull(g_strstr_len(desc, -1, "has been disabled"));
+    path = g_build_filename(fix.test_dir, "sock", NULL);
+    fd = connect_qga(path);
+    g_assert_cmpint(fd, !=, -1);
+
+    /* each client gets the responses to its own requests */
+    qmp_fd_send(fix.fd, "{'execute': 'guest-ping', 'id': 1}");
+    qmp_fd_send(fd, "{'execute': 'guest-ping', 'id': 2}");
+    ret = qmp_fd_receive(fd);
+    qmp_assert_no_error(ret);
+    g_assert_cmpint(qdict_get_int(ret, "id"), ==, 2);
+    QDECREF(ret);
+    ret = qmp_fd_receive(fix.fd);
+    qmp_assert_no_error(ret);
+    g_assert_cmpint(qdict_get_int(ret, "id"), ==, 1);
     QDECREF(ret);
 
-    ret = qmp_fd(fix.fd, "{'execute': 'guest-get-time'}");
-    g_assert_nonnull(ret);
-    error = qdict_get_qdict(ret, "error");
-    class = qdict_get_try_str(error, "class");
-    desc = qdict_get_try_str(error, "desc");
-    g_assert_cmpstr(class, ==, "GenericError");
-    g_assert_nonnull(g_strstr_len(desc, -1, "has been disabled"));
+    /* and connection state of its own */
+    qga_set_compression(fd, true, 64);
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-info'}");
+    qmp_assert_no_error(ret);
     QDECREF(ret);
 
-    /* check something work */
-    ret = qmp_fd(fix.fd, "{'execute': 'guest-get-fsinfo'}");
+    close(fd);
+    fd = connect_qga(path);
+    g_assert_cmpint(fd, !=, -1);
+    ret = qmp_fd(fd, "{'execute': 'guest-ping'}");
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+    close(fd);
+
+    fixture_tear_down(&fix, NULL);
+    g_free(path);
+}
+
+/*
+ * A client that does not read its responses neither holds up the other
+ * clients nor has the agent queue output for it without bound.
+ */
+static void test_qga_slow_client(gconstpointer data)
+{
+    const int size = 1024 * 1024;
+    struct timeval tv = { .tv_sec = 10 };
+    TestFixture fix;
+    QDict *ret;
+    char *path, *file, *contents, buf[4096];
+    int64_t id, start;
+    ssize_t len;
+    int fd, i;
+
+    fixture_setup_with_conf(&fix, "[general]\n"
+                            "max-connections=2\n");
+    path = g_build_filename(fix.test_dir, "sock", NULL);
+    fd = connect_qga(path);
+    g_assert_cmpint(fd, !=, -1);
+
+    file = g_build_filename(fix.test_dir, "slow", NULL);
+    contents = g_malloc0(size);
+    g_assert(g_file_set_contents(file, contents, size, NULL));
+    id = qga_file_open(fix.fd, file, "r");
+
+    /* ask for far more than the socket holds, without reading any of it */
+    for (i = 0; i < 8; i++) {
+        qmp_fd_send(fix.fd, "{'execute': 'guest-file-pread',"
+                    " 'arguments': { 'handle': %" PRId64 ", 'offset': 0,"
+                    " 'count': %d } }", id, size);
+    }
+    g_usleep(G_USEC_PER_SEC / 10);
+
+    start = g_get_monotonic_time();
+    ret = qmp_fd(fd, "{'execute': 'guest-ping'}");
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+    g_assert_cmpint(g_get_monotonic_time() - start, <, G_USEC_PER_SEC);
+
+    /* the slow client is disconnected once too much is queued for it */
+    setsockopt(fix.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    do {
+        len = read(fix.fd, buf, sizeof(buf));
+    } while (len > 0);
+    g_assert_cmpint(len, ==, 0);
+
+    ret = qmp_fd(fd, "{'execute': 'guest-ping'}");
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+    close(fd);
+
+    fixture_tear_down(&fix, NULL);
+    unlink(file);
+    g_free(contents);
+    g_free(file);
+    g_free(path);
+}
+
+/* user and system time used by @pid, in clock ticks */
+static int64_t qga_cpu_ticks(GPid pid)
+{
+    gchar *path, *stat, *p;
+    unsigned long utime, stime;
+    int64_t ticks = -1;
+
+    path = g_strdup_printf("/proc/%d/stat", (int)pid);
+    if (g_file_get_contents(path, &stat, NULL, NULL)) {
+        p = strrchr(stat, ')');
+        if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                        "%lu %lu", &utime, &stime) == 2) {
+            ticks = utime + stime;
+        }
+        g_free(stat);
+    }
+    g_free(path);
+
+    return ticks;
+}
+
+#ifdef SYS_pidfd_getfd
+/* the descriptor @pid has open on a file whose name ends in @name, or -1 */
+static int qga_find_fd(GPid pid, const char *name)
+{
+    gchar *dir, *link, *target;
+    const gchar *entry;
+    GDir *d;
+    int fd = -1;
+
+    dir = g_strdup_printf("/proc/%d/fd", (int)pid);
+    d = g_dir_open(dir, 0, NULL);
+    while (d && fd == -1 && (entry = g_dir_read_name(d))) {
+        link = g_build_filename(dir, entry, NULL);
+        target = g_file_read_link(link, NULL);
+        if (target && g_str_has_suffix(target, name)) {
+            fd = atoi(entry);
+        }
+        g_free(target);
+        g_free(link);
+    }
+    if (d) {
+        g_dir_close(d);
+    }
+    g_free(dir);
+
+    return fd;
+}
+
+static int qga_open_pty_slave(int master)
+{
+    struct termios tio;
+    int fd;
+
+    fd = open(ptsname(master), O_RDWR | O_NOCTTY);
+    g_assert_cmpint(fd, !=, -1);
+    g_assert_cmpint(tcgetattr(fd, &tio), ==, 0);
+    cfmakeraw(&tio);
+    g_assert_cmpint(tcsetattr(fd, TCSANOW, &tio), ==, 0);
+
+    return fd;
+}
+
+/*
+ * The agent gets a pty master as its virtio-serial port, and the test
+ * plays the host by opening and closing the slave. Like a port without a
+ * host, the master polls as hung up while the slave is closed, but unlike
+ * virtio-serial it raises no SIGIO when the slave is opened again, so the
+ * test sends that itself.
+ */
+static void test_qga_virtio_serial(gconstpointer data)
+{
+    GError *error = NULL;
+    gchar *dir, *cwd, *cmd, *tmp, **argv;
+    int64_t ticks, start;
+    bool compressed;
+    QDict *ret;
+    GPid pid;
+    int pidfd, num = -1, master = -1, fd, status, i;
+
+    dir = g_strdup("/tmp/qgatest.XXXXXX");
+    g_assert_nonnull(mkdtemp(dir));
+    cwd = g_get_current_dir();
+    cmd = g_strdup_printf("%s%cqemu-ga -m virtio-serial -t %s -p /dev/ptmx %s",
+                          cwd, G_DIR_SEPARATOR, dir,
+                          getenv("QTEST_LOG") ? "-v" : "");
+    g_shell_parse_argv(cmd, NULL, &argv, &error);
+    g_assert_no_error(error);
+    g_spawn_async(dir, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                  NULL, NULL, &pid, &error);
+    g_assert_no_error(error);
+
+    for (i = 0; i < 100 && num == -1; i++) {
+        g_usleep(G_USEC_PER_SEC / 100);
+        num = qga_find_fd(pid, "ptmx");
+    }
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd != -1 && num != -1) {
+        master = syscall(SYS_pidfd_getfd, pidfd, num, 0);
+    }
+    if (master == -1) {
+        g_test_message("cannot get hold of the agent's pty, skipping");
+        goto out;
+    }
+    g_assert_cmpint(unlockpt(master), ==, 0);
+
+    fd = qga_open_pty_slave(master);
+    ret = qmp_fd(fd, "{'execute': 'guest-sync', 'arguments': {'id': 7}}");
+    qmp_assert_no_error(ret);
+    g_assert_cmpint(qdict_get_int(ret, "return"), ==, 7);
+    QDECREF(ret);
+    qga_set_compression(fd, true, 64);
+
+    /* the agent parks the hung up port instead of exiting or spinning */
+    close(fd);
+    g_usleep(G_USEC_PER_SEC / 10);
+    ticks = qga_cpu_ticks(pid);
+    g_usleep(G_USEC_PER_SEC / 2);
+    g_assert_cmpint(waitpid(pid, &status, WNOHANG), ==, 0);
+    g_assert_cmpint(qga_cpu_ticks(pid) - ticks, <,
+                    sysconf(_SC_CLK_TCK) / 4);
+
+    /* and answers the next host right away, as a new client */
+    start = g_get_monotonic_time();
+    fd = qga_open_pty_slave(master);
+    kill(pid, SIGIO);
+    ret = qmp_fd(fd, "{'execute': 'guest-sync', 'arguments': {'id': 8}}");
+    g_assert_cmpint(g_get_monotonic_time() - start, <, G_USEC_PER_SEC / 2);
+    qmp_assert_no_error(ret);
+    g_assert_cmpint(qdict_get_int(ret, "return"), ==, 8);
+    QDECREF(ret);
+
+    qmp_fd_send(fd, "{'execute': 'guest-info'}");
+    ret = qga_receive_response(fd, NULL, &compressed);
+    qmp_assert_no_error(ret);
+    g_assert(!compressed);
+    QDECREF(ret);
+    close(fd);
+    close(master);
+
+out:
+    if (pidfd != -1) {
+        close(pidfd);
+    }
+    kill(pid, SIGTERM);
+    g_assert_cmpint(waitpid(pid, &status, 0), ==, pid);
+    g_spawn_close_pid(pid);
+
+    tmp = g_build_filename(dir, "qga.state", NULL);
+    g_unlink(tmp);
+    g_free(tmp);
+    g_rmdir(dir);
+    g_strfreev(argv);
+    g_free(cmd);
+    g_free(cwd);
+    g_free(dir);
+}
+#endif
+
+static void test_qga_dispatch_arena(gconstpointer data)
+{
+    TestFixture fix;
+    QDict *ret, *val;
+    QList *list;
+    char *path;
+    int64_t id;
+    int i;
+
+    fixture_setup_with_conf(&fix, "[general]\n"
+                            "dispatch-arena=true\n");
+
+    /* the arena is reused from one request to the next */
+    for (i = 0; i < 3; i++) {
+        ret = qmp_fd(fix.fd, "{'execute': 'guest-info', 'id': %d}", i);
+        qmp_assert_no_error(ret);
+        g_assert_cmpint(qdict_get_int(ret, "id"), ==, i);
+        list = qdict_get_qlist(qdict_get_qdict(ret, "return"),
+                               "supported_commands");
+        g_assert_cmpint(qlist_size(list), >, 0);
+        QDECREF(ret);
+    }
+
+    /* string arguments are parsed into the arena, too */
+    path = g_build_filename(fix.test_dir, "arena", NULL);
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-file-open',"
+                 " 'arguments': { 'path': %s, 'mode': 'w+' } }", path);
+    qmp_assert_no_error(ret);
+    id = qdict_get_int(ret, "return");
+    QDECREF(ret);
+
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-file-pwrite',"
+                 " 'arguments': { 'handle': %" PRId64 ", 'offset': 0,"
+                 " 'buf-b64': 'aGVsbG8gd29ybGQK' } }", id);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-file-pread',"
+                 " 'arguments': { 'handle': %" PRId64 ", 'offset': 0 } }",
+                 id);
+    qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpstr(qdict_get_str(val, "buf-b64"), ==, "aGVsbG8gd29ybGQK");
+    QDECREF(ret);
+
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-file-close',"
+                 " 'arguments': { 'handle': %" PRId64 " } }", id);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+
+    /* errors and nested dispatch */
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-batch', 'arguments': {"
+                 "'commands': [ {'execute': 'guest-sync',"
+                 "               'arguments': {'id': 42}},"
+                 "              {'execute': 'guest-invalid-cmd'} ] } }");
+    qmp_assert_no_error(ret);
+    list = qdict_get_qlist(ret, "return");
+    g_assert_cmpint(qlist_size(list), ==, 2);
+    QDECREF(ret);
+
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-file-close',"
+                 " 'arguments': { 'handle': -1 } }");
+    g_assert_nonnull(qdict_get_qdict(ret, "error"));
+    QDECREF(ret);
+
+    ret = qmp_fd(fix.fd, "{'execute': 'guest-get-agent-stats'}");
     qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "arena-allocations"), >, 0);
     QDECREF(ret);
 
+    unlink(path);
+    g_free(path);
     fixture_tear_down(&fix, NULL);
 }
 
@@ -620,7 +2005,12 @@ static void test_qga_config(gconstpointer data)
         "pidfile=/var/foo/qemu-ga.pid\n"
         "statedir=/var/state\n"
         "verbose=true\n"
-        "blacklist=guest-ping;guest-get-time\n";
+        "blacklist=guest-ping;guest-get-time\n"
+        "metrics-interval=5\n"
+        "disk-threshold=90\n"
+        "oom-events=true\n"
+        "max-connections=4\n"
+        "dispatch-arena=true\n";
 
     tmp = g_file_open_tmp(NULL, &conf, &error);
     g_assert_no_error(error);
@@ -689,6 +2079,24 @@ static void test_qga_config(gconstpointer data)
     g_assert_no_error(error);
     g_strfreev(strv);
 
+    g_assert_cmpint(g_key_file_get_integer(kf, "general", "metrics-interval",
+                                           &error), ==, 5);
+    g_assert_no_error(error);
+    g_assert_cmpint(g_key_file_get_integer(kf, "general", "disk-threshold",
+                                           &error), ==, 90);
+    g_assert_no_error(error);
+    g_assert_cmpint(g_key_file_get_integer(kf, "general", "memory-threshold",
+                                           &error), ==, 0);
+    g_assert_no_error(error);
+    g_assert_true(g_key_file_get_boolean(kf, "general", "oom-events", &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(g_key_file_get_integer(kf, "general", "max-connections",
+                                           &error), ==, 4);
+    g_assert_no_error(error);
+    g_assert_true(g_key_file_get_boolean(kf, "general", "dispatch-arena",
+                                         &error));
+    g_assert_no_error(error);
+
     g_free(out);
     g_free(err);
     g_free(conf);
@@ -738,6 +2146,395 @@ static void test_qga_fsfreeze_and_thaw(gconstpointer fix)
     QDECREF(ret);
 }
 
+static void test_qga_fsfreeze_parallel(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *val, *mount;
+    const QListEntry *entry;
+    int64_t count = 0;
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-fsfreeze-freeze-parallel',"
+                 " 'arguments': {'sync-threads': 4}}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+
+    val = qdict_get_qdict(ret, "return");
+    g_assert_cmpint(qdict_get_int(val, "time"), >=, 0);
+    entry = qlist_first(qdict_get_qlist(val, "mounts"));
+    for (; entry; entry = qlist_next(entry)) {
+        mount = qobject_to_qdict(entry->value);
+        g_assert_cmpint(qdict_get_int(mount, "sync-time"), >=, 0);
+        g_assert_cmpint(qdict_get_int(mount, "frozen-time"), <=,
+                        qdict_get_int(val, "time"));
+        count += qdict_get_bool(mount, "frozen");
+    }
+    g_assert_cmpint(qdict_get_int(val, "count"), ==, count);
+    QDECREF(ret);
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-fsfreeze-status'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    g_assert_cmpstr(qdict_get_try_str(ret, "return"), ==, "frozen");
+    QDECREF(ret);
+
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-fsfreeze-thaw'}");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    g_assert_cmpint(qdict_get_int(ret, "return"), ==, count);
+    QDECREF(ret);
+}
+
+static void perf_qga_collectors(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    const char *cmds[] = {
+        "guest-get-system-info",
+        "guest-get-disk-status",
+        "guest-get-app-status",
+        NULL
+    };
+    unsigned int i, j, max;
+    double duration;
+    QDict *ret;
+
+    max = 100;
+
+    for (i = 0; cmds[i]; i++) {
+        g_test_timer_start();
+        for (j = 0; j < max; j++) {
+            ret = qmp_fd(fixture->fd, "{'execute': %s}", cmds[i]);
+            g_assert_nonnull(ret);
+            qmp_assert_no_error(ret);
+            QDECREF(ret);
+        }
+        duration = g_test_timer_elapsed();
+
+        g_test_message("%s %u calls: %f s, %f ms/call\n", cmds[i], max,
+                       duration, duration * 1000 / max);
+    }
+}
+
+static void perf_qga_file_raw(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    const size_t size = 64 * 1024 * 1024;
+    const int64_t b64_chunk = 1024 * 1024;
+    int64_t id, chunk_size, count;
+    guchar *buf;
+    gchar *path;
+    double duration;
+    QDict *ret, *val;
+    bool eof;
+
+    buf = g_malloc0(size);
+    path = g_build_filename(fixture->test_dir, "raw-perf", NULL);
+    g_assert(g_file_set_contents(path, (gchar *)buf, size, NULL));
+
+    /* base64 reads, for comparison */
+    id = qga_file_open(fixture->fd, "raw-perf", "r");
+    g_test_timer_start();
+    do {
+        ret = qmp_fd(fixture->fd, "{'execute': 'guest-file-read',"
+                     " 'arguments': {'handle': %" PRId64 ","
+                     " 'count': %" PRId64 "} }", id, b64_chunk);
+        g_assert_nonnull(ret);
+        qmp_assert_no_error(ret);
+        val = qdict_get_qdict(ret, "return");
+        count = qdict_get_int(val, "count");
+        eof = qdict_get_bool(val, "eof");
+        QDECREF(ret);
+    } while (count && !eof);
+    duration = g_test_timer_elapsed();
+    g_test_message("guest-file-read %zu MiB: %f s, %f MiB/s\n",
+                   size >> 20, duration, (size >> 20) / duration);
+    qga_file_close(fixture->fd, id);
+
+    chunk_size = qga_set_binary_transfer(fixture->fd, true, 1024 * 1024);
+
+    id = qga_file_open(fixture->fd, "raw-perf", "r+");
+    g_test_timer_start();
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-file-read-raw',"
+                 " 'arguments': {'handle': %" PRId64 "} }", id);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+    g_assert_cmpint(qga_receive_frames(fixture->fd, buf, size, chunk_size),
+                    ==, size);
+    duration = g_test_timer_elapsed();
+    g_test_message("guest-file-read-raw %zu MiB: %f s, %f MiB/s\n",
+                   size >> 20, duration, (size >> 20) / duration);
+
+    g_test_timer_start();
+    qmp_fd_send(fixture->fd, "{'execute': 'guest-file-write-raw',"
+                " 'arguments': {'handle': %" PRId64 "} }", id);
+    qga_send_frames(fixture->fd, buf, size, chunk_size);
+    ret = qmp_fd_receive(fixture->fd);
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    QDECREF(ret);
+    duration = g_test_timer_elapsed();
+    g_test_message("guest-file-write-raw %zu MiB: %f s, %f MiB/s\n",
+                   size >> 20, duration, (size >> 20) / duration);
+
+    qga_file_close(fixture->fd, id);
+    qga_set_binary_transfer(fixture->fd, false, 0);
+
+    unlink(path);
+    g_free(path);
+    g_free(buf);
+}
+
+/* run @cmd @max times, report the bytes it took on the channel and latency */
+static void perf_qga_compression_run(int fd, const char *cmd,
+                                     const char *desc, unsigned int max)
+{
+    size_t wire = 0;
+    unsigned int i;
+    double duration;
+    bool compressed;
+    QDict *ret;
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        qmp_fd_send(fd, cmd);
+        ret = qga_receive_response(fd, &wire, &compressed);
+        qmp_assert_no_error(ret);
+        QDECREF(ret);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("%s: %zu bytes/call, %f ms/call\n", desc, wire / max,
+                   duration * 1000 / max);
+}
+
+static void perf_qga_compression(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    const size_t size = 1024 * 1024;
+    const unsigned int max = 50;
+    const char *cmds[] = {
+        "{'execute': 'guest-info'}",
+        "{'execute': 'guest-get-fsinfo'}",
+        "{'execute': 'guest-network-get-interfaces'}",
+        "{'execute': 'guest-get-processes', 'arguments': {'count': 1000}}",
+        NULL
+    };
+    GString *log = g_string_new(NULL);
+    gchar *path, *cmd, *desc;
+    int64_t id;
+    int i, level;
+
+    /* something like a log file, for guest-file-read */
+    for (i = 0; log->len < size; i++) {
+        g_string_append_printf(log, "Oct 17 12:%02d:%02d guest qemu-ga: "
+                               "info: guest-ping called, seq %d\n",
+                               (i / 60) % 60, i % 60, i);
+    }
+    path = g_build_filename(fixture->test_dir, "compress-perf", NULL);
+    g_assert(g_file_set_contents(path, log->str, log->len, NULL));
+    id = qga_file_open(fixture->fd, "compress-perf", "r");
+    cmd = g_strdup_printf("{'execute': 'guest-file-pread',"
+                          " 'arguments': {'handle': %" PRId64 ","
+                          " 'offset': 0, 'count': %zu} }", id, size);
+
+    for (level = 0; level < 2; level++) {
+        for (i = 0; cmds[i]; i++) {
+            desc = g_strdup_printf("%s %s", level ? "zlib" : "plain", cmds[i]);
+            perf_qga_compression_run(fixture->fd, cmds[i], desc, max);
+            g_free(desc);
+        }
+        desc = g_strdup_printf("%s guest-file-pread 1MiB",
+                               level ? "zlib" : "plain");
+        perf_qga_compression_run(fixture->fd, cmd, desc, max);
+        g_free(desc);
+
+        qga_set_compression(fixture->fd, !level, 4096);
+    }
+
+    qga_file_close(fixture->fd, id);
+    unlink(path);
+    g_free(cmd);
+    g_free(path);
+    g_string_free(log, true);
+}
+
+/* @clients processes issue @max requests each, returns the time taken */
+static double perf_qga_multi_client_run(const char *path, const char *cmd,
+                                        int clients, unsigned int max)
+{
+    pid_t pids[clients];
+    unsigned int j;
+    int i, fd, status;
+    QDict *ret;
+
+    g_test_timer_start();
+    for (i = 0; i < clients; i++) {
+        pids[i] = fork();
+        g_assert_cmpint(pids[i], !=, -1);
+        if (pids[i]) {
+            continue;
+        }
+        fd = connect_qga((char *)path);
+        g_assert_cmpint(fd, !=, -1);
+        for (j = 0; j < max; j++) {
+            ret = qmp_fd(fd, cmd);
+            qmp_assert_no_error(ret);
+            QDECREF(ret);
+        }
+        close(fd);
+        _exit(EXIT_SUCCESS);
+    }
+    for (i = 0; i < clients; i++) {
+        g_assert_cmpint(waitpid(pids[i], &status, 0), ==, pids[i]);
+        g_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    }
+
+    return g_test_timer_elapsed();
+}
+
+static void perf_qga_multi_client(gconstpointer data)
+{
+    const char *cmds[] = {
+        "{'execute': 'guest-ping'}",
+        "{'execute': 'guest-get-fsinfo'}",
+        "{'execute': 'guest-get-memory-blocks'}",
+        NULL
+    };
+    const unsigned int max = 500;
+    TestFixture fix;
+    char *path;
+    double duration;
+    int i, clients;
+
+    fixture_setup_with_conf(&fix, "[general]\n"
+                            "max-connections=8\n"
+                            "async-workers=4\n");
+    path = g_build_filename(fix.test_dir, "sock", NULL);
+    /* leave all connections to the clients */
+    close(fix.fd);
+
+    for (i = 0; cmds[i]; i++) {
+        for (clients = 1; clients <= 8; clients *= 2) {
+            duration = perf_qga_multi_client_run(path, cmds[i], clients, max);
+            g_test_message("%s, %d clients: %f s, %f requests/s\n", cmds[i],
+                           clients, duration, clients * max / duration);
+        }
+    }
+
+    fixture_tear_down(&fix, NULL);
+    g_free(path);
+}
+
+/*
+ * Time from connecting to the first response. The agent has to notice
+ * that the previous client went away before it takes the next one.
+ */
+static void perf_qga_reconnect(gconstpointer data)
+{
+    const unsigned int max = 100;
+    TestFixture fix;
+    double duration, total = 0, worst = 0;
+    unsigned int i;
+    char *path;
+    QDict *ret;
+    int fd;
+
+    fixture_setup(&fix, NULL);
+    path = g_build_filename(fix.test_dir, "sock", NULL);
+    close(fix.fd);
+
+    for (i = 0; i < max; i++) {
+        g_test_timer_start();
+        fd = connect_qga(path);
+        g_assert_cmpint(fd, !=, -1);
+        ret = qmp_fd(fd, "{'execute': 'guest-ping'}");
+        duration = g_test_timer_elapsed();
+        qmp_assert_no_error(ret);
+        QDECREF(ret);
+        close(fd);
+
+        total += duration;
+        worst = MAX(worst, duration);
+    }
+    g_test_message("first response after reconnect: %f ms average,"
+                   " %f ms worst\n", total * 1000 / max, worst * 1000);
+
+    fixture_tear_down(&fix, NULL);
+    g_free(path);
+}
+
+/* peak resident set size of @pid, in KiB */
+static int64_t perf_qga_peak_rss(GPid pid)
+{
+    gchar *path, *status, *line;
+    int64_t rss = -1;
+
+    path = g_strdup_printf("/proc/%d/status", (int)pid);
+    if (g_file_get_contents(path, &status, NULL, NULL)) {
+        line = strstr(status, "VmHWM:");
+        if (line) {
+            rss = g_ascii_strtoll(line + strlen("VmHWM:"), NULL, 10);
+        }
+        g_free(status);
+    }
+    g_free(path);
+
+    return rss;
+}
+
+/* latency and agent memory use for guest-exec-status with 16MB of output */
+static void perf_qga_exec_status(gconstpointer data)
+{
+    const unsigned int max = 5;
+    const char *b64;
+    TestFixture fix;
+    double duration, total = 0;
+    int64_t pid, rss;
+    size_t size = 0;
+    unsigned int i;
+    QDict *ret, *val;
+
+    fixture_setup(&fix, NULL);
+    rss = perf_qga_peak_rss(fix.pid);
+
+    for (i = 0; i < max; i++) {
+        /* 12MiB of output is 16MiB of base64 */
+        ret = qmp_fd(fix.fd, "{'execute': 'guest-exec', 'arguments': {"
+                     " 'path': '/bin/sh', 'arg': [ '-c',"
+                     " 'head -c 12582912 /dev/urandom' ],"
+                     " 'capture-output': true } }");
+        qmp_assert_no_error(ret);
+        pid = qdict_get_int(qdict_get_qdict(ret, "return"), "pid");
+        QDECREF(ret);
+
+        for (;;) {
+            g_test_timer_start();
+            ret = qmp_fd(fix.fd, "{'execute': 'guest-exec-status',"
+                         " 'arguments': { 'pid': %" PRId64 " } }", pid);
+            duration = g_test_timer_elapsed();
+            qmp_assert_no_error(ret);
+            val = qdict_get_qdict(ret, "return");
+            if (qdict_get_bool(val, "exited")) {
+                break;
+            }
+            QDECREF(ret);
+            g_usleep(10 * 1000);
+        }
+        b64 = qdict_get_try_str(val, "out-data");
+        g_assert_nonnull(b64);
+        size = strlen(b64);
+        total += duration;
+        QDECREF(ret);
+    }
+
+    g_test_message("guest-exec-status, %zu bytes of out-data: %f ms/call\n",
+                   size, total * 1000 / max);
+    g_test_message("agent peak RSS: %" PRId64 " KiB at start, %" PRId64
+                   " KiB after\n", rss, perf_qga_peak_rss(fix.pid));
+
+    fixture_tear_down(&fix, NULL);
+}
+
 int main(int argc, char **argv)
 {
     TestFixture fix;
@@ -751,30 +2548,71 @@ int main(int argc, char **argv)
     g_test_add_data_func("/qga/sync", &fix, test_qga_sync);
     g_test_add_data_func("/qga/ping", &fix, test_qga_ping);
     g_test_add_data_func("/qga/info", &fix, test_qga_info);
+    g_test_add_data_func("/qga/batch", &fix, test_qga_batch);
+    g_test_add_data_func("/qga/agent-stats", &fix, test_qga_agent_stats);
     g_test_add_data_func("/qga/network-get-interfaces", &fix,
                          test_qga_network_get_interfaces);
     g_test_add_data_func("/qga/get-vcpus", &fix, test_qga_get_vcpus);
+    g_test_add_data_func("/qga/set-vcpus-async", &fix,
+                         test_qga_set_vcpus_async);
     g_test_add_data_func("/qga/get-fsinfo", &fix, test_qga_get_fsinfo);
     g_test_add_data_func("/qga/get-memory-block-info", &fix,
                          test_qga_get_memory_block_info);
     g_test_add_data_func("/qga/get-memory-blocks", &fix,
                          test_qga_get_memory_blocks);
+    g_test_add_data_func("/qga/get-memory-status", &fix,
+                         test_qga_get_memory_status);
+    g_test_add_data_func("/qga/get-oom-status", &fix,
+                         test_qga_get_oom_status);
+    g_test_add_data_func("/qga/get-processes", &fix, test_qga_get_processes);
+    g_test_add_data_func("/qga/get-cpu-stats", &fix, test_qga_get_cpu_stats);
+    g_test_add_data_func("/qga/get-disk-io-stats", &fix,
+                         test_qga_get_disk_io_stats);
     g_test_add_data_func("/qga/file-ops", &fix, test_qga_file_ops);
+    g_test_add_data_func("/qga/file-raw", &fix, test_qga_file_raw);
+    g_test_add_data_func("/qga/file-pread", &fix, test_qga_file_pread);
+    g_test_add_data_func("/qga/compression", &fix, test_qga_compression);
+    g_test_add_data_func("/qga/file-delta", &fix, test_qga_file_delta);
+    g_test_add_data_func("/qga/exec-read", &fix, test_qga_exec_read);
     g_test_add_data_func("/qga/get-time", &fix, test_qga_get_time);
     g_test_add_data_func("/qga/invalid-cmd", &fix, test_qga_invalid_cmd);
     g_test_add_data_func("/qga/fsfreeze-status", &fix,
                          test_qga_fsfreeze_status);
 
     g_test_add_data_func("/qga/blacklist", NULL, test_qga_blacklist);
+    g_test_add_data_func("/qga/async", NULL, test_qga_async);
+    g_test_add_data_func("/qga/async-wedged", NULL, test_qga_async_wedged);
+    g_test_add_data_func("/qga/multi-client", NULL, test_qga_multi_client);
+    g_test_add_data_func("/qga/slow-client", NULL, test_qga_slow_client);
+#ifdef SYS_pidfd_getfd
+    g_test_add_data_func("/qga/virtio-serial", NULL, test_qga_virtio_serial);
+#endif
+    g_test_add_data_func("/qga/dispatch-arena", NULL,
+                         test_qga_dispatch_arena);
     g_test_add_data_func("/qga/config", NULL, test_qga_config);
 
     if (g_getenv("QGA_TEST_SIDE_EFFECTING")) {
         g_test_add_data_func("/qga/fsfreeze-and-thaw", &fix,
                              test_qga_fsfreeze_and_thaw);
+        g_test_add_data_func("/qga/fsfreeze-parallel", &fix,
+                             test_qga_fsfreeze_parallel);
         g_test_add_data_func("/qga/set-time", &fix, test_qga_set_time);
         g_test_add_data_func("/qga/fstrim", &fix, test_qga_fstrim);
     }
 
+    if (g_test_perf()) {
+        g_test_add_data_func("/perf/qga/collectors", &fix,
+                             perf_qga_collectors);
+        g_test_add_data_func("/perf/qga/file-raw", &fix, perf_qga_file_raw);
+        g_test_add_data_func("/perf/qga/compression", &fix,
+                             perf_qga_compression);
+        g_test_add_data_func("/perf/qga/multi-client", NULL,
+                             perf_qga_multi_client);
+        g_test_add_data_func("/perf/qga/reconnect", NULL, perf_qga_reconnect);
+        g_test_add_data_func("/perf/qga/exec-status", NULL,
+                             perf_qga_exec_status);
+    }
+
     ret = g_test_run();
 
     fixture_tear_down(&fix, NULL);
@@ -237,6 +237,45 @@ static void test_dealloc_partial(void)
     qapi_free_UserDefTwo(ud2);
 }
 
+static void qmp_filler_cmd(QDict *args, QObject **ret, Error **errp)
+{
+}
+
+/* roughly the size of the guest agent's command set */
+#define FILLER_COMMANDS 100
+
+/* dispatch rate with a realistically sized command registry */
+static void perf_dispatch(void)
+{
+    const char *name = NULL;
+    QDict *req;
+    QObject *resp;
+    double duration;
+    int i, max = 1000000;
+
+    for (i = 0; i < FILLER_COMMANDS; i++) {
+        name = g_strdup_printf("x-filler-command-%d", i);
+        qmp_register_command(name, qmp_filler_cmd, QCO_NO_OPTIONS);
+    }
+
+    /* the last command registered */
+    req = qdict_new();
+    qdict_put(req, "execute", qstring_from_str(name));
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        resp = qmp_dispatch(QOBJECT(req));
+        assert(resp != NULL);
+        assert(!qdict_haskey(qobject_to_qdict(resp), "error"));
+        qobject_decref(resp);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("%d dispatches: %f s, %f requests/s\n", max, duration,
+                   max / duration);
+
+    QDECREF(req);
+}
 
 int main(int argc, char **argv)
 {
@@ -247,6 +286,9 @@ int main(int argc, char **argv)
     g_test_add_func("/0.15/dispatch_cmd_io", test_dispatch_cmd_io);
     g_test_add_func("/0.15/dealloc_types", test_dealloc_types);
     g_test_add_func("/0.15/dealloc_partial", test_dealloc_partial);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/dispatch", perf_dispatch);
+    }
 
     module_call_init(MODULE_INIT_QAPI);
     g_test_run();
@@ -0,0 +1,180 @@
+/*
+ * Region allocator for short-lived object trees
+ *
+ * Copyright (c) 2015 Red Hat, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "qemu/arena.h"
+
+/* #define DEBUG_ARENA */
+
+#define ARENA_ALIGN 8
+#define ARENA_POISON 0x6b       /* fills reset memory with DEBUG_ARENA */
+
+/* precedes every allocation, so that it can be grown */
+typedef union QemuArenaHeader {
+    size_t size;
+    uint64_t align;
+} QemuArenaHeader;
+
+struct QemuArena {
+    char *base;
+    size_t size;
+    size_t max_size;
+    size_t used;
+    size_t spilled;             /* bytes that did not fit since the reset */
+    uint64_t allocs;
+};
+
+static __thread QemuArena *current_arena;
+
+QemuArena *qemu_arena_new(size_t size, size_t max_size)
+{
+    QemuArena *arena = g_new0(QemuArena, 1);
+
+    arena->size = QEMU_ALIGN_UP(size, ARENA_ALIGN);
+    arena->max_size = MAX(arena->size, max_size);
+    arena->base = g_malloc(arena->size);
+    return arena;
+}
+
+void qemu_arena_reset(QemuArena *arena)
+{
+    size_t want = arena->used + arena->spilled;
+
+#ifdef DEBUG_ARENA
+    memset(arena->base, ARENA_POISON, arena->used);
+#endif
+    if (want > arena->size && arena->size < arena->max_size) {
+        /* make room for the largest round seen so far */
+        while (arena->size < want && arena->size < arena->max_size) {
+            arena->size = MIN(arena->size * 2, arena->max_size);
+        }
+        g_free(arena->base);
+        arena->base = g_malloc(arena->size);
+    }
+    arena->used = 0;
+    arena->spilled = 0;
+}
+
+void qemu_arena_destroy(QemuArena *arena)
+{
+    assert(current_arena != arena);
+    g_free(arena->base);
+    g_free(arena);
+}
+
+QemuArena *qemu_arena_set_current(QemuArena *arena)
+{
+    QemuArena *old = current_arena;
+
+    current_arena = arena;
+    return old;
+}
+
+uint64_t qemu_arena_get_allocs(QemuArena *arena)
+{
+    return arena->allocs;
+}
+
+/* room taken after the header, never 0 so that a pointer is in the region */
+static size_t arena_len(size_t size)
+{
+    return QEMU_ALIGN_UP(MAX(size, 1), ARENA_ALIGN);
+}
+
+static bool arena_owns(QemuArena *arena, void *ptr)
+{
+    return (char *)ptr > arena->base && (char *)ptr < arena->base + arena->size;
+}
+
+static void *arena_alloc(QemuArena *arena, size_t size)
+{
+    size_t len = sizeof(QemuArenaHeader) + arena_len(size);
+    QemuArenaHeader *hdr;
+
+    if (len > arena->size - arena->used) {
+        /* told apart from arena memory by its address when freed */
+        arena->spilled += len;
+        return g_malloc(size);
+    }
+
+    hdr = (QemuArenaHeader *)(arena->base + arena->used);
+    hdr->size = size;
+    arena->used += len;
+    arena->allocs++;
+    return hdr + 1;
+}
+
+void *qemu_arena_malloc(size_t size)
+{
+    if (!current_arena) {
+        return g_malloc(size);
+    }
+    return arena_alloc(current_arena, size);
+}
+
+void *qemu_arena_malloc0(size_t size)
+{
+    if (!current_arena) {
+        return g_malloc0(size);
+    }
+    return memset(arena_alloc(current_arena, size), 0, size);
+}
+
+void *qemu_arena_realloc(void *ptr, size_t size)
+{
+    QemuArena *arena = current_arena;
+    QemuArenaHeader *hdr;
+    size_t old_len, new_len;
+    void *new;
+
+    if (!arena || (ptr && !arena_owns(arena, ptr))) {
+        return g_realloc(ptr, size);
+    }
+    if (!ptr) {
+        return arena_alloc(arena, size);
+    }
+
+    hdr = (QemuArenaHeader *)ptr - 1;
+    old_len = arena_len(hdr->size);
+    new_len = arena_len(size);
+    if ((char *)ptr + old_len == arena->base + arena->used) {
+        /* the most recent allocation grows in place */
+        if (new_len <= old_len ||
+            new_len - old_len <= arena->size - arena->used) {
+            arena->used = arena->used - old_len + new_len;
+            hdr->size = size;
+            return ptr;
+        }
+    } else if (size <= hdr->size) {
+        return ptr;
+    }
+
+    new = arena_alloc(arena, size);
+    memcpy(new, ptr, MIN(size, hdr->size));
+    return new;
+}
+
+char *qemu_arena_strdup(const char *str)
+{
+    size_t len;
+
+    if (!current_arena || !str) {
+        return g_strdup(str);
+    }
+    len = strlen(str) + 1;
+    return memcpy(arena_alloc(current_arena, len), str, len);
+}
+
+void qemu_arena_free(void *ptr)
+{
+    /* arena memory goes away with the next reset */
+    if (!current_arena || !arena_owns(current_arena, ptr)) {
+        g_free(ptr);
+    }
+}